@@ -0,0 +1,90 @@
+/**
+ * \file afterglow.cpp
+ *
+ * \brief Persistence effect implementation.
+ */
+
+#include "afterglow.hpp"
+#include "frame.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+using namespace std;
+using namespace chrono;
+
+// GCC and clang both turn these into SSE2 on x86 and NEON on the Pi, and
+// fall back to plain integer code anywhere else
+typedef uint8_t u8x16 __attribute__((vector_size(16)));
+typedef uint16_t u16x8 __attribute__((vector_size(16)));
+
+afterglow::afterglow()
+        : half_life_(0), keep_(0)
+{
+        reset();
+}
+
+void afterglow::configure(float half_life, microseconds interval)
+{
+        float keep;
+
+        half_life_ = half_life > 0 ? half_life : 0;
+        if (half_life_ == 0) {
+                keep_ = 0;
+                return;
+        }
+        // never keep all of it, or nothing would ever go dark
+        keep = 256*pow(0.5f, duration<float>(interval).count()/half_life_);
+        keep_ = min(255.0f, round(keep));
+}
+
+float afterglow::half_life() const
+{
+        return half_life_;
+}
+
+void afterglow::reset()
+{
+        memset(glow_, 0, sizeof(glow_));
+}
+
+void afterglow::apply(frame& f)
+{
+        // any character type may look at another object's bytes
+        uint8_t *bytes = reinterpret_cast<uint8_t *>(f.data());
+        u16x8 keep, low, high, pairs;
+        u8x16 old, cur, brighter;
+        size_t i;
+
+        static_assert(sizeof(frame) == BYTES,
+                      "a frame is 3 bytes of RGB per pixel, nothing else");
+        static_assert(BYTES % sizeof(u8x16) == 0, "whole vectors only");
+        if (keep_ == 0) {
+                memcpy(glow_, bytes, BYTES);
+                return;
+        }
+
+        for (i = 0; i < 8; ++i) {
+                keep[i] = keep_;
+                low[i] = 0x00ff;
+                high[i] = 0xff00;
+        }
+
+        // 8 bit channels times an 8.8 factor need 16 bits, so fade the
+        // even and odd bytes of each 16 bit lane separately. memcpy is
+        // how we do unaligned vector loads and stores without breaking
+        // aliasing rules; it compiles to a single instruction.
+        for (i = 0; i < BYTES; i += sizeof(u8x16)) {
+                memcpy(&pairs, glow_ + i, sizeof(pairs));
+                pairs = (((pairs & low)*keep) >> 8) |
+                        (((pairs >> 8)*keep) & high);
+                memcpy(&old, &pairs, sizeof(old));
+
+                memcpy(&cur, bytes + i, sizeof(cur));
+                brighter = (u8x16)(cur > old);
+                cur = (cur & brighter) | (old & ~brighter);
+                memcpy(bytes + i, &cur, sizeof(cur));
+                memcpy(glow_ + i, &cur, sizeof(cur));
+        }
+}
@@ -0,0 +1,46 @@
+/**
+ * \file afterglow.hpp
+ *
+ * \brief Persistence for generators that redraw every frame from scratch,
+ * so bars fade out instead of flickering at low frame rates.
+ *
+ * \detail afterglow keeps the last frame it output. Each new frame is
+ * merged with that frame dimmed by the decay: every color channel becomes
+ * the brighter of the new value and the faded old one. The decay is set
+ * as a half life in seconds and turned into an 8.8 fixed point factor per
+ * frame, and the merge runs 16 channels at a time over the frame's bytes.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+class frame;
+
+class afterglow {
+public:
+        // starts off
+        afterglow();
+
+        // half_life is how long a lit pixel takes to fade to half
+        // brightness, for frames interval apart. 0 turns the effect off.
+        void configure(float half_life, std::chrono::microseconds interval);
+
+        float half_life() const;
+
+        // forget the frames seen so far, e.g. at the start of a song
+        void reset();
+
+        // merge f with the faded previous output, in place
+        void apply(frame& f);
+
+private:
+        // frame.hpp includes us, so spell out a frame's size
+        static constexpr size_t BYTES = 3*32*32;
+
+        float half_life_;
+        uint16_t keep_;         // fraction of the old frame kept, /256
+        alignas(16) uint8_t glow_[BYTES];
+};
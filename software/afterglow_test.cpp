@@ -0,0 +1,92 @@
+/**
+ * \file afterglow_test.cpp
+ *
+ * \brief Tests for afterglow: pixels fade by the half life, brighter new
+ * channels win, and the vector code agrees with the obvious scalar loop.
+ */
+
+#include "afterglow.hpp"
+#include "frame.hpp"
+
+#include <cassert>
+#include <cstdlib>
+#include <iostream>
+
+using namespace std;
+using namespace chrono;
+
+static const seconds one_second(1);
+
+// what afterglow should do to one channel, keeping keep/256 of old
+static uint8_t expected(uint8_t old, uint8_t cur, unsigned keep)
+{
+        return max<unsigned>(cur, old*keep >> 8);
+}
+
+int main(void)
+{
+        afterglow glow;
+        frame f, prev, want;
+        size_t i, round;
+
+        // off by default: frames go through untouched
+        f.fill(pixel(0, 0, 0));
+        f.at(3, 4) = pixel(200, 100, 50);
+        glow.apply(f);
+        f.fill(pixel(0, 0, 0));
+        glow.apply(f);
+        assert(f.at(3, 4).red() == 0);
+
+        // a half life of one frame halves each channel every frame
+        glow.configure(1, one_second);
+        glow.reset();
+        f.at(3, 4) = pixel(200, 100, 50);
+        glow.apply(f);
+        f.fill(pixel(0, 0, 0));
+        glow.apply(f);
+        assert(f.at(3, 4).red() == 100 && f.at(3, 4).green() == 50 &&
+               f.at(3, 4).blue() == 25);
+        f.fill(pixel(0, 0, 0));
+        glow.apply(f);
+        assert(f.at(3, 4).red() == 50);
+
+        // each channel takes the brighter of new and faded
+        f.fill(pixel(0, 0, 0));
+        f.at(3, 4) = pixel(10, 200, 0);
+        glow.apply(f);
+        assert(f.at(3, 4).red() == 25 && f.at(3, 4).green() == 200 &&
+               f.at(3, 4).blue() == 6);
+
+        // even the brightest pixel goes dark eventually
+        glow.configure(1000, microseconds(1));
+        for (round = 0; round < 2000; ++round) {
+                f.fill(pixel(0, 0, 0));
+                glow.apply(f);
+        }
+        assert(f.at(3, 4).green() == 0);
+
+        // random frames against the scalar version, at 20 frames/s
+        glow.configure(0.1, milliseconds(50));
+        glow.reset();
+        prev.fill(pixel(0, 0, 0));
+        srand(1);
+        for (round = 0; round < 50; ++round) {
+                for (i = 0; i < f.size(); ++i) {
+                        f[i] = pixel(rand() % 256, rand() % 256,
+                                     rand() % 3 ? 0 : rand() % 256);
+                        want[i] = pixel(
+                                expected(prev[i].red(), f[i].red(), 181),
+                                expected(prev[i].green(), f[i].green(), 181),
+                                expected(prev[i].blue(), f[i].blue(), 181));
+                }
+                glow.apply(f);
+                for (i = 0; i < f.size(); ++i)
+                        assert(f[i].red() == want[i].red() &&
+                               f[i].green() == want[i].green() &&
+                               f[i].blue() == want[i].blue());
+                prev = f;
+        }
+
+        cout << "test passed" << endl;
+        return 0;
+}
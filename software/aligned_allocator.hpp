@@ -0,0 +1,123 @@
+/**
+ * \file aligned_allocator.hpp
+ *
+ * \brief A std::allocator replacement for FFT workspaces and sample data:
+ * every buffer is 64 byte (cache line) aligned, so SIMD code can use
+ * aligned loads, and buffers of 2MB or more are backed by huge pages.
+ *
+ * \detail Big buffers first try explicit huge pages (MAP_HUGETLB, which
+ * needs pages reserved in /proc/sys/vm/nr_hugepages). Failing that they
+ * are mmapped on a 2MB boundary and madvised for transparent huge pages,
+ * which the kernel fills in if THP is enabled. Either way a whole song or
+ * a million point FFT needs a handful of TLB entries instead of thousands.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <vector>
+
+#include <sys/mman.h>
+
+namespace detail {
+
+const size_t HUGE_PAGE_SIZE = 2 << 20;
+
+inline size_t round_to_huge_page(size_t bytes)
+{
+        return (bytes + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+}
+
+inline void *alloc_huge(size_t bytes)
+{
+        const size_t len = round_to_huge_page(bytes);
+        uintptr_t start, aligned;
+        void *p;
+
+        p = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (p != MAP_FAILED)
+                return p;
+
+        // over allocate so we can trim to a huge page boundary; THP only
+        // backs aligned 2MB ranges
+        p = mmap(NULL, len + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED)
+                throw std::bad_alloc();
+        start = uintptr_t(p);
+        aligned = (start + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+        if (aligned > start)
+                munmap(p, aligned - start);
+        munmap((void *)(aligned + len), start + HUGE_PAGE_SIZE - aligned);
+#ifdef MADV_HUGEPAGE
+        madvise((void *)aligned, len, MADV_HUGEPAGE);
+#endif
+        return (void *)aligned;
+}
+
+inline void *alloc_aligned(size_t bytes, size_t align)
+{
+        void *p;
+
+        if (bytes >= HUGE_PAGE_SIZE)
+                return alloc_huge(bytes);
+        if (posix_memalign(&p, align, bytes ? bytes : 1) != 0)
+                throw std::bad_alloc();
+        return p;
+}
+
+inline void free_aligned(void *p, size_t bytes)
+{
+        if (bytes >= HUGE_PAGE_SIZE)
+                munmap(p, round_to_huge_page(bytes));
+        else
+                free(p);
+}
+
+} // namespace detail
+
+template <typename T, size_t Align = 64>
+class aligned_allocator {
+public:
+        typedef T value_type;
+
+        template <typename U>
+        struct rebind {
+                typedef aligned_allocator<U, Align> other;
+        };
+
+        aligned_allocator() = default;
+
+        template <typename U>
+        aligned_allocator(const aligned_allocator<U, Align>&) {}
+
+        T *allocate(size_t n)
+        {
+                return static_cast<T *>(
+                        detail::alloc_aligned(n*sizeof(T), Align));
+        }
+
+        void deallocate(T *p, size_t n)
+        {
+                detail::free_aligned(p, n*sizeof(T));
+        }
+
+        template <typename U>
+        bool operator==(const aligned_allocator<U, Align>&) const
+        {
+                return true;
+        }
+
+        template <typename U>
+        bool operator!=(const aligned_allocator<U, Align>&) const
+        {
+                return false;
+        }
+};
+
+template <typename T>
+using aligned_vector = std::vector<T, aligned_allocator<T>>;
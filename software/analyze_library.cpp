@@ -0,0 +1,110 @@
+/**
+ * \file analyze_library.cpp
+ *
+ * \brief Analyze every WAV under a directory into a library index (see
+ * library.hpp), or print an index. Run it again after adding or changing
+ * songs and only those are analyzed:
+ *
+ *     ./analyze_library ~/music [-o library.idx] [--threads n]
+ *     ./analyze_library --list library.idx [file.wav]
+ */
+
+#include "library.hpp"
+#include "fft_tuner.hpp"
+#include "task_pool.hpp"
+
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+
+using namespace std;
+
+static void usage(const char *prog)
+{
+        cerr << "usage: " << prog << " DIR [-o index] [--threads n]\n"
+             << "       " << prog << " --list index [file]" << endl;
+}
+
+static void print(const char *path, const track_features& t)
+{
+        cout << fixed << setprecision(1) << setw(7) << t.seconds << "s "
+             << setw(6) << t.tempo << "bpm " << setw(6) << t.loudness
+             << "dB " << setw(7) << setprecision(0) << t.centroid << "Hz  "
+             << path << endl;
+}
+
+static int list(const string& index_path, const char *file)
+{
+        library_index index(index_path);
+        const track_features *t;
+        size_t i;
+
+        if (file) {
+                if (!(t = index.find(file))) {
+                        cerr << file << " isn't in " << index_path << endl;
+                        return 1;
+                }
+                print(file, *t);
+                return 0;
+        }
+        for (i = 0; i < index.size(); ++i)
+                print(index.path(i), index[i]);
+        return 0;
+}
+
+int main(int argc, char **argv)
+{
+        string dir, index_path = "library.idx";
+        library_scan_stats stats;
+        unsigned threads = 0;
+        char *end;
+        int i;
+
+        if (argc >= 3 && argc <= 4 && strcmp(argv[1], "--list") == 0) {
+                try {
+                        return list(argv[2], argc == 4 ? argv[3] : NULL);
+                } catch (const runtime_error& e) {
+                        cerr << e.what() << endl;
+                        return 1;
+                }
+        }
+
+        for (i = 1; i < argc; ++i) {
+                if (strcmp(argv[i], "-o") == 0 && i+1 < argc) {
+                        index_path = argv[++i];
+                } else if (strcmp(argv[i], "--threads") == 0 && i+1 < argc) {
+                        threads = strtoul(argv[++i], &end, 10);
+                        if (!isdigit((unsigned char)argv[i][0]) || *end != '\0') {
+                                cerr << "bad --threads " << argv[i] << endl;
+                                return 1;
+                        }
+                } else if (argv[i][0] != '-' && dir.empty()) {
+                        dir = argv[i];
+                } else {
+                        usage(argv[0]);
+                        return 1;
+                }
+        }
+        if (dir.empty()) {
+                usage(argv[0]);
+                return 1;
+        }
+
+        // analyze with the FFT engines fft_tune picked for this machine
+        load_fft_wisdom();
+        task_pool::configure(threads);
+        try {
+                stats = scan_library(dir, index_path, task_pool::global(),
+                                     &cout);
+        } catch (const runtime_error& e) {
+                cerr << e.what() << endl;
+                return 1;
+        }
+        cout << stats.analyzed << " analyzed, " << stats.reused
+             << " unchanged, " << stats.failed << " unreadable, "
+             << stats.removed << " removed; wrote " << index_path << endl;
+        return 0;
+}
@@ -0,0 +1,44 @@
+/**
+ * \file beat.cpp
+ *
+ * \brief Beat detector implementation.
+ */
+
+#include "beat.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+
+beat_detector::beat_detector()
+{
+        reset();
+}
+
+void beat_detector::reset()
+{
+        average_ = 0;
+        since_beat_ = 0;
+        pulse_ = 0;
+}
+
+bool beat_detector::update(float bass, float dt)
+{
+        bool beat = false;
+
+        since_beat_ += dt;
+        pulse_ *= pow(0.5f, dt/0.1f);
+        if (bass > average_ + 0.05f && since_beat_ >= 0.25f) {
+                pulse_ = 1;
+                since_beat_ = 0;
+                beat = true;
+        }
+        average_ += (bass - average_)*min(1.0f, dt/0.5f);
+        return beat;
+}
+
+float beat_detector::pulse() const
+{
+        return pulse_;
+}
@@ -0,0 +1,33 @@
+/**
+ * \file beat.hpp
+ *
+ * \brief A cheap beat detector for generators that want to react to the
+ * rhythm.
+ *
+ * \detail A beat is the bass jumping well over its average of the last
+ * half second, at most 4 times a second. Each beat sets a pulse to 1,
+ * which halves every 0.1s, for visuals that flash and fade.
+ */
+
+#pragma once
+
+class beat_detector {
+public:
+        beat_detector();
+
+        // forget the song so far
+        void reset();
+
+        // feed the bass level (e.g. the average of the lowest few
+        // bands) of a frame dt seconds after the last one. Returns true
+        // if it's a beat.
+        bool update(float bass, float dt);
+
+        // 1 on a beat, fading towards 0 until the next
+        float pulse() const;
+
+private:
+        float average_;
+        float since_beat_;
+        float pulse_;
+};
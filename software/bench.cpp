@@ -0,0 +1,420 @@
+/**
+ * \file bench.cpp
+ *
+ * \brief Microbenchmarks for the stages of the render loop, with hardware
+ * counters so we can tell compute bound stages from cache bound ones.
+ *
+ * \detail usage: bench song.wav [--iterations n] [--spi]
+ *
+ * Each stage is run once to warm up, then under perf_counters enough
+ * times to do n runs' worth of a 4096 unit stage (at least once).
+ * Results are per unit of work (a sample for audio stages, a pixel for
+ * output stages): time, cycles, instructions per cycle and misses. Any
+ * counter the machine won't give us prints as "-". frame::write drives the
+ * real SPI bus, so it only runs with --spi, on the Pi.
+ *
+ * Every fft_backend built in (except the O(n^2) reference) is timed at the
+ * FFT sizes our frame rates produce, and its error against the reference
+ * is printed first.
+ */
+
+#include "afterglow.hpp"
+#include "aligned_allocator.hpp"
+#include "chroma.hpp"
+#include "fft.hpp"
+#include "expr.hpp"
+#include "fft_backend.hpp"
+#include "filterbank.hpp"
+#include "frame.hpp"
+#include "particles.hpp"
+#include "perf_counters.hpp"
+#include "pipeline.hpp"
+#include "pitch.hpp"
+#include "player.hpp"
+#include "sample_store.hpp"
+#include "wav_reader.hpp"
+
+#include <chrono>
+#include <complex>
+#include <cstring>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace std;
+using namespace chrono;
+
+// largest difference between backend b and the reference on input
+static float backend_error(fft_backend& b, const spectrum& input)
+{
+        spectrum expect = input, got = input;
+        float err = 0;
+        size_t i;
+
+        find_fft_backend("reference")->forward(expect);
+        b.forward(got);
+        for (i = 0; i < expect.size(); ++i)
+                err = max(err, abs(got[i] - expect[i]));
+        return err;
+}
+
+// fixed band levels for FRAMES frames, so the drawing stages can be timed
+// without an FFT in the way
+struct test_bands_stage : pipeline_stage {
+        typedef pipeline_start input_type;
+        typedef frame_generator::band_levels output_type;
+
+        static const unsigned FRAMES = 64;
+
+        bool operator()(frame_context& ctx, const pipeline_start&,
+                        output_type& out)
+        {
+                size_t i;
+
+                for (i = 0; i < out.size(); ++i)
+                        out[i] = (ctx.start.count()/1000 + 37*i) % 100/100.0;
+                return ctx.start < ctx.interval*FRAMES;
+        }
+};
+
+struct stage {
+        string name;
+        const char *unit;       // what the per unit numbers are per
+        size_t units;           // units of work in one run
+        function<void()> run;
+};
+
+static void print_header()
+{
+        cout << left << setw(24) << "stage" << right
+             << setw(10) << "ns/unit" << setw(10) << "cyc/unit"
+             << setw(8) << "IPC" << setw(10) << "L1d/unit"
+             << setw(10) << "LLC/unit" << setw(10) << "br/unit"
+             << "  unit" << endl;
+}
+
+// a counter per unit, or "-" if we don't have it
+static void print_per_unit(const perf_counters::reading& r,
+                           perf_counters::event e, double units)
+{
+        if (r.valid[e])
+                cout << setw(10) << fixed << setprecision(3)
+                     << r.value[e]/units;
+        else
+                cout << setw(10) << "-";
+}
+
+static void run_stage(const stage& s, perf_counters& counters,
+                      unsigned iterations)
+{
+        perf_counters::reading r;
+        steady_clock::time_point start;
+        nanoseconds elapsed;
+        double units;
+        unsigned i;
+
+        iterations = max<size_t>(1, iterations*4096/s.units);
+        units = double(s.units)*iterations;
+        s.run();
+
+        start = steady_clock::now();
+        counters.start();
+        for (i = 0; i < iterations; ++i)
+                s.run();
+        r = counters.stop();
+        elapsed = steady_clock::now() - start;
+
+        cout << left << setw(24) << s.name << right << setw(10) << fixed
+             << setprecision(3) << elapsed.count()/units;
+        print_per_unit(r, perf_counters::CYCLES, units);
+        if (r.valid[perf_counters::CYCLES] &&
+            r.valid[perf_counters::INSTRUCTIONS] &&
+            r.value[perf_counters::CYCLES] > 0)
+                cout << setw(8) << setprecision(2)
+                     << double(r.value[perf_counters::INSTRUCTIONS])/
+                        r.value[perf_counters::CYCLES];
+        else
+                cout << setw(8) << "-";
+        print_per_unit(r, perf_counters::L1D_MISSES, units);
+        print_per_unit(r, perf_counters::LLC_MISSES, units);
+        print_per_unit(r, perf_counters::BRANCH_MISSES, units);
+        cout << "  " << s.unit << endl;
+}
+
+int main(int argc, char **argv)
+{
+        const microseconds interval(50*1000);
+        unsigned iterations = 200;
+        bool spi = false;
+        vector<stage> stages;
+        vector<complex<float>> small_input, big_input, std_data;
+        spectrum aligned_data, backend_input[3], backend_data, binned;
+        const size_t backend_sizes[3] = { 1024, 2048, 4096 };
+        microseconds song_length, offset(0);
+        size_t range_units, lit = 0, i;
+        frame f, bars;
+        frame::packed packed;
+        afterglow glow;
+        int a;
+
+        if (argc < 2) {
+                cerr << "usage: " << argv[0]
+                     << " song.wav [--iterations n] [--spi]" << endl;
+                return 1;
+        }
+        for (a = 2; a < argc; ++a) {
+                if (strcmp(argv[a], "--iterations") == 0 && a+1 < argc)
+                        iterations = max(1, stoi(argv[++a]));
+                else if (strcmp(argv[a], "--spi") == 0)
+                        spi = true;
+                else {
+                        cerr << "unknown option " << argv[a] << endl;
+                        return 1;
+                }
+        }
+
+        wav_reader song(argv[1]);
+        range_units = song.get_range(microseconds(0), interval).size();
+        song_length = interval*song.get_all_samples().size()/range_units;
+
+        for (i = 0; i < 4096; ++i)
+                small_input.push_back(cos(0.01f*i*i));
+        for (i = 0; i < 1 << 20; ++i)
+                big_input.push_back(cos(0.01f*i*i));
+
+        // std::vector against aligned_allocator, at frame size and at
+        // whole song size where huge pages matter
+        stages.push_back({"fft 4096", "sample", small_input.size(), [&]() {
+                std_data = small_input;
+                fft(std_data);
+        }});
+        stages.push_back({"fft 4096 aligned", "sample", small_input.size(),
+                          [&]() {
+                aligned_data.assign(small_input.begin(), small_input.end());
+                fft(aligned_data);
+        }});
+        stages.push_back({"fft 1M", "sample", big_input.size(), [&]() {
+                std_data = big_input;
+                fft(std_data);
+        }});
+        stages.push_back({"fft 1M aligned", "sample", big_input.size(),
+                          [&]() {
+                aligned_data.assign(big_input.begin(), big_input.end());
+                fft(aligned_data);
+        }});
+
+        // 44, 30 and 20 frames per second at 44.1kHz
+        for (a = 0; a < 3; ++a) {
+                backend_input[a].assign(small_input.begin(),
+                                        small_input.begin() +
+                                        backend_sizes[a]);
+                for (fft_backend *b : fft_backends()) {
+                        if (string(b->name()) == "reference")
+                                continue;
+                        const spectrum& in = backend_input[a];
+                        stages.push_back({string("fft ") + b->name() + " " +
+                                          to_string(in.size()),
+                                          "sample", in.size(), [&, b]() {
+                                backend_data = in;
+                                b->forward(backend_data);
+                        }});
+                }
+        }
+        for (fft_backend *b : fft_backends())
+                cout << b->name() << " max error vs reference at 4096: "
+                     << backend_error(*b, backend_input[2]) << endl;
+        // walk through the song so we see its real access pattern
+        stages.push_back({"get_range 50ms", "sample", range_units, [&]() {
+                song.get_range(offset, interval);
+                offset += interval;
+                if (offset + interval > song_length)
+                        offset = microseconds(0);
+        }});
+
+        // the same from a compressed copy, and a block decode on its own:
+        // stepping past the cache's worth of blocks always misses
+        wav_reader compressed(argv[1], true);
+        const size_t blocks = compressed.size()/sample_store::BLOCK;
+        microseconds compressed_offset(0);
+        size_t cold = 0;
+        cout << "compressed samples take " << compressed.sample_bytes()
+             << " of " << song.sample_bytes() << " bytes" << endl;
+        stages.push_back({"get_range 50ms compressed", "sample", range_units,
+                          [&]() {
+                compressed.get_range(compressed_offset, interval);
+                compressed_offset += interval;
+                if (compressed_offset + interval > song_length)
+                        compressed_offset = microseconds(0);
+        }});
+        stages.push_back({"sample_store decode", "sample",
+                          sample_store::BLOCK, [&]() {
+                compressed.get_range(microseconds(
+                        uint64_t(cold)*sample_store::BLOCK*1000000/
+                        compressed.sample_rate() + 1), microseconds(100));
+                cold = (cold + sample_store::CACHED + 1) % blocks;
+        }});
+
+        for (i = 0; i < f.size(); ++i)
+                f[i] = pixel(i, 2*i, 3*i);
+        stages.push_back({"frame::pack", "pixel", f.size(), [&]() {
+                f.pack(packed);
+        }});
+        glow.configure(0.1, interval);
+        stages.push_back({"afterglow", "pixel", bars.size(), [&]() {
+                bars.fill(pixel(0, 0, 0));
+                bars.at(lit++ % frame::WIDTH, 0) = f[0];
+                glow.apply(bars);
+        }});
+
+        // the same stages fused by pipeline_generator, and chained through
+        // std::function in a lambda_generator
+        auto fused = make_pipeline(20, test_bands_stage(), bars_stage(),
+                                   afterglow_stage(0.1));
+        function<bool(frame_context&, const pipeline_start&,
+                      frame_generator::band_levels&)> source =
+                test_bands_stage();
+        function<bool(frame_context&, const frame_generator::band_levels&,
+                      frame&)> draw = bars_stage();
+        afterglow_stage fade(0.1);
+        fade.glow.configure(0.1, interval);
+        function<bool(frame_context&, const frame&, frame&)> effect = fade;
+        frame_generator::band_levels dyn_bands;
+        lambda_generator dynamic(20, [&](const wav_reader& s,
+                                         microseconds start, frame& out) {
+                frame_context ctx(dynamic, s, start, interval);
+                return source(ctx, pipeline_start(), dyn_bands) &&
+                        draw(ctx, dyn_bands, out) && effect(ctx, out, out);
+        });
+        stages.push_back({"bars+glow pipeline", "frame",
+                          test_bands_stage::FRAMES, [&]() {
+                fused->render_song(song, [](const frame&) {});
+        }});
+        stages.push_back({"bars+glow function", "frame",
+                          test_bands_stage::FRAMES, [&]() {
+                dynamic.render_song(song, [](const frame&) {});
+        }});
+
+        // binning one spectrum into 32 log spaced bands (what static and
+        // scrolling do) against mapping it to notes (chroma)
+        note_map notes(4096, song.sample_rate());
+        note_map::note_levels note_levels;
+        frame_generator::band_levels band_levels;
+        frame_context band_ctx(*fused, song, microseconds(0), interval);
+        binned = backend_input[2];
+        default_fft_backend().forward(binned);
+        stages.push_back({"bin_spectrum 4096", "bin", binned.size(), [&]() {
+                band_ctx.bin_spectrum(binned, 0, binned.size()/2 - 20,
+                                      band_levels);
+        }});
+        stages.push_back({"note_map 4096", "bin", binned.size(), [&]() {
+                notes.apply(binned, note_levels);
+        }});
+
+        // an expression program, against the same thing as plain C++
+        expr_program plasma(
+                "v = sin(10*x + t) + sin(10*y + t/2)\n"
+                "r = 0.5 + 0.5*sin(v*pi + 3*bass)\n"
+                "b = (y < band)*(0.4 + level) + 0.5*beat\n");
+        expr_inputs plasma_in = { 1, 0.5, 0.5, 0.5, {} };
+        stages.push_back({"expr plasma", "pixel", bars.size(), [&]() {
+                plasma.render(plasma_in, bars);
+                plasma_in.t += 0.05;
+        }});
+        stages.push_back({"plasma in C++", "pixel", bars.size(), [&]() {
+                const expr_inputs& in = plasma_in;
+                size_t col, row;
+                float x, y, v;
+
+                for (row = 0; row < frame::HEIGHT; ++row) {
+                        y = float(frame::HEIGHT - 1 - row)/
+                                (frame::HEIGHT - 1);
+                        for (col = 0; col < frame::WIDTH; ++col) {
+                                x = float(col)/(frame::WIDTH - 1);
+                                v = sin(10*x + in.t) + sin(10*y + in.t/2);
+                                bars.at(col, row) = pixel(
+                                        255*(0.5f + 0.5f*sin(v*float(M_PI) +
+                                                             3*in.bass)),
+                                        0,
+                                        255*min(1.0f, (y < in.bands[col])*
+                                                (0.4f + in.level) +
+                                                0.5f*in.beat));
+                        }
+                }
+                plasma_in.t += 0.05;
+        }});
+
+        // pitch of a 50ms slice from the middle of the song
+        spectrum slice;
+        pitch_tracker tracker;
+        pitch_estimate pitch;
+        frame_context(*fused, song, song_length/2, interval)
+                .make_spectrum(slice);
+        stages.push_back({"pitch_tracker", "bin", slice.size(), [&]() {
+                tracker.analyze(slice, song.sample_rate(), pitch);
+        }});
+
+        // the two ways to get 32 band levels from a block of samples: FFT
+        // then bin, or run it through a filter per band
+        vector<float> block(small_input.size());
+        filterbank filters;
+        for (i = 0; i < block.size(); ++i)
+                block[i] = small_input[i].real();
+        filters.configure(44100, 50, 44100/4);
+        stages.push_back({"fft+bin_spectrum 4096", "sample", block.size(),
+                          [&]() {
+                backend_data.assign(block.begin(), block.end());
+                default_fft_backend().forward(backend_data);
+                band_ctx.bin_spectrum(backend_data, 0,
+                                      backend_data.size()/2 - 20,
+                                      band_levels);
+        }});
+        stages.push_back({"filterbank 32 bands", "sample", block.size(),
+                          [&]() {
+                filters.process(block.data(), block.size());
+                filters.envelopes(band_levels);
+        }});
+
+        // a full particle pool: refill, move and draw, as particle_generator
+        // does each frame
+        unique_ptr<particle_pool> sparks(new particle_pool);
+        stages.push_back({"particles", "particle", particle_pool::CAPACITY,
+                          [&]() {
+                for (i = sparks->size(); i < particle_pool::CAPACITY; ++i)
+                        sparks->spawn(i % frame::WIDTH + 0.5f, i % 29 + 1,
+                                      float(i % 7) - 3, float(i % 5) + 2,
+                                      0.5f + (i % 11)*0.1f,
+                                      pixel(i % 64, 32, 255 - i % 64));
+                sparks->step(1.0f/30, -30);
+                sparks->draw(bars);
+        }});
+
+        if (spi) {
+                init_display();
+                // write skips a frame the panel already shows, and packing
+                // keeps only the top bits of each gamma corrected channel,
+                // so swap between two reds that pack differently
+                stages.push_back({"frame::write", "pixel", f.size(), [&]() {
+                        f[0].red() = f[0].red() == 0 ? 255 : 0;
+                        f.write();
+                }});
+        }
+
+        perf_counters counters;
+        if (!counters.any_available())
+                cerr << "no hardware counters (check "
+                     << "/proc/sys/kernel/perf_event_paranoid); timing only"
+                     << endl;
+        for (a = 0; a < perf_counters::EVENTS; ++a)
+                if (counters.any_available() &&
+                    !counters.available(perf_counters::event(a)))
+                        cerr << perf_counters::name(perf_counters::event(a))
+                             << " counter unavailable" << endl;
+
+        print_header();
+        for (const stage& s : stages)
+                run_stage(s, counters, iterations);
+        return 0;
+}
@@ -0,0 +1,181 @@
+/**
+ * \file chroma.cpp
+ *
+ * \brief note_map and chroma_generator.
+ */
+
+#include "chroma.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+using namespace chrono;
+
+note_map::note_map(size_t fft_size, unsigned sample_rate)
+        : fft_size_(fft_size), sample_rate_(sample_rate)
+{
+        const float bins_per_hz = float(fft_size)/sample_rate;
+        const size_t nyquist = fft_size/2;
+        size_t k, lo, hi;
+        unsigned n;
+        float note, b, w;
+
+        for (n = 0; n < NOTES; ++n) {
+                first_[n] = entries_.size();
+                note = FIRST_NOTE + int(n);
+
+                // bins within a semitone, weighted by closeness
+                lo = max<size_t>(1, ceil(frequency(note - 1)*bins_per_hz));
+                hi = min<size_t>(nyquist, frequency(note + 1)*bins_per_hz);
+                for (k = lo; k <= hi; ++k) {
+                        w = 1 - fabs(69 + 12*log2(k/bins_per_hz/440) - note);
+                        if (w > 0)
+                                entries_.push_back({ uint32_t(k), w });
+                }
+                if (first_[n] != entries_.size())
+                        continue;
+
+                // no bin that close, so interpolate between the two
+                // either side of the note
+                b = frequency(note)*bins_per_hz;
+                k = b;
+                if (k + 1 > nyquist)
+                        continue;
+                entries_.push_back({ uint32_t(k), 1 - (b - k) });
+                entries_.push_back({ uint32_t(k + 1), b - k });
+        }
+        first_[NOTES] = entries_.size();
+}
+
+size_t note_map::fft_size() const
+{
+        return fft_size_;
+}
+
+unsigned note_map::sample_rate() const
+{
+        return sample_rate_;
+}
+
+size_t note_map::entries() const
+{
+        return entries_.size();
+}
+
+float note_map::weight(unsigned note) const
+{
+        float sum = 0;
+        uint32_t i;
+
+        for (i = first_[note]; i < first_[note + 1]; ++i)
+                sum += entries_[i].weight;
+        return sum;
+}
+
+void note_map::apply(const spectrum& spec, note_levels& notes) const
+{
+        const entry *e = entries_.data();
+        unsigned n;
+        float sum;
+        uint32_t i;
+
+        for (n = 0; n < NOTES; ++n) {
+                sum = 0;
+                for (i = first_[n]; i < first_[n + 1]; ++i)
+                        sum += e[i].weight*sqrt(norm(spec[e[i].bin]));
+                notes[n] = sum;
+        }
+}
+
+float note_map::frequency(float note)
+{
+        return 440*exp2((note - 69)/12);
+}
+
+chroma_generator::chroma_generator()
+        : frame_rate_(20), sample_rate_(0), max_(0), range_(50)
+{
+        glow_.configure(0.1, get_frame_interval());
+}
+
+bool chroma_generator::set_parameter(const string& name, float value)
+{
+        if (name == "frame_rate" && value >= 1)
+                frame_rate_ = value;
+        else if (name == "afterglow" && value >= 0)
+                glow_.configure(value, get_frame_interval());
+        else if (name == "range" && value > 0)
+                range_ = value;
+        else
+                return frame_generator::set_parameter(name, value);
+
+        glow_.configure(glow_.half_life(), get_frame_interval());
+        return true;
+}
+
+void chroma_generator::prepare(const wav_reader& song)
+{
+        if (song.sample_rate() != sample_rate_)
+                maps_.clear();
+        sample_rate_ = song.sample_rate();
+        max_ = song.max_sample();
+        glow_.reset();
+}
+
+const note_map& chroma_generator::map_for(size_t n)
+{
+        for (const note_map& m : maps_)
+                if (m.fft_size() == n)
+                        return m;
+        maps_.emplace_back(n, sample_rate_);
+        return maps_.back();
+}
+
+bool chroma_generator::make_next_frame(const wav_reader& song,
+                                       microseconds start, frame& frame)
+{
+        // a full scale sine peaks at about a quarter of max after the
+        // window and the FFT's 1/n
+        const float full = max_/4;
+        static const unsigned ROWS = frame::HEIGHT/note_map::OCTAVES;
+        spectrum spec;
+        unsigned note, pc, octave, row, col;
+        float level, hue;
+        pixel p;
+
+        static_assert(frame::HEIGHT % note_map::OCTAVES == 0,
+                      "whole rows per octave");
+        if (!make_spectrum(song, start, spec))
+                return false;
+
+        frame.fill(pixel(0, 0, 0));
+        if (!spec.empty()) {
+                map_for(spec.size()).apply(spec, notes_);
+                for (note = 0; note < note_map::NOTES; ++note) {
+                        level = 1 + 20*log10(notes_[note]/full + 1e-9f)/
+                                range_;
+                        if (level <= 0)
+                                continue;
+                        level = min(level, 1.0f);
+                        pc = note % 12;
+                        octave = note/12;
+                        hue = 2*M_PI*pc/12;
+                        p = pixel(level*127*(1 + cos(hue)),
+                                  level*127*(1 + cos(hue - 2*M_PI/3)),
+                                  level*127*(1 + cos(hue - 4*M_PI/3)));
+                        for (col = pc*frame::WIDTH/12;
+                             col < (pc + 1)*frame::WIDTH/12; ++col)
+                                for (row = 0; row < ROWS; ++row)
+                                        frame.at(col, frame::HEIGHT - 1 -
+                                                 (octave*ROWS + row)) = p;
+                }
+        }
+        glow_.apply(frame);
+        return true;
+}
+
+unsigned chroma_generator::get_frame_rate() const
+{
+        return frame_rate_;
+}
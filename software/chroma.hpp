@@ -0,0 +1,104 @@
+/**
+ * \file chroma.hpp
+ *
+ * \brief A chromagram: the spectrum binned by musical note rather than
+ * into log spaced bands, so harmonic music lights up by pitch class.
+ *
+ * \detail note_map is a sparse table of FFT bin -> note weights, built
+ * once for an FFT size and sample rate. Each bin is shared between the
+ * two notes either side of it, weighted by how many semitones away it is,
+ * so a note gets the bins within a semitone of it. Low notes closer
+ * together than the bins get the two bins either side of their frequency,
+ * interpolated, instead. Stored note by note (CSR), applying it is one
+ * pass over at most twice the bins in range, about what bin_spectrum
+ * costs.
+ *
+ * chroma_generator draws 8 octaves from C1 up as rows of 4 pixels, lowest
+ * at the bottom, and the 12 pitch classes as columns 2 or 3 pixels wide,
+ * each its own color and as bright as the note is loud.
+ */
+
+#pragma once
+
+#include "afterglow.hpp"
+#include "frame.hpp"
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+class note_map {
+public:
+        static const unsigned OCTAVES = 8;
+        static const unsigned NOTES = 12*OCTAVES;
+
+        // the lowest note, C1, as a MIDI note number
+        static const int FIRST_NOTE = 24;
+
+        typedef std::array<float, NOTES> note_levels;
+
+        // for spectra of fft_size bins (after zero padding) of audio
+        // sampled at sample_rate
+        note_map(size_t fft_size, unsigned sample_rate);
+
+        size_t fft_size() const;
+        unsigned sample_rate() const;
+
+        // number of bin -> note weights stored
+        size_t entries() const;
+
+        // the sum of note's weights
+        float weight(unsigned note) const;
+
+        // weighted sum of bin magnitudes for each note. spec must be
+        // fft_size() long.
+        void apply(const spectrum& spec, note_levels& notes) const;
+
+        // frequency of a MIDI note number, A4 (69) being 440Hz
+        static float frequency(float note);
+
+private:
+        struct entry {
+                uint32_t bin;
+                float weight;
+        };
+
+        size_t fft_size_;
+        unsigned sample_rate_;
+
+        // note n's weights are entries_[first_[n]] to entries_[first_[n+1]]
+        std::vector<entry> entries_;
+        std::array<uint32_t, NOTES + 1> first_;
+};
+
+class chroma_generator : public frame_generator {
+public:
+        chroma_generator();
+        ~chroma_generator() = default;
+
+        // "frame_rate", "afterglow" (seconds) and "range", the decibels
+        // below a full scale note that show as black
+        bool set_parameter(const std::string& name, float value);
+
+protected:
+        void prepare(const wav_reader& song);
+
+        bool make_next_frame(const wav_reader& song,
+                             std::chrono::microseconds start,
+                             frame& frame);
+
+        unsigned get_frame_rate() const;
+
+private:
+        // the map for spectra n bins long, built the first time it's
+        // needed. There's one per quality level at most.
+        const note_map& map_for(size_t n);
+
+        unsigned frame_rate_;
+        unsigned sample_rate_;
+        float max_;
+        float range_;
+        std::vector<note_map> maps_;
+        note_map::note_levels notes_;
+        afterglow glow_;
+};
@@ -0,0 +1,74 @@
+/**
+ * \file chroma_test.cpp
+ *
+ * \brief Tests for note_map and chroma_generator: pure tones land on
+ * their notes, every note gets some bins, the table stays sparse, and the
+ * generator renders a song. Reads AmpUp.wav, so run it from the software
+ * directory.
+ */
+
+#include "chroma.hpp"
+#include "fft_backend.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <iostream>
+
+using namespace std;
+
+// the note loudest in a sine at freq, n samples at rate
+static unsigned loudest_note(const note_map& map, float freq, size_t n,
+                             unsigned rate)
+{
+        note_map::note_levels notes;
+        spectrum spec;
+        size_t i;
+
+        for (i = 0; i < n; ++i)
+                spec.push_back(sin(2*M_PI*freq*i/rate));
+        assert(default_fft_backend().forward(spec) == 0);
+        assert(spec.size() == map.fft_size());
+        map.apply(spec, notes);
+        return max_element(notes.begin(), notes.end()) - notes.begin();
+}
+
+int main(void)
+{
+        const note_map map(4096, 44100), small(1024, 44100);
+        const unsigned A4 = 69 - note_map::FIRST_NOTE;
+        const unsigned C6 = 84 - note_map::FIRST_NOTE;
+        wav_reader song("AmpUp.wav");
+        chroma_generator gen;
+        size_t frames = 0, lit = 0;
+        unsigned n;
+
+        assert(fabs(note_map::frequency(69) - 440) < 1e-3);
+        assert(fabs(note_map::frequency(57) - 220) < 1e-3);
+
+        assert(loudest_note(map, 440, 4096, 44100) == A4);
+        assert(loudest_note(map, note_map::frequency(84), 4096, 44100) ==
+               C6);
+        assert(loudest_note(small, 440, 1024, 44100) == A4);
+
+        // every note sees something, even where bins are a few semitones
+        // apart, and each bin goes to at most two notes
+        for (n = 0; n < note_map::NOTES; ++n) {
+                assert(map.weight(n) > 0);
+                assert(small.weight(n) > 0);
+        }
+        assert(map.entries() <= 2*map.fft_size()/2 + 2*note_map::NOTES);
+
+        gen.render_song(song, [&](const frame& f) {
+                for (const pixel& p : f)
+                        lit += p.red() || p.green() || p.blue();
+                ++frames;
+        });
+        assert(frames > 0);
+        assert(lit > 0 && lit < frames*frame().size());
+        cout << "lit " << 100.0*lit/(frames*frame().size())
+             << "% of pixels over " << frames << " frames" << endl;
+
+        cout << "test passed" << endl;
+        return 0;
+}
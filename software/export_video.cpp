@@ -0,0 +1,104 @@
+/**
+ * \file export_video.cpp
+ *
+ * \brief Render a visualization of a whole song headlessly and write it as
+ * an LED styled video, e.g.
+ *
+ *     ./export_video scrolling song.wav | ffmpeg -i - -i song.wav out.mp4
+ */
+
+#include "fft_tuner.hpp"
+#include "frame.hpp"
+#include "player.hpp"
+#include "task_pool.hpp"
+#include "video_export.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+using namespace std;
+using namespace chrono;
+
+static void usage(const char *prog)
+{
+        cerr << "usage: " << prog
+             << " scrolling|static|bars|chroma|melody|particles|expr:FILE "
+             << "filename.wav [--size n] [--rgb] [--threads n] [-o file]"
+             << endl;
+}
+
+int main(int argc, char **argv)
+{
+        video_exporter::format fmt = video_exporter::Y4M;
+        unsigned size = 640;
+        const char *out_name = NULL;
+        vector<frame> frames;
+        FILE *out = stdout;
+        int i;
+
+        if (argc < 3) {
+                usage(argv[0]);
+                return 1;
+        }
+        for (i = 3; i < argc; ++i) {
+                if (strcmp(argv[i], "--size") == 0 && i+1 < argc) {
+                        size = stoul(argv[++i]);
+                } else if (strcmp(argv[i], "--threads") == 0 && i+1 < argc) {
+                        task_pool::configure(stoul(argv[++i]));
+                } else if (strcmp(argv[i], "--rgb") == 0) {
+                        fmt = video_exporter::RGB;
+                } else if (strcmp(argv[i], "-o") == 0 && i+1 < argc) {
+                        out_name = argv[++i];
+                } else {
+                        usage(argv[0]);
+                        return 1;
+                }
+        }
+
+        unique_ptr<frame_generator> gen;
+        try {
+                gen = make_generator(argv[1]);
+        } catch (const runtime_error& e) {
+                cerr << e.what() << endl;
+                return 1;
+        }
+        if (!gen) {
+                usage(argv[0]);
+                return 1;
+        }
+
+        load_fft_wisdom();
+        wav_reader song(argv[2]);
+        auto start = steady_clock::now();
+        gen->render_song(song, [&](const frame& f) { frames.push_back(f); });
+        auto rendered = steady_clock::now();
+
+        try {
+                video_exporter exporter(size, fmt, gen->frame_rate());
+
+                if (out_name && !(out = fopen(out_name, "wb"))) {
+                        cerr << "can't open " << out_name << endl;
+                        return 1;
+                }
+                if (!exporter.write_header(out) ||
+                    !exporter.write_frames(frames, out) || fflush(out) != 0) {
+                        cerr << "write failed" << endl;
+                        return 1;
+                }
+        } catch (const invalid_argument& e) {
+                cerr << e.what() << endl;
+                return 1;
+        }
+        auto done = steady_clock::now();
+
+        cerr << frames.size() << " frames: render "
+             << duration_cast<milliseconds>(rendered - start).count()
+             << " ms, upscale and write "
+             << duration_cast<milliseconds>(done - rendered).count()
+             << " ms" << endl;
+        if (out != stdout)
+                fclose(out);
+        return 0;
+}
@@ -0,0 +1,577 @@
+/**
+ * \file expr.cpp
+ *
+ * \brief Expression language compiler, interpreter and generator.
+ */
+
+#include "expr.hpp"
+
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+
+using namespace std;
+using namespace chrono;
+
+typedef expr_program::op op;
+static const size_t LANES = expr_program::LANES;
+
+// apply f lane by lane. Inlined with the lambda, these are plain loops the
+// compiler can vectorize.
+template <typename F>
+static inline void lanes(float *d, const float *a, const float *b,
+                         const float *c, F f)
+{
+        size_t i;
+
+        for (i = 0; i < LANES; ++i)
+                d[i] = f(a[i], b[i], c[i]);
+}
+
+// one instruction over a row. Also folds constants, on rows of copies.
+static void kernel(op code, float *d, const float *a, const float *b,
+                   const float *c)
+{
+        switch (code) {
+        case expr_program::NEG:
+                lanes(d, a, b, c, [](float a, float, float) { return -a; });
+                break;
+        case expr_program::SIN:
+                lanes(d, a, b, c, [](float a, float, float) {
+                        return sin(a);
+                });
+                break;
+        case expr_program::COS:
+                lanes(d, a, b, c, [](float a, float, float) {
+                        return cos(a);
+                });
+                break;
+        case expr_program::ABS:
+                lanes(d, a, b, c, [](float a, float, float) {
+                        return fabs(a);
+                });
+                break;
+        case expr_program::SQRT:
+                lanes(d, a, b, c, [](float a, float, float) {
+                        return sqrt(a);
+                });
+                break;
+        case expr_program::FLOOR:
+                lanes(d, a, b, c, [](float a, float, float) {
+                        return floor(a);
+                });
+                break;
+        case expr_program::FRACT:
+                lanes(d, a, b, c, [](float a, float, float) {
+                        return a - floor(a);
+                });
+                break;
+        case expr_program::EXP:
+                lanes(d, a, b, c, [](float a, float, float) {
+                        return exp(a);
+                });
+                break;
+        case expr_program::LOG:
+                lanes(d, a, b, c, [](float a, float, float) {
+                        return log(a);
+                });
+                break;
+        case expr_program::ADD:
+                lanes(d, a, b, c, [](float a, float b, float) {
+                        return a + b;
+                });
+                break;
+        case expr_program::SUB:
+                lanes(d, a, b, c, [](float a, float b, float) {
+                        return a - b;
+                });
+                break;
+        case expr_program::MUL:
+                lanes(d, a, b, c, [](float a, float b, float) {
+                        return a*b;
+                });
+                break;
+        case expr_program::DIV:
+                lanes(d, a, b, c, [](float a, float b, float) {
+                        return a/b;
+                });
+                break;
+        case expr_program::MOD:
+                lanes(d, a, b, c, [](float a, float b, float) {
+                        return a - b*floor(a/b);
+                });
+                break;
+        case expr_program::POW:
+                lanes(d, a, b, c, [](float a, float b, float) {
+                        return pow(a, b);
+                });
+                break;
+        case expr_program::LT:
+                lanes(d, a, b, c, [](float a, float b, float) {
+                        return a < b ? 1.0f : 0.0f;
+                });
+                break;
+        case expr_program::GT:
+                lanes(d, a, b, c, [](float a, float b, float) {
+                        return a > b ? 1.0f : 0.0f;
+                });
+                break;
+        case expr_program::MIN:
+                lanes(d, a, b, c, [](float a, float b, float) {
+                        return b < a ? b : a;
+                });
+                break;
+        case expr_program::MAX:
+                lanes(d, a, b, c, [](float a, float b, float) {
+                        return a < b ? b : a;
+                });
+                break;
+        case expr_program::CLAMP:
+                lanes(d, a, b, c, [](float v, float lo, float hi) {
+                        return v < lo ? lo : (hi < v ? hi : v);
+                });
+                break;
+        case expr_program::MIX:
+                lanes(d, a, b, c, [](float a, float b, float f) {
+                        return a + (b - a)*f;
+                });
+                break;
+        }
+}
+
+// recursive descent over one statement at a time, emitting code as it
+// goes. Values are registers, or constants until something needs them in
+// a register.
+class expr_program::parser {
+public:
+        parser(expr_program& prog) : prog_(prog), line_(1) {}
+
+        void program(const string& source);
+
+private:
+        struct value {
+                bool constant;
+                float number;
+                uint16_t reg;
+        };
+
+        void statement();
+        value expression();
+        value sum();
+        value product();
+        value unary();
+        value power();
+        value primary();
+
+        value emit(op code, value a, value b, value c);
+        uint16_t in_register(value v);
+        uint16_t fresh();
+
+        void skip_space();
+        bool accept(char c);
+        void expect(char c);
+        string identifier();
+        [[noreturn]] void fail(const string& what);
+
+        expr_program& prog_;
+        string line_text_;
+        size_t pos_;
+        unsigned line_;
+        map<string, uint16_t> names_;
+        map<float, uint16_t> constants_;
+};
+
+void expr_program::parser::program(const string& source)
+{
+        const value black = { true, 0, 0 };
+        istringstream in(source);
+        string text;
+        size_t end;
+
+        names_["x"] = X;
+        names_["y"] = Y;
+        names_["t"] = T;
+        names_["beat"] = BEAT;
+        names_["level"] = LEVEL;
+        names_["bass"] = BASS;
+        names_["band"] = BAND;
+        prog_.regs_.assign(FIRST_FREE*LANES, 0);
+
+        for (line_ = 1; getline(in, text); ++line_) {
+                text = text.substr(0, text.find('#'));
+                while (!text.empty()) {
+                        end = text.find(';');
+                        line_text_ = text.substr(0, end);
+                        text = end == string::npos ? "" :
+                                text.substr(end + 1);
+                        pos_ = 0;
+                        skip_space();
+                        if (pos_ < line_text_.size())
+                                statement();
+                }
+        }
+
+        // unset colors are black
+        prog_.r_ = names_.count("r") ? names_["r"] : in_register(black);
+        prog_.g_ = names_.count("g") ? names_["g"] : in_register(black);
+        prog_.b_ = names_.count("b") ? names_["b"] : in_register(black);
+}
+
+void expr_program::parser::statement()
+{
+        string name = identifier();
+
+        if (name.empty())
+                fail("expected a name to assign to");
+        if (name == "x" || name == "y" || name == "t" || name == "beat" ||
+            name == "level" || name == "bass" || name == "band" ||
+            name == "pi")
+                fail("can't assign to input " + name);
+        expect('=');
+        names_[name] = in_register(expression());
+        if (pos_ < line_text_.size())
+                fail("unexpected '" + line_text_.substr(pos_) + "'");
+}
+
+expr_program::parser::value expr_program::parser::expression()
+{
+        value v = sum();
+
+        if (accept('<'))
+                return emit(LT, v, sum(), v);
+        if (accept('>'))
+                return emit(GT, v, sum(), v);
+        return v;
+}
+
+expr_program::parser::value expr_program::parser::sum()
+{
+        value v = product();
+
+        for (;;) {
+                if (accept('+'))
+                        v = emit(ADD, v, product(), v);
+                else if (accept('-'))
+                        v = emit(SUB, v, product(), v);
+                else
+                        return v;
+        }
+}
+
+expr_program::parser::value expr_program::parser::product()
+{
+        value v = unary();
+
+        for (;;) {
+                if (accept('*'))
+                        v = emit(MUL, v, unary(), v);
+                else if (accept('/'))
+                        v = emit(DIV, v, unary(), v);
+                else if (accept('%'))
+                        v = emit(MOD, v, unary(), v);
+                else
+                        return v;
+        }
+}
+
+expr_program::parser::value expr_program::parser::unary()
+{
+        value v;
+
+        if (accept('-')) {
+                v = unary();
+                return emit(NEG, v, v, v);
+        }
+        return power();
+}
+
+expr_program::parser::value expr_program::parser::power()
+{
+        value v = primary();
+
+        // right associative, and binds tighter than unary minus on its
+        // left: -2^2 is -4
+        if (accept('^'))
+                return emit(POW, v, unary(), v);
+        return v;
+}
+
+expr_program::parser::value expr_program::parser::primary()
+{
+        static const struct {
+                const char *name;
+                op code;
+                unsigned args;
+        } functions[] = {
+                { "sin", SIN, 1 }, { "cos", COS, 1 }, { "abs", ABS, 1 },
+                { "sqrt", SQRT, 1 }, { "floor", FLOOR, 1 },
+                { "fract", FRACT, 1 }, { "exp", EXP, 1 }, { "log", LOG, 1 },
+                { "min", MIN, 2 }, { "max", MAX, 2 }, { "pow", POW, 2 },
+                { "clamp", CLAMP, 3 }, { "mix", MIX, 3 },
+        };
+        value args[3] = {};
+        const char *start;
+        char *end;
+        string name;
+        unsigned n;
+        float number;
+
+        if (accept('(')) {
+                args[0] = expression();
+                expect(')');
+                return args[0];
+        }
+
+        start = line_text_.c_str() + pos_;
+        if (isdigit(*start) || *start == '.') {
+                number = strtof(start, &end);
+                if (end == start)
+                        fail("bad number");
+                pos_ += end - start;
+                skip_space();
+                return { true, number, 0 };
+        }
+
+        name = identifier();
+        if (name.empty())
+                fail(pos_ < line_text_.size() ?
+                     "unexpected '" + line_text_.substr(pos_, 1) + "'" :
+                     "expression ends early");
+        if (!accept('(')) {
+                if (name == "pi")
+                        return { true, float(M_PI), 0 };
+                if (!names_.count(name))
+                        fail("unknown name " + name);
+                return { false, 0, names_[name] };
+        }
+
+        for (const auto& f : functions) {
+                if (name != f.name)
+                        continue;
+                for (n = 0; n < f.args; ++n) {
+                        if (n > 0)
+                                expect(',');
+                        args[n] = expression();
+                }
+                expect(')');
+                for (; n < 3; ++n)
+                        args[n] = args[0];
+                return emit(f.code, args[0], args[1], args[2]);
+        }
+        fail("unknown function " + name);
+}
+
+expr_program::parser::value
+expr_program::parser::emit(op code, value a, value b, value c)
+{
+        alignas(16) float da[LANES], db[LANES], dc[LANES], dd[LANES];
+        instr i;
+        size_t k;
+
+        if (a.constant && b.constant && c.constant) {
+                for (k = 0; k < LANES; ++k) {
+                        da[k] = a.number;
+                        db[k] = b.number;
+                        dc[k] = c.number;
+                }
+                kernel(code, dd, da, db, dc);
+                return { true, dd[0], 0 };
+        }
+        i.code = code;
+        i.a = in_register(a);
+        i.b = in_register(b);
+        i.c = in_register(c);
+        i.dst = fresh();
+        prog_.code_.push_back(i);
+        return { false, 0, i.dst };
+}
+
+uint16_t expr_program::parser::in_register(value v)
+{
+        uint16_t r;
+
+        if (!v.constant)
+                return v.reg;
+        if (constants_.count(v.number))
+                return constants_[v.number];
+        r = fresh();
+        fill(prog_.reg(r), prog_.reg(r) + LANES, v.number);
+        constants_[v.number] = r;
+        return r;
+}
+
+uint16_t expr_program::parser::fresh()
+{
+        const size_t r = prog_.regs_.size()/LANES;
+
+        if (r > UINT16_MAX)
+                fail("program too long");
+        prog_.regs_.resize(prog_.regs_.size() + LANES);
+        return r;
+}
+
+void expr_program::parser::skip_space()
+{
+        while (pos_ < line_text_.size() && isspace(line_text_[pos_]))
+                ++pos_;
+}
+
+bool expr_program::parser::accept(char c)
+{
+        if (pos_ >= line_text_.size() || line_text_[pos_] != c)
+                return false;
+        ++pos_;
+        skip_space();
+        return true;
+}
+
+void expr_program::parser::expect(char c)
+{
+        if (!accept(c))
+                fail(string("expected '") + c + "'");
+}
+
+string expr_program::parser::identifier()
+{
+        const size_t start = pos_;
+        string name;
+
+        if (pos_ >= line_text_.size() ||
+            !(isalpha(line_text_[pos_]) || line_text_[pos_] == '_'))
+                return "";
+        while (pos_ < line_text_.size() &&
+               (isalnum(line_text_[pos_]) || line_text_[pos_] == '_'))
+                ++pos_;
+        name = line_text_.substr(start, pos_ - start);
+        skip_space();
+        return name;
+}
+
+void expr_program::parser::fail(const string& what)
+{
+        throw runtime_error("expr: line " + to_string(line_) + ": " + what);
+}
+
+expr_program::expr_program(const string& source)
+        : r_(0), g_(0), b_(0)
+{
+        size_t i;
+
+        parser(*this).program(source);
+        for (i = 0; i < LANES; ++i)
+                reg(X)[i] = float(i)/(LANES - 1);
+}
+
+float *expr_program::reg(uint16_t r)
+{
+        return regs_.data() + r*LANES;
+}
+
+size_t expr_program::size() const
+{
+        return code_.size();
+}
+
+void expr_program::render(const expr_inputs& in, frame& f)
+{
+        const float *r = reg(r_), *g = reg(g_), *b = reg(b_);
+        size_t row, col;
+
+        static_assert(LANES == frame_generator::BANDS, "a band per lane");
+        fill(reg(T), reg(T) + LANES, in.t);
+        fill(reg(BEAT), reg(BEAT) + LANES, in.beat);
+        fill(reg(LEVEL), reg(LEVEL) + LANES, in.level);
+        fill(reg(BASS), reg(BASS) + LANES, in.bass);
+        copy(in.bands.begin(), in.bands.end(), reg(BAND));
+
+        // NaN compares false, so it comes out black
+        auto channel = [](float v) {
+                return uint8_t(v > 0 ? (v < 1 ? v*255 : 255) : 0);
+        };
+        for (row = 0; row < frame::HEIGHT; ++row) {
+                fill(reg(Y), reg(Y) + LANES,
+                     float(frame::HEIGHT - 1 - row)/(frame::HEIGHT - 1));
+                for (const instr& i : code_)
+                        kernel(i.code, reg(i.dst), reg(i.a), reg(i.b),
+                               reg(i.c));
+                for (col = 0; col < frame::WIDTH; ++col)
+                        f.at(col, row) = pixel(channel(r[col]),
+                                               channel(g[col]),
+                                               channel(b[col]));
+        }
+}
+
+expr_generator::expr_generator(const string& source, unsigned frame_rate)
+        : program_(source), frame_rate_(frame_rate), max_(0)
+{}
+
+unique_ptr<expr_generator> expr_generator::from_file(const string& path)
+{
+        ifstream in(path);
+        ostringstream source;
+
+        if (!in || !(source << in.rdbuf()))
+                throw runtime_error("expr: can't read " + path);
+        return unique_ptr<expr_generator>(new expr_generator(source.str()));
+}
+
+bool expr_generator::set_parameter(const string& name, float value)
+{
+        if (name != "frame_rate" || value < 1)
+                return frame_generator::set_parameter(name, value);
+        frame_rate_ = value;
+        return true;
+}
+
+void expr_generator::prepare(const wav_reader& song)
+{
+        max_ = song.max_sample();
+        reset_bands();
+        beats_.reset();
+}
+
+bool expr_generator::make_next_frame(const wav_reader& song,
+                                     microseconds start, frame& frame)
+{
+        const float interval = duration<float>(get_frame_interval()).count();
+        size_t i;
+
+        if (!next_bands(song, start, in_.bands))
+                return false;
+        in_.t = duration<float>(start).count();
+        in_.level = 0;
+        in_.bass = 0;
+        for (i = 0; i < BANDS; ++i)
+                in_.level += in_.bands[i]/BANDS;
+        for (i = 0; i < 4; ++i)
+                in_.bass += in_.bands[i]/4;
+        beats_.update(in_.bass, interval);
+        in_.beat = beats_.pulse();
+
+        program_.render(in_, frame);
+        return true;
+}
+
+unsigned expr_generator::get_frame_rate() const
+{
+        return frame_rate_;
+}
+
+bool expr_generator::compute_bands(const wav_reader& song,
+                                   microseconds start, band_levels& bands)
+{
+        spectrum spec;
+
+        if (!make_spectrum(song, start, spec))
+                return false;
+        if (spec.empty()) {
+                bands.fill(0);
+                return true;
+        }
+        bin_spectrum(spec, 0, spec.size()/2, max_, bands);
+        return true;
+}
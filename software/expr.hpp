@@ -0,0 +1,125 @@
+/**
+ * \file expr.hpp
+ *
+ * \brief A little expression language for visuals, so a new look is a text
+ * file rather than a lambda_generator and a rebuild.
+ *
+ * \detail A program is lines (or ;-separated statements) of
+ *
+ *     name = expression
+ *
+ * run in order for every pixel. r, g and b, from 0 to 1, are the pixel's
+ * color; anything else is a variable for later lines. # starts a comment.
+ * Inputs:
+ *
+ *     x, y    the pixel, 0 to 1 from the bottom left
+ *     t       seconds into the song
+ *     band    level of the band under this column, roughly 0 to 1
+ *     level   average of all the bands
+ *     bass    average of the lowest 4 bands
+ *     beat    1 on a beat, fading to 0 by the next
+ *     pi
+ *
+ * with + - * / % ^ (power), < and > (1 or 0), parentheses, and
+ * sin cos abs sqrt floor fract exp log min max pow clamp(v, lo, hi) and
+ * mix(a, b, f). See plasma.expr.
+ *
+ * Programs compile once to register bytecode, folding anything constant.
+ * Each instruction then runs over a whole row of pixels at a time, in
+ * loops the compiler vectorizes, so interpreting costs one dispatch per
+ * instruction per row rather than per pixel.
+ */
+
+#pragma once
+
+#include "aligned_allocator.hpp"
+#include "beat.hpp"
+#include "frame.hpp"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// what the inputs other than x and y are for one frame
+struct expr_inputs {
+        float t;
+        float beat;
+        float level;
+        float bass;
+        frame_generator::band_levels bands;
+};
+
+class expr_program {
+public:
+        // compile source. Throws std::runtime_error, with the line, if
+        // it doesn't parse.
+        explicit expr_program(const std::string& source);
+
+        // draw a frame
+        void render(const expr_inputs& in, frame& f);
+
+        // instructions run per row, after constant folding
+        size_t size() const;
+
+        // pixels evaluated per instruction
+        static const size_t LANES = frame::WIDTH;
+
+        enum op : uint8_t {
+                NEG, SIN, COS, ABS, SQRT, FLOOR, FRACT, EXP, LOG,
+                ADD, SUB, MUL, DIV, MOD, POW, LT, GT, MIN, MAX,
+                CLAMP, MIX
+        };
+
+private:
+        struct instr {
+                op code;
+                uint16_t dst, a, b, c;
+        };
+
+        // fixed registers
+        enum {
+                X, Y, T, BEAT, LEVEL, BASS, BAND, FIRST_FREE
+        };
+
+        class parser;
+
+        float *reg(uint16_t r);
+
+        std::vector<instr> code_;
+        uint16_t r_, g_, b_;
+        aligned_vector<float> regs_;
+};
+
+class expr_generator : public frame_generator {
+public:
+        explicit expr_generator(const std::string& source,
+                                unsigned frame_rate = 20);
+        ~expr_generator() = default;
+
+        // compile the program in a file
+        static std::unique_ptr<expr_generator>
+        from_file(const std::string& path);
+
+        bool set_parameter(const std::string& name, float value);
+
+protected:
+        void prepare(const wav_reader& song);
+
+        bool make_next_frame(const wav_reader& song,
+                             std::chrono::microseconds start,
+                             frame& frame);
+
+        unsigned get_frame_rate() const;
+
+        bool compute_bands(const wav_reader& song,
+                           std::chrono::microseconds start,
+                           band_levels& bands);
+
+private:
+        expr_program program_;
+        unsigned frame_rate_;
+        float max_;
+        beat_detector beats_;
+        expr_inputs in_;
+};
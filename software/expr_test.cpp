@@ -0,0 +1,116 @@
+/**
+ * \file expr_test.cpp
+ *
+ * \brief Tests for expr_program: inputs land on the right pixels,
+ * precedence and functions match C++, constants fold away, bad programs
+ * are rejected with their line, and plasma.expr renders a song. Reads
+ * AmpUp.wav and plasma.expr, so run it from the software directory.
+ */
+
+#include "expr.hpp"
+
+#include <cassert>
+#include <cmath>
+#include <iostream>
+#include <stdexcept>
+
+using namespace std;
+
+static expr_inputs inputs()
+{
+        expr_inputs in;
+        size_t i;
+
+        in.t = 1.5;
+        in.beat = 1;
+        in.level = 0.5;
+        in.bass = 0.25;
+        for (i = 0; i < in.bands.size(); ++i)
+                in.bands[i] = float(i)/(in.bands.size() - 1);
+        return in;
+}
+
+static uint8_t channel(float v)
+{
+        return v > 0 ? (v < 1 ? v*255 : 255) : 0;
+}
+
+// the error compiling source, or "" if it compiles
+static string error(const string& source)
+{
+        try {
+                expr_program p(source);
+        } catch (const runtime_error& e) {
+                return e.what();
+        }
+        return "";
+}
+
+int main(void)
+{
+        expr_inputs in = inputs();
+        frame f;
+        float x, y, expect;
+        size_t col, row, frames = 0;
+
+        // x and y from the bottom left, band by column
+        expr_program coords("r = x; g = y\nb = band");
+        coords.render(in, f);
+        assert(f.at(0, frame::HEIGHT - 1).red() == 0);
+        assert(f.at(frame::WIDTH - 1, 0).red() == 255);
+        assert(f.at(0, frame::HEIGHT - 1).green() == 0);
+        assert(f.at(0, 0).green() == 255);
+        for (col = 0; col < frame::WIDTH; ++col)
+                assert(f.at(col, 3).blue() == channel(in.bands[col]));
+
+        // precedence, functions and variables agree with C++
+        expr_program maths(
+                "# comments and blank lines are fine\n"
+                "\n"
+                "v = 2*x - 0.5 + -y^2   # unary minus binds looser than ^\n"
+                "r = clamp(v, 0, 1)\n"
+                "g = mix(sin(v*pi), abs(cos(t)), 0.25) + (x > y)*0.1\n"
+                "b = fract(v*3) % 0.5 + min(level, bass) * max(beat, 0)\n");
+        maths.render(in, f);
+        for (col = 0; col < frame::WIDTH; ++col) {
+                for (row = 0; row < frame::HEIGHT; ++row) {
+                        x = float(col)/(frame::WIDTH - 1);
+                        y = float(frame::HEIGHT - 1 - row)/
+                                (frame::HEIGHT - 1);
+                        const float v = 2*x - 0.5f - y*y;
+                        const float s = sin(v*float(M_PI));
+                        const float fr = v*3 - floor(v*3);
+                        expect = min(max(v, 0.0f), 1.0f);
+                        assert(f.at(col, row).red() == channel(expect));
+                        expect = s + (fabs(cos(in.t)) - s)*0.25f +
+                                (x > y)*0.1f;
+                        assert(abs(f.at(col, row).green() -
+                                   channel(expect)) <= 1);
+                        expect = fr - 0.5f*floor(fr/0.5f) + 0.25f;
+                        assert(abs(f.at(col, row).blue() -
+                                   channel(expect)) <= 1);
+                }
+        }
+
+        // constants fold; only per pixel work is left
+        assert(expr_program("r = 1 + 2*3 - sqrt(4)/pi").size() == 0);
+        assert(expr_program("r = x*(2 + 3)").size() == 1);
+
+        // errors name the line
+        assert(error("r = x\ng = nope") == "expr: line 2: unknown name nope");
+        assert(error("r = (x").find("line 1") != string::npos);
+        assert(error("x = 1") != "");
+        assert(error("r = sin(x, y)") != "");
+        assert(error("r = frob(x)") != "");
+        assert(error("r = x y") != "");
+        assert(error("r = ") != "");
+        assert(error("") == "");
+
+        auto gen = expr_generator::from_file("plasma.expr");
+        wav_reader song("AmpUp.wav");
+        gen->render_song(song, [&](const frame&) { ++frames; });
+        assert(frames > 0);
+
+        cout << "test passed" << endl;
+        return 0;
+}
@@ -15,7 +15,8 @@
  *     Some good slides:
  *         http://sip.cua.edu/res/docs/courses/ee515/chapter08/ch8-2.pdf
  *
- * The interesting functions in this file are fft and ifft.
+ * The interesting functions in this file are fft and ifft. They take a
+ * vector with any allocator, so workspaces can use aligned_allocator.
  */
 
 #pragma once
@@ -33,8 +34,8 @@
 namespace detail {
 
 // sort a vector based on the bitwise reverse representation of its indices.
-template <typename float_t>
-void bit_reverse_sort(std::vector<std::complex<float_t>>& data)
+template <typename float_t, typename alloc_t>
+void bit_reverse_sort(std::vector<std::complex<float_t>, alloc_t>& data)
 {
         size_t size = data.size();
         unsigned order = __builtin_ffs(size) - 1;
@@ -54,7 +55,7 @@ void bit_reverse_sort(std::vector<std::complex<float_t>>& data)
 //
 // taken from here:
 // http://graphics.stanford.edu/~seander/bithacks.html#RoundUpPowerOf2Float
-size_t next_power_of2_or_zero(size_t v)
+inline size_t next_power_of2_or_zero(size_t v)
 {
         size_t t;
         float f;
@@ -67,14 +68,11 @@ size_t next_power_of2_or_zero(size_t v)
                 return v;
 }
         
-template <bool forward, typename float_t>
-int fft_impl(std::vector<std::complex<float_t>>& data)
+template <bool forward, typename float_t, typename alloc_t>
+int fft_impl(std::vector<std::complex<float_t>, alloc_t>& data)
 {
         size_t n = data.size();
-        const std::complex<float_t> w_n = std::exp(
-                std::complex<float_t>(2*M_PI*(forward ? -1 : 1)/n)*
-                std::complex<float_t>(0, 1));
-        std::complex<float_t> even, odd, w_curr, w_step;
+        std::complex<float_t> w_n, even, odd, w_curr, w_step;
         size_t grp_size, grp, i, start, size;
 
         static_assert(std::numeric_limits<float_t>::is_iec559,
@@ -87,6 +85,10 @@ int fft_impl(std::vector<std::complex<float_t>>& data)
                 n = data.size();
         }
 
+        // the root of unity has to come from the padded size
+        w_n = std::exp(std::complex<float_t>(2*M_PI*(forward ? -1 : 1)/n)*
+                       std::complex<float_t>(0, 1));
+
         bit_reverse_sort(data);
 
         // There are a lot of local variables to keep track of here, so
@@ -140,8 +142,8 @@ int fft_impl(std::vector<std::complex<float_t>>& data)
 ///               2. Transformation is performed in place.
 ///
 /// \return 0 on success, EINVAL if the size is not a power of 2.
-template <typename float_t>
-int fft(std::vector<std::complex<float_t>>& data)
+template <typename float_t, typename alloc_t>
+int fft(std::vector<std::complex<float_t>, alloc_t>& data)
 {
         return detail::fft_impl<true>(data);
 }
@@ -153,8 +155,8 @@ int fft(std::vector<std::complex<float_t>>& data)
 ///               2. Transformation is performed in place.
 ///
 /// \return 0 on success, EINVAL if the size is not a power of 2.
-template <typename float_t>
-int ifft(std::vector<std::complex<float_t>>& data)
+template <typename float_t, typename alloc_t>
+int ifft(std::vector<std::complex<float_t>, alloc_t>& data)
 {
         return detail::fft_impl<false>(data);
 }
@@ -0,0 +1,314 @@
+/**
+ * \file fft_backend.cpp
+ *
+ * \brief FFT engine implementations.
+ */
+
+#include "fft.hpp"
+#include "fft_backend.hpp"
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+
+#ifdef HAVE_FFTW
+#include <fftw3.h>
+#endif
+
+using namespace std;
+
+// engines that only know how to do an unscaled power of 2 transform;
+// padding and scaling are done here
+class power2_backend : public fft_backend {
+public:
+        int forward(spectrum& data);
+        int inverse(spectrum& data);
+
+protected:
+        // transform n points in place, n a power of 2, without scaling
+        virtual void transform(complex<float> *data, size_t n,
+                               bool forward) = 0;
+};
+
+int power2_backend::forward(spectrum& data)
+{
+        const size_t n = detail::next_power_of2_or_zero(data.size());
+        size_t i;
+
+        data.resize(n);
+        if (n == 0)
+                return 0;
+        transform(data.data(), n, true);
+        for (i = 0; i < n; ++i)
+                data[i] /= float(n);
+        return 0;
+}
+
+int power2_backend::inverse(spectrum& data)
+{
+        const size_t n = detail::next_power_of2_or_zero(data.size());
+
+        data.resize(n);
+        if (n != 0)
+                transform(data.data(), n, false);
+        return 0;
+}
+
+class builtin_backend : public fft_backend {
+public:
+        const char *name() const
+        {
+                return "builtin";
+        }
+
+        int forward(spectrum& data)
+        {
+                return fft(data);
+        }
+
+        int inverse(spectrum& data)
+        {
+                return ifft(data);
+        }
+};
+
+class radix2_backend : public power2_backend {
+public:
+        const char *name() const
+        {
+                return "radix2";
+        }
+
+protected:
+        struct plan {
+                vector<uint32_t> swaps;         // pairs to exchange
+                aligned_vector<complex<float>> twiddle; // e^(-2 pi i k/n)
+        };
+
+        const plan& get_plan(size_t n)
+        {
+                lock_guard<mutex> lock(lock_);
+                unique_ptr<plan>& p = plans_[n];
+                unsigned order = __builtin_ctzl(n);
+                size_t i, rev;
+
+                if (p)
+                        return *p;
+                p.reset(new plan);
+                for (i = 1; i < n; ++i) {
+                        rev = bit_reverse(i) >> (8*sizeof rev - order);
+                        if (rev > i) {
+                                p->swaps.push_back(i);
+                                p->swaps.push_back(rev);
+                        }
+                }
+                for (i = 0; i < n/2; ++i)
+                        p->twiddle.push_back(
+                                complex<float>(polar(1.0, -2*M_PI*i/n)));
+                return *p;
+        }
+
+        void transform(complex<float> *data, size_t n, bool forward)
+        {
+                const plan& p = get_plan(n);
+                const complex<float> *tw = p.twiddle.data();
+                float *d = reinterpret_cast<float *>(data);
+                const float sign = forward ? 1 : -1;
+                size_t len, half, step, i, j, a, b;
+                float wr, wi, xr, xi;
+
+                for (i = 0; i < p.swaps.size(); i += 2)
+                        swap(data[p.swaps[i]], data[p.swaps[i+1]]);
+
+                // complex multiplies written out by hand; operator* on
+                // std::complex handles NaN and infinity specially and is a
+                // library call without -ffast-math
+                for (len = 2; len <= n; len *= 2) {
+                        half = len/2;
+                        step = n/len;
+                        for (i = 0; i < n; i += len) {
+                                for (j = 0; j < half; ++j) {
+                                        wr = tw[j*step].real();
+                                        wi = sign*tw[j*step].imag();
+                                        a = 2*(i + j);
+                                        b = 2*(i + j + half);
+                                        xr = d[b]*wr - d[b+1]*wi;
+                                        xi = d[b]*wi + d[b+1]*wr;
+                                        d[b] = d[a] - xr;
+                                        d[b+1] = d[a+1] - xi;
+                                        d[a] += xr;
+                                        d[a+1] += xi;
+                                }
+                        }
+                }
+        }
+
+private:
+        mutex lock_;
+        map<size_t, unique_ptr<plan>> plans_;
+};
+
+class reference_backend : public power2_backend {
+public:
+        const char *name() const
+        {
+                return "reference";
+        }
+
+protected:
+        void transform(complex<float> *data, size_t n, bool forward)
+        {
+                const double sign = forward ? -1 : 1;
+                vector<complex<float>> out(n);
+                complex<double> sum;
+                size_t k, t;
+
+                for (k = 0; k < n; ++k) {
+                        sum = 0;
+                        for (t = 0; t < n; ++t)
+                                sum += complex<double>(data[t]) *
+                                        polar(1.0, sign*2*M_PI*(k*t % n)/n);
+                        out[k] = complex<float>(sum);
+                }
+                copy(out.begin(), out.end(), data);
+        }
+};
+
+#ifdef HAVE_FFTW
+class fftw_backend : public power2_backend {
+public:
+        ~fftw_backend()
+        {
+                for (auto& p : plans_)
+                        fftwf_destroy_plan(p.second);
+        }
+
+        const char *name() const
+        {
+                return "fftw";
+        }
+
+protected:
+        // plans are made once per size and direction on a scratch buffer
+        // (FFTW_MEASURE scribbles on its input), then run on our data with
+        // the new array interface. Our buffers are 64 byte aligned, which
+        // satisfies the plan's alignment.
+        fftwf_plan get_plan(size_t n, bool forward)
+        {
+                lock_guard<mutex> lock(lock_);
+                fftwf_plan& p = plans_[make_pair(n, forward)];
+                fftwf_complex *scratch;
+
+                if (p)
+                        return p;
+                scratch = fftwf_alloc_complex(n);
+                p = fftwf_plan_dft_1d(n, scratch, scratch,
+                                      forward ? FFTW_FORWARD : FFTW_BACKWARD,
+                                      FFTW_MEASURE);
+                fftwf_free(scratch);
+                return p;
+        }
+
+        void transform(complex<float> *data, size_t n, bool forward)
+        {
+                fftwf_complex *d = reinterpret_cast<fftwf_complex *>(data);
+
+                fftwf_execute_dft(get_plan(n, forward), d, d);
+        }
+
+private:
+        mutex lock_;
+        map<pair<size_t, bool>, fftwf_plan> plans_;
+};
+#endif
+
+class tuned_backend : public fft_backend {
+public:
+        const char *name() const
+        {
+                return "tuned";
+        }
+
+        int forward(spectrum& data)
+        {
+                return pick(data.size()).forward(data);
+        }
+
+        int inverse(spectrum& data)
+        {
+                return pick(data.size()).inverse(data);
+        }
+
+        // only written during setup, so lookups don't lock
+        map<size_t, fft_backend*> best;
+        fft_backend *fallback;
+
+private:
+        fft_backend& pick(size_t size)
+        {
+                auto it = best.find(detail::next_power_of2_or_zero(size));
+                return it == best.end() ? *fallback : *it->second;
+        }
+};
+
+static tuned_backend tuned;
+
+static vector<fft_backend*>& registry()
+{
+        static builtin_backend builtin;
+        static radix2_backend radix2;
+        static reference_backend reference;
+#ifdef HAVE_FFTW
+        static fftw_backend fftw;
+#endif
+        static vector<fft_backend*> all = []() {
+                tuned.fallback = &builtin;
+                return vector<fft_backend*>{
+                        &builtin, &radix2, &reference,
+#ifdef HAVE_FFTW
+                        &fftw,
+#endif
+                        &tuned,
+                };
+        }();
+        return all;
+}
+
+static atomic<fft_backend*> current(nullptr);
+
+vector<fft_backend*> fft_backends()
+{
+        return registry();
+}
+
+fft_backend *find_fft_backend(const string& name)
+{
+        for (fft_backend *b : registry())
+                if (name == b->name())
+                        return b;
+        return nullptr;
+}
+
+fft_backend& default_fft_backend()
+{
+        fft_backend *b = current.load();
+
+        return b ? *b : *registry().front();
+}
+
+void set_tuned_fft_backend(size_t n, fft_backend& backend)
+{
+        registry();
+        tuned.best[n] = &backend;
+}
+
+bool set_default_fft_backend(const string& name)
+{
+        fft_backend *b = find_fft_backend(name);
+
+        if (!b)
+                return false;
+        current = b;
+        return true;
+}
@@ -0,0 +1,61 @@
+/**
+ * \file fft_backend.hpp
+ *
+ * \brief Interchangeable FFT engines behind one interface, so the fastest
+ * one on each target can be picked (at build time or with --fft) without
+ * the generators knowing.
+ *
+ * \detail Engines:
+ *
+ *     builtin     fft()/ifft() from fft.hpp; the default
+ *     radix2      iterative radix 2 with cached bit reversal and twiddle
+ *                 tables per size
+ *     reference   textbook O(n^2) DFT in double precision, for checking
+ *                 the others
+ *     fftw        FFTW 3 (single precision), if built with FFTW=1
+ *     tuned       hands each size to whichever engine fft_tuner found
+ *                 fastest for it, builtin for sizes it wasn't told about
+ *
+ * All of them follow fft.hpp's conventions: in place, zero padded up to a
+ * power of 2, and the forward transform divides by n.
+ */
+
+#pragma once
+
+#include "aligned_allocator.hpp"
+
+#include <complex>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// FFT workspace for one frame's worth of samples
+typedef aligned_vector<std::complex<float>> spectrum;
+
+class fft_backend {
+public:
+        virtual ~fft_backend() = default;
+
+        virtual const char *name() const = 0;
+
+        // same contract as fft() and ifft(). Return 0 on success. Safe to
+        // call from several threads at once.
+        virtual int forward(spectrum& data) = 0;
+        virtual int inverse(spectrum& data) = 0;
+};
+
+// every engine built into this binary
+std::vector<fft_backend*> fft_backends();
+
+// look an engine up by name. Returns null if it isn't built in.
+fft_backend *find_fft_backend(const std::string& name);
+
+// the engine make_spectrum uses
+fft_backend& default_fft_backend();
+
+// switch the default engine. Returns false for an unknown name.
+bool set_default_fft_backend(const std::string& name);
+
+// have the "tuned" engine use backend for transforms that pad to n points.
+// Do this before anything starts transforming.
+void set_tuned_fft_backend(size_t n, fft_backend& backend);
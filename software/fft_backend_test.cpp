@@ -0,0 +1,81 @@
+/**
+ * \file fft_backend_test.cpp
+ *
+ * \brief Check every fft_backend against the reference DFT, forward and
+ * back, including sizes that need padding, and that fft_tuner's wisdom
+ * file round trips.
+ */
+
+#include "fft_backend.hpp"
+#include "fft_tuner.hpp"
+
+#include <cassert>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+
+using namespace std;
+
+int main(void)
+{
+        const size_t sizes[] = { 1, 2, 8, 300, 1024 };
+        fft_backend *reference = find_fft_backend("reference");
+        spectrum input, expect, got;
+        size_t i;
+
+        assert(reference != nullptr);
+        assert(&default_fft_backend() == find_fft_backend("builtin"));
+        assert(!set_default_fft_backend("no such engine"));
+
+        for (size_t n : sizes) {
+                input.clear();
+                for (i = 0; i < n; ++i)
+                        input.push_back(complex<float>(cos(0.1f*i*i),
+                                                       sin(0.3f*i)));
+                expect = input;
+                assert(reference->forward(expect) == 0);
+
+                for (fft_backend *b : fft_backends()) {
+                        got = input;
+                        assert(b->forward(got) == 0);
+                        assert(got.size() == expect.size());
+                        for (i = 0; i < got.size(); ++i)
+                                assert(abs(got[i] - expect[i]) < 1e-4);
+
+                        assert(b->inverse(got) == 0);
+                        for (i = 0; i < n; ++i)
+                                assert(abs(got[i] - input[i]) < 1e-3);
+                }
+        }
+
+        assert(set_default_fft_backend("radix2"));
+        assert(string(default_fft_backend().name()) == "radix2");
+
+        // another machine's entry survives us writing ours
+        const string path = "/tmp/fft_backend_test_wisdom";
+        fft_wisdom wisdom, loaded;
+        ofstream("/tmp/fft_backend_test_wisdom") << "other cpu\t1024\tfftw\n";
+        wisdom.cpu = cpu_model();
+        wisdom.best[1024] = "radix2";
+        wisdom.best[4096] = "builtin";
+        assert(write_fft_wisdom(path, wisdom));
+        assert(read_fft_wisdom(path, loaded));
+        assert(loaded.best == wisdom.best);
+        ifstream check(path);
+        string first;
+        getline(check, first);
+        assert(first == "other cpu\t1024\tfftw");
+
+        assert(load_fft_wisdom(path));
+        assert(string(default_fft_backend().name()) == "tuned");
+        got = input;
+        expect = input;
+        reference->forward(expect);
+        default_fft_backend().forward(got);
+        for (i = 0; i < got.size(); ++i)
+                assert(abs(got[i] - expect[i]) < 1e-4);
+        remove(path.c_str());
+
+        cout << "test passed" << endl;
+}
@@ -6,6 +6,7 @@
  * \brief Some small tests for the fft and ifft functions in fft.hpp
  */
 
+#include "aligned_allocator.hpp"
 #include "fft.hpp"
 
 #include <cassert>
@@ -17,6 +18,7 @@ using namespace std;
 int main(void)
 {
         vector<complex<double>> data, copy;
+        aligned_vector<complex<double>> aligned;
         size_t i;
         int ret;
 
@@ -33,5 +35,18 @@ int main(void)
         for (i = 0; i < data.size(); ++i)
                 assert(abs(copy[i] - data[i]) < 1e-8);
 
+        // 16MB, so this one lives in huge pages
+        aligned.assign(data.begin(), data.end());
+        assert(uintptr_t(aligned.data()) % 64 == 0);
+        ret = fft(aligned);
+        assert(ret == 0);
+        ret = ifft(aligned);
+        assert(ret == 0);
+        for (i = 0; i < data.size(); ++i)
+                assert(abs(aligned[i] - data[i]) < 1e-8);
+
+        aligned.assign(3, 1.0);
+        assert(uintptr_t(aligned.data()) % 64 == 0);
+
         cout << "test passed" << endl;
 }
@@ -0,0 +1,51 @@
+/**
+ * \file fft_tune.cpp
+ *
+ * \brief Time every FFT engine on this machine and save the winners to the
+ * wisdom file the players load at startup. Run it once per board:
+ *
+ *     ./fft_tune [--sizes 1024,2048,4096] [--wisdom path]
+ */
+
+#include "fft_tuner.hpp"
+
+#include <cstring>
+#include <iostream>
+#include <sstream>
+
+using namespace std;
+
+int main(int argc, char **argv)
+{
+        vector<size_t> sizes = DEFAULT_FFT_SIZES;
+        string path = default_wisdom_path(), size;
+        fft_wisdom wisdom;
+        int i;
+
+        for (i = 1; i < argc; ++i) {
+                if (strcmp(argv[i], "--sizes") == 0 && i+1 < argc) {
+                        istringstream list(argv[++i]);
+                        sizes.clear();
+                        while (getline(list, size, ','))
+                                sizes.push_back(stoul(size));
+                } else if (strcmp(argv[i], "--wisdom") == 0 && i+1 < argc) {
+                        path = argv[++i];
+                } else {
+                        cerr << "usage: " << argv[0] << " [--sizes n,n,...] "
+                             << "[--wisdom path]" << endl;
+                        return 1;
+                }
+        }
+
+        cout << "tuning for " << cpu_model() << endl;
+        wisdom = tune_fft(sizes, &cout);
+        for (const auto& w : wisdom.best)
+                cout << "best at " << w.first << ": " << w.second << endl;
+
+        if (!write_fft_wisdom(path, wisdom)) {
+                cerr << "couldn't write " << path << endl;
+                return 1;
+        }
+        cout << "wrote " << path << endl;
+        return 0;
+}
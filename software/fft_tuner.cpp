@@ -0,0 +1,179 @@
+/**
+ * \file fft_tuner.cpp
+ *
+ * \brief FFT auto tuning and wisdom file implementation.
+ */
+
+#include "fft_backend.hpp"
+#include "fft_tuner.hpp"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <limits>
+#include <sstream>
+
+using namespace std;
+using namespace chrono;
+
+const vector<size_t> DEFAULT_FFT_SIZES = { 1024, 2048, 4096 };
+
+string cpu_model()
+{
+        ifstream in("/proc/cpuinfo");
+        string line, key, model, hardware;
+        size_t colon;
+
+        // x86 has "model name"; the Pi's kernel puts the board in "Model"
+        // and the SoC in "Hardware", which say more than the core name
+        while (getline(in, line)) {
+                colon = line.find(':');
+                if (colon == string::npos)
+                        continue;
+                key = line.substr(0, line.find_last_not_of(" \t", colon - 1)
+                                     + 1);
+                line = line.substr(min(colon + 2, line.size()));
+                if (key == "Model")
+                        return line;
+                if (key == "Hardware")
+                        hardware = line;
+                else if (key == "model name" && model.empty())
+                        model = line;
+        }
+        if (!hardware.empty())
+                return hardware;
+        return model.empty() ? "unknown" : model;
+}
+
+string default_wisdom_path()
+{
+        const char *home = getenv("HOME");
+
+        return string(home ? home : ".") + "/.musicvis_fft_wisdom";
+}
+
+// seconds per transform of n points with b: the best of a few batches,
+// each long enough (~10ms) that clock resolution doesn't matter
+static double time_backend(fft_backend& b, size_t n)
+{
+        spectrum input, data;
+        steady_clock::time_point start;
+        double best = numeric_limits<double>::max(), t;
+        unsigned reps, batch, i;
+
+        for (i = 0; i < n; ++i)
+                input.push_back(complex<float>(cos(0.01f*i*i)));
+
+        // warm up and size the batches
+        reps = 1;
+        for (;;) {
+                start = steady_clock::now();
+                for (i = 0; i < reps; ++i) {
+                        data = input;
+                        b.forward(data);
+                }
+                t = duration<double>(steady_clock::now() - start).count();
+                if (t > 0.01 || reps > (1 << 20))
+                        break;
+                reps *= 2;
+        }
+
+        for (batch = 0; batch < 5; ++batch) {
+                start = steady_clock::now();
+                for (i = 0; i < reps; ++i) {
+                        data = input;
+                        b.forward(data);
+                }
+                t = duration<double>(steady_clock::now() - start).count();
+                best = min(best, t/reps);
+        }
+        return best;
+}
+
+fft_wisdom tune_fft(const vector<size_t>& sizes, ostream *log)
+{
+        fft_wisdom wisdom;
+        double best, t;
+
+        wisdom.cpu = cpu_model();
+        for (size_t n : sizes) {
+                best = numeric_limits<double>::max();
+                for (fft_backend *b : fft_backends()) {
+                        if (string(b->name()) == "reference" ||
+                            string(b->name()) == "tuned")
+                                continue;
+                        t = time_backend(*b, n);
+                        if (log)
+                                *log << n << " " << b->name() << ": "
+                                     << t*1e6 << " us" << endl;
+                        if (t < best) {
+                                best = t;
+                                wisdom.best[n] = b->name();
+                        }
+                }
+        }
+        return wisdom;
+}
+
+bool read_fft_wisdom(const string& path, fft_wisdom& wisdom)
+{
+        ifstream in(path);
+        string line, cpu, engine;
+        size_t n;
+
+        wisdom.cpu = cpu_model();
+        wisdom.best.clear();
+        while (getline(in, line)) {
+                istringstream fields(line);
+                if (!getline(fields, cpu, '\t') || cpu != wisdom.cpu)
+                        continue;
+                if (fields >> n >> engine)
+                        wisdom.best[n] = engine;
+        }
+        return !wisdom.best.empty();
+}
+
+bool write_fft_wisdom(const string& path, const fft_wisdom& wisdom)
+{
+        ifstream in(path);
+        vector<string> keep;
+        string line, tmp = path + ".tmp";
+
+        // other machines' entries stay as they were
+        while (getline(in, line))
+                if (line.compare(0, wisdom.cpu.size() + 1,
+                                 wisdom.cpu + "\t") != 0)
+                        keep.push_back(line);
+        in.close();
+
+        ofstream out(tmp);
+        for (const string& l : keep)
+                out << l << "\n";
+        for (const auto& w : wisdom.best)
+                out << wisdom.cpu << "\t" << w.first << "\t" << w.second
+                    << "\n";
+        out.close();
+        return out && rename(tmp.c_str(), path.c_str()) == 0;
+}
+
+void apply_fft_wisdom(const fft_wisdom& wisdom)
+{
+        fft_backend *b;
+
+        for (const auto& w : wisdom.best)
+                if ((b = find_fft_backend(w.second)))
+                        set_tuned_fft_backend(w.first, *b);
+        set_default_fft_backend("tuned");
+}
+
+bool load_fft_wisdom(const string& path)
+{
+        fft_wisdom wisdom;
+
+        if (!read_fft_wisdom(path, wisdom))
+                return false;
+        apply_fft_wisdom(wisdom);
+        return true;
+}
@@ -0,0 +1,55 @@
+/**
+ * \file fft_tuner.hpp
+ *
+ * \brief Find the fastest fft_backend for each FFT size on this machine and
+ * remember it in a wisdom file, so a Pi 3, a Pi Zero and an x86 box each
+ * run their own best engine without anyone tuning them by hand.
+ *
+ * \detail The wisdom file is plain text, one line per CPU model and size:
+ *
+ *     <cpu model>\t<fft size>\t<engine>
+ *
+ * so one file can be shared between machines. Loading it points the
+ * "tuned" engine at this CPU's winners and makes it the default.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+
+struct fft_wisdom {
+        std::string cpu;
+        std::map<size_t, std::string> best;     // fft size -> engine name
+};
+
+// FFT sizes our frame rates need (20 to 44 frames/s at 44.1 or 48kHz)
+extern const std::vector<size_t> DEFAULT_FFT_SIZES;
+
+// the CPU model from /proc/cpuinfo, e.g. "Raspberry Pi 3 Model B Rev 1.2"
+// or "Intel(R) Core(TM) i5-8250U CPU @ 1.60GHz"
+std::string cpu_model();
+
+// $HOME/.musicvis_fft_wisdom
+std::string default_wisdom_path();
+
+// time every engine (except the reference DFT) at each size and return
+// the fastest for each. Progress goes to log if given.
+fft_wisdom tune_fft(const std::vector<size_t>& sizes,
+                    std::ostream *log = nullptr);
+
+// read the entry for this CPU from path. Returns false if there is none.
+bool read_fft_wisdom(const std::string& path, fft_wisdom& wisdom);
+
+// replace wisdom.cpu's entries in path with wisdom, keeping other CPUs'
+bool write_fft_wisdom(const std::string& path, const fft_wisdom& wisdom);
+
+// route each size to its winner and make "tuned" the default engine.
+// Engines not built into this binary are skipped.
+void apply_fft_wisdom(const fft_wisdom& wisdom);
+
+// read and apply this CPU's wisdom, if path has any
+bool load_fft_wisdom(const std::string& path = default_wisdom_path());
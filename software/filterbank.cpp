@@ -0,0 +1,126 @@
+/**
+ * \file filterbank.cpp
+ *
+ * \brief Band-pass filterbank implementation.
+ */
+
+#include "filterbank.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+using namespace std;
+
+// 4 bands per vector: SSE on x86 and NEON on the Pi, plain float code
+// anywhere else
+typedef float f32x4 __attribute__((vector_size(16)));
+typedef int32_t i32x4 __attribute__((vector_size(16)));
+
+filterbank::filterbank()
+        : sample_rate_(0), low_(0), high_(0)
+{
+        memset(b0_, 0, sizeof(b0_));
+        memset(a1_, 0, sizeof(a1_));
+        memset(a2_, 0, sizeof(a2_));
+        memset(release_, 0, sizeof(release_));
+        reset();
+}
+
+void filterbank::configure(unsigned sample_rate, float low, float high,
+                           float release)
+{
+        float ratio, q, w0, alpha, a0;
+        size_t i;
+
+        // a band at Nyquist would have no width
+        high = min(high, 0.45f*sample_rate);
+
+        // neighbouring centers are ratio apart, and each band's -3dB
+        // points are halfway between (in log frequency)
+        ratio = pow(high/low, 1.0f/(BANDS - 1));
+        q = sqrt(ratio)/(ratio - 1);
+        sample_rate_ = sample_rate;
+        low_ = low;
+        high_ = high;
+        for (i = 0; i < BANDS; ++i) {
+                w0 = 2*M_PI*center(i)/sample_rate;
+                alpha = sin(w0)/(2*q);
+                a0 = 1 + alpha;
+                b0_[i] = alpha/a0;
+                a1_[i] = -2*cos(w0)/a0;
+                a2_[i] = (1 - alpha)/a0;
+
+                // hold at least 4 periods, or low bands' envelopes sag
+                // between the wave's peaks
+                release_[i] = pow(0.5f, 1/(max(release, 4/center(i))*
+                                           sample_rate));
+        }
+        reset();
+}
+
+float filterbank::center(size_t band) const
+{
+        return low_*pow(high_/low_, float(band)/(BANDS - 1));
+}
+
+void filterbank::reset()
+{
+        memset(z1_, 0, sizeof(z1_));
+        memset(z2_, 0, sizeof(z2_));
+        memset(env_, 0, sizeof(env_));
+}
+
+void filterbank::process(const float *samples, size_t n)
+{
+        // vectors run side by side: one band's recursion is a chain of
+        // dependent multiply-adds, so a lone vector leaves the FPU idle
+        // waiting on it
+        static const size_t WAYS = 2, STRIDE = 4*WAYS;
+        const i32x4 magnitude = { 0x7fffffff, 0x7fffffff, 0x7fffffff,
+                                  0x7fffffff };
+        f32x4 b0[WAYS], a1[WAYS], a2[WAYS], release[WAYS], z1[WAYS],
+                z2[WAYS], env[WAYS], x, y, rect;
+        i32x4 louder;
+        size_t band, i, w;
+
+        static_assert(BANDS % STRIDE == 0, "whole vectors only");
+        for (band = 0; band < BANDS; band += STRIDE) {
+                memcpy(b0, b0_ + band, sizeof(b0));
+                memcpy(a1, a1_ + band, sizeof(a1));
+                memcpy(a2, a2_ + band, sizeof(a2));
+                memcpy(release, release_ + band, sizeof(release));
+                memcpy(z1, z1_ + band, sizeof(z1));
+                memcpy(z2, z2_ + band, sizeof(z2));
+                memcpy(env, env_ + band, sizeof(env));
+
+                for (i = 0; i < n; ++i) {
+                        x = f32x4{ samples[i], samples[i], samples[i],
+                                   samples[i] };
+                        for (w = 0; w < WAYS; ++w) {
+                                y = b0[w]*x + z1[w];
+                                z1[w] = z2[w] - a1[w]*y;
+                                z2[w] = -b0[w]*x - a2[w]*y;
+
+                                // |y|, then the louder of it and the
+                                // decayed envelope, with masks since
+                                // there's no vector fabs or max
+                                rect = (f32x4)((i32x4)y & magnitude);
+                                env[w] *= release[w];
+                                louder = rect > env[w];
+                                env[w] = (f32x4)(((i32x4)rect & louder) |
+                                                 ((i32x4)env[w] & ~louder));
+                        }
+                }
+
+                memcpy(z1_ + band, z1, sizeof(z1));
+                memcpy(z2_ + band, z2, sizeof(z2));
+                memcpy(env_ + band, env, sizeof(env));
+        }
+}
+
+void filterbank::envelopes(levels& out) const
+{
+        memcpy(out.data(), env_, sizeof(env_));
+}
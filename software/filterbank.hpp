@@ -0,0 +1,65 @@
+/**
+ * \file filterbank.hpp
+ *
+ * \brief A bank of band-pass filters, one per band, as a low latency
+ * alternative to the FFT: a band's level is up to date as of the last
+ * sample, rather than averaged over the whole window.
+ *
+ * \detail Each band is a biquad band-pass (the Audio EQ Cookbook's 0dB
+ * peak one) centered on a log spaced frequency, with a Q that makes
+ * neighbouring bands meet, followed by a peak envelope follower that
+ * falls to half in the release time. Bands are independent, so they run
+ * 4 at a time in vector registers, and each group of 4 runs over a whole
+ * block of samples with its state in registers.
+ *
+ * static_fft_generator and scrolling_fft_generator use one in place of
+ * the FFT when their "filterbank" parameter is set to 1.
+ */
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+
+class filterbank {
+public:
+        static const size_t BANDS = 32;
+        typedef std::array<float, BANDS> levels;
+
+        // passes nothing until configured
+        filterbank();
+
+        // BANDS bands centered from low to high Hz for audio at
+        // sample_rate, with envelopes falling to half in release seconds
+        // (or 4 periods of the band, if that's longer). Resets the
+        // filters.
+        void configure(unsigned sample_rate, float low, float high,
+                       float release = 0.01);
+
+        // center frequency of a band in Hz
+        float center(size_t band) const;
+
+        // silence the filters and envelopes, e.g. at the start of a song
+        void reset();
+
+        // run n samples through every band
+        void process(const float *samples, size_t n);
+
+        // each band's envelope: the recent peak amplitude of its output
+        void envelopes(levels& out) const;
+
+private:
+        unsigned sample_rate_;
+        float low_, high_;
+
+        // per band coefficients (b1 is always 0, and b2 is -b0), the
+        // fraction of the envelope kept per sample, filter state
+        // (transposed direct form II) and envelope
+        alignas(16) float b0_[BANDS];
+        alignas(16) float a1_[BANDS];
+        alignas(16) float a2_[BANDS];
+        alignas(16) float release_[BANDS];
+        alignas(16) float z1_[BANDS];
+        alignas(16) float z2_[BANDS];
+        alignas(16) float env_[BANDS];
+};
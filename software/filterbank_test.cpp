@@ -0,0 +1,74 @@
+/**
+ * \file filterbank_test.cpp
+ *
+ * \brief Tests for filterbank: a tone at a band's center passes that band
+ * at unity gain and is the loudest band, envelopes die away in silence,
+ * and static_fft_generator renders a song through it. Reads AmpUp.wav, so
+ * run it from the software directory.
+ */
+
+#include "filterbank.hpp"
+#include "frame.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <iostream>
+#include <vector>
+
+using namespace std;
+
+static const unsigned RATE = 44100;
+
+// 0.2s of a sine at freq, then the envelopes
+static filterbank::levels tone(filterbank& fb, float freq, float amplitude)
+{
+        vector<float> samples(RATE/5);
+        filterbank::levels env;
+        size_t i;
+
+        for (i = 0; i < samples.size(); ++i)
+                samples[i] = amplitude*sin(2*M_PI*freq*i/RATE);
+        fb.reset();
+        fb.process(samples.data(), samples.size());
+        fb.envelopes(env);
+        return env;
+}
+
+int main(void)
+{
+        filterbank fb;
+        filterbank::levels env;
+        vector<float> silence(RATE/5, 0);
+        wav_reader song("AmpUp.wav");
+        static_fft_generator fft, filtered;
+        size_t band, fft_frames, filtered_frames;
+
+        // unconfigured, it passes nothing
+        env = tone(fb, 440, 1000);
+        assert(*max_element(env.begin(), env.end()) == 0);
+
+        fb.configure(RATE, 50, RATE/4);
+        assert(fabs(fb.center(0) - 50) < 1e-3);
+        assert(fabs(fb.center(filterbank::BANDS - 1) - RATE/4) < 1);
+        for (band = 0; band < filterbank::BANDS; band += 5) {
+                env = tone(fb, fb.center(band), 1000);
+                assert(size_t(max_element(env.begin(), env.end()) -
+                              env.begin()) == band);
+                assert(fabs(env[band] - 1000) < 100);
+        }
+
+        // 0.2s is 20 release times
+        fb.process(silence.data(), silence.size());
+        fb.envelopes(env);
+        assert(*max_element(env.begin(), env.end()) < 1);
+
+        // a song lasts as long through the filters as through the FFT
+        assert(filtered.set_parameter("filterbank", 1));
+        fft_frames = fft.render_song(song, [](const frame&) {});
+        filtered_frames = filtered.render_song(song, [](const frame&) {});
+        assert(filtered_frames == fft_frames);
+
+        cout << "test passed" << endl;
+        return 0;
+}
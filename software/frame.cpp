@@ -8,21 +8,31 @@
  */
 
 #include "fft.hpp"
+#include "fft_backend.hpp"
 #include "frame.hpp"
+#include "frame_timer.hpp"
+#include "metrics.hpp"
 #include "piHelpers.h"
+#include "rt_config.hpp"
 #include "util.hpp"
 
 #include <algorithm>
 #include <cassert>
 #include <complex>
+#include <condition_variable>
 #include <cstdlib>
+#include <cstring>
 #include <fstream>
 #include <iterator>
 #include <limits>
+#include <mutex>
+#include <numeric>
 #include <stdexcept>
 #include <thread>
 #include <iostream>
 
+#include <signal.h>
+#include <spawn.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <unistd.h>
@@ -90,7 +100,7 @@ void frame::move_right()
         }
 }
 
-void frame::write() const
+void frame::pack(packed& out) const
 {
         // For now the format for the spi communication will involve sending
         // row by row, starting with the first row. For each row, we send each
@@ -105,7 +115,7 @@ void frame::write() const
 
         size_t x, y;
         uint8_t r0, g0, b0, r1, g1, b1;
-        uint8_t byte1, byte2, byte3;
+        auto byte = out.begin();
         for (y = 0; y < HEIGHT; ++y) {
             for (x = 0; x < WIDTH; x += 2) {
                 r0 = gc(at(x, y).red()) / 16;
@@ -114,84 +124,507 @@ void frame::write() const
                 r1 = gc(at(x + 1, y).red()) / 16;
                 g1 = gc(at(x + 1, y).green()) / 16;
                 b1 = gc(at(x + 1, y).blue()) / 16;
-                byte1 = bit_reverse(uint8_t(g0 << 4 | r0));
-                byte2 = bit_reverse(uint8_t(r1 << 4 | b0));
-                byte3 = bit_reverse(uint8_t(b1 << 4 | g1));
-                // print statements to check that the above conversions
-                // are working properly
-                // printf("red0 %02x green0 %02X\n", r0, g0);
-                // printf("combined %02X\n", byte1);
-                // printf("blue0 %02x red1 %02X\n", b0, r1);
-                // printf("combined %02X\n", byte2);
-                // printf("green1 %02x blue1 %02X\n", g1, b1);
-                // printf("combined %02X\n", byte3);
-                spiSendReceive(byte1);
-                spiSendReceive(byte2);
-                spiSendReceive(byte3);
+                *byte++ = bit_reverse(uint8_t(g0 << 4 | r0));
+                *byte++ = bit_reverse(uint8_t(r1 << 4 | b0));
+                *byte++ = bit_reverse(uint8_t(b1 << 4 | g1));
             }
         }
 }
 
+void frame::write() const
+{
+        static metrics_registry& r = metrics_registry::global();
+        static metric_counter& spi_bytes = r.counter(
+                "musicvis_spi_bytes_total", "Bytes written to the SPI bus.");
+        static metric_counter& skipped = r.counter(
+                "musicvis_spi_frames_skipped_total",
+                "Frames not sent because the panel already showed them.");
+
+        // there's one panel, so one last frame, whoever writes it
+        static mutex lock;
+        static packed last;
+        static bool have_last = false;
+        packed bytes;
+
+        pack(bytes);
+        lock_guard<mutex> guard(lock);
+        if (have_last && bytes == last) {
+                skipped.add(1);
+                return;
+        }
+        for (uint8_t byte : bytes)
+                spiSendReceive(byte);
+        spi_bytes.add(bytes.size());
+        last = bytes;
+        have_last = true;
+}
+
+void spi_sink::write(const frame& f)
+{
+        f.write();
+}
+
+frame_generator::frame_generator()
+        : quality_(quality_controller::settings(0)), silence_(0.001),
+          last_start_(0),
+          ahead_start_(0), have_last_(false), have_ahead_(false),
+          stop_(false), stops_(0), player_pid_(0)
+{}
+
+void frame_generator::prepare(const wav_reader&)
+{}
+
+void frame_generator::finish()
+{}
+
+bool frame_generator::set_parameter(const string& name, float value)
+{
+        if (name != "silence" || value < 0)
+                return false;
+        silence_ = value;
+        return true;
+}
+
+void frame_generator::stop()
+{
+        pid_t pid = player_pid_;
+
+        // counted first; see play_song
+        ++stops_;
+        stop_ = true;
+        if (pid > 0)
+                kill(pid, SIGTERM);
+}
+
+uint64_t frame_generator::stops() const
+{
+        return stops_;
+}
+
+void frame_generator::add_sink(frame_sink& sink)
+{
+        sinks_.push_back(&sink);
+}
+
+void frame_generator::output(const frame& f)
+{
+        if (sinks_.empty()) {
+                f.write();
+                return;
+        }
+        for (frame_sink *sink : sinks_)
+                sink->write(f);
+}
+
+unsigned frame_generator::frame_rate() const
+{
+        return get_frame_rate();
+}
+
 microseconds frame_generator::get_frame_interval() const
 {
         return microseconds(1000*1000/get_frame_rate());
 }
 
+void frame_generator::set_quality(const quality_level& q)
+{
+        quality_ = q;
+}
+
+const quality_level& frame_generator::quality() const
+{
+        return quality_;
+}
+
+bool frame_generator::compute_bands(const wav_reader&, microseconds,
+                                    band_levels&)
+{
+        return false;
+}
+
+void frame_generator::reset_bands()
+{
+        have_last_ = have_ahead_ = false;
+}
+
+bool frame_generator::next_bands(const wav_reader& song, microseconds start,
+                                 band_levels& bands)
+{
+        const microseconds interval = get_frame_interval();
+        size_t i;
+
+        // the second of an interpolated pair was analyzed last time
+        if (have_ahead_ && ahead_start_ == start) {
+                have_ahead_ = false;
+                bands = last_bands_ = ahead_bands_;
+                last_start_ = start;
+                have_last_ = true;
+                return true;
+        }
+        have_ahead_ = false;
+
+        // one analysis covers this frame and the next: look ahead a frame
+        // and show the midpoint now
+        if (quality_.interpolate && have_last_ &&
+            last_start_ + interval == start &&
+            compute_bands(song, start + interval, ahead_bands_)) {
+                for (i = 0; i < BANDS; ++i)
+                        bands[i] = (last_bands_[i] + ahead_bands_[i])/2;
+                have_ahead_ = true;
+                ahead_start_ = start + interval;
+                have_last_ = false;
+                return true;
+        }
+
+        have_last_ = compute_bands(song, start, bands);
+        last_bands_ = bands;
+        last_start_ = start;
+        return have_last_;
+}
+
+void frame_generator::bin_spectrum(const spectrum& spec, size_t first,
+                                   size_t span, float max,
+                                   band_levels& bands) const
+{
+        // a smaller FFT has proportionally fewer bins per band
+        const size_t b_0 = std::max<size_t>(1, 8 >> quality_.fft_shift);
+        const float alpha = compute_alpha(b_0, span);
+        auto iter = spec.begin() + first;
+        complex<float> sum;
+        size_t i, b;
+
+        for (i = 0; i < BANDS; ++i, iter += b) {
+                b = b_0*pow(alpha, i);
+                if (i % quality_.band_step != 0) {
+                        bands[i] = bands[i - i % quality_.band_step];
+                        continue;
+                }
+                // |sum| comes out about the same for a band at any FFT
+                // size, so normalize as if it were full size
+                sum = accumulate(iter, iter + b, complex<float>(0));
+                bands[i] = log(abs(sum) + 1)/
+                        log((b << quality_.fft_shift)*max);
+        }
+}
+
+bool frame_generator::filter_bands(const wav_reader& song,
+                                   microseconds start, float max,
+                                   filterbank& filters, band_levels& bands)
+{
+        const microseconds interval = get_frame_interval();
+        const microseconds length = interval/(1 << quality_.fft_shift);
+        vector<float> sample = song.get_range(start + interval - length,
+                                              length);
+        filterbank::levels env;
+        size_t i;
+
+        static_assert(filterbank::BANDS == BANDS, "a filter per band");
+        if (sample.size() <= frame::HEIGHT)
+                return false;
+        filters.process(sample.data(), sample.size());
+        filters.envelopes(env);
+        for (i = 0; i < BANDS; ++i)
+                bands[i] = log(env[i] + 1)/log(max + 1);
+        return true;
+}
+
+// render loop health, broken down by the output and render threads'
+// scheduling so runs with different rt settings can be compared. Looked
+// up once per song; updates are lock free.
+struct loop_metrics {
+        metric_counter& frames;
+        metric_counter& late_frames;
+        metric_gauge& frame_rate;
+        metric_latency& render;
+        metric_latency& output;
+        metric_latency& wakeup;
+        metric_gauge& quality;
+};
+
+static loop_metrics get_loop_metrics()
+{
+        metrics_registry& r = metrics_registry::global();
+        const string config =
+                "output_sched=\"" +
+                role_policy(OUTPUT_THREAD).describe() + "\"," +
+                "render_sched=\"" +
+                role_policy(RENDER_THREAD).describe() + "\"";
+        loop_metrics m = {
+                r.counter("musicvis_frames_total", "Frames played.", config),
+                r.counter("musicvis_late_frames_total",
+                          "Frames not rendered by their deadline.", config),
+                r.gauge("musicvis_frame_rate", "Current frames per second."),
+                r.latency("musicvis_stage_seconds",
+                          "Time spent in each render loop stage.",
+                          "stage=\"render\"," + config),
+                r.latency("musicvis_stage_seconds",
+                          "Time spent in each render loop stage.",
+                          "stage=\"output\"," + config),
+                r.latency("musicvis_wakeup_error_seconds",
+                          "How late the loop woke up for each frame.",
+                          config + ",spin_us=\"" +
+                          to_string(frame_timer::default_spin().count()) +
+                          "\""),
+                r.gauge("musicvis_quality_level",
+                        "Render quality level, 0 is full detail."),
+        };
+        return m;
+}
+
+// frames the render thread has made ahead of the output thread. Frame k
+// goes in slots[k % 2]; the render thread only fills a slot once the
+// output thread has finished with the frame that was in it, and neither
+// side takes a lock, so a low priority render thread can never hold up
+// output.
+struct frame_handoff {
+        struct slot {
+                frame f;
+                microseconds interval;  // until the frame after this one
+        };
+
+        frame_handoff() : produced(0), consumed(0), done(false) {}
+
+        slot slots[2];
+        atomic<size_t> produced;        // frames ready, in order
+        atomic<size_t> consumed;        // frames done being output
+        atomic<bool> done;              // no more frames coming
+
+        // the render thread naps here while both slots are full
+        mutex lock;
+        condition_variable space;
+};
+
+// configure the pi to play audio through the audio jack, once
+static void route_audio()
+{
+        char *const args[] = { (char *)"amixer", (char *)"cset",
+                               (char *)"numid=3", (char *)"1", NULL };
+        pid_t pid;
+
+        if (posix_spawnp(&pid, "amixer", NULL, NULL, args, environ) == 0)
+                waitpid(pid, NULL, 0);
+}
+
 void frame_generator::play_song(const string& fname)
 {
-        wav_reader song(fname);
-        clock_t::time_point start, next_start;
-        size_t frame_count = 0;
-        microseconds offset, interval;
+        play_song(fname, stops());
+}
+
+void frame_generator::play_song(const string& fname, uint64_t seen)
+{
+        static once_flag routed;
+        // the caller may play more songs, and start other things, after
+        // we return; don't leave it as the output thread
+        saved_thread_policy caller;
+        loop_metrics m = get_loop_metrics();
+        clock_t::time_point before, after;
+        steady_clock::time_point next_start;
+        frame_handoff handoff;
+        frame_timer timer;
+        exception_ptr render_error;
+        bool stopped;
+        thread render;
+        string err;
+        size_t k;
         pid_t pid;
-        frame f;
+        int spawn_err;
+
+        // a stop() from before this point has bumped stops_; one from
+        // after leaves stop_ set, so none is lost, even while we load
+        stop_ = false;
+        if (stops_ != seen)
+                return;
+        wav_reader song(fname);
+        if (stop_)
+                return;
 
         // make the first frame before we start playing the song because
         // it's comutationally intensive
-        if (!make_next_frame(song, microseconds(0), f))
+        set_quality(quality_controller::settings(0));
+        m.quality.set(0);
+        prepare(song);
+        if (!make_next_frame(song, microseconds(0), handoff.slots[0].f)) {
+                finish();
                 throw runtime_error("failed to generate first frame");
-        
-        pid = fork();
-        if (pid < 0)
-                throw runtime_error("fork failed");
-        else if (pid == 0) {
-                // configure the pi to play audio through the audio jack
-                system("amixer cset numid=3 1");
-                system(("aplay " + fname).c_str());
-                exit(0);
-        } else {
-                start = clock_t::now();
-                interval = get_frame_interval();
-                for (;;) {
-                        f.write();
-                        next_start = start + ++frame_count*interval;
-                        offset = duration_cast<microseconds>(next_start - start);
-                        if (!make_next_frame(song, offset, f))
-                                break;
-                        this_thread::sleep_until(next_start);
+        }
+        handoff.slots[0].interval = get_frame_interval();
+        handoff.produced = 1;
+
+        // spawn rather than fork: callers like the daemon have threads,
+        // and a forked child of a threaded process may only make async
+        // signal safe calls. Run aplay directly so stop() can kill it.
+        call_once(routed, route_audio);
+        {
+                char *const args[] = { (char *)"aplay",
+                                       (char *)fname.c_str(), NULL };
+                spawn_err = posix_spawnp(&pid, "aplay", NULL, NULL, args,
+                                         environ);
+        }
+        if (spawn_err != 0) {
+                finish();
+                throw runtime_error(string("can't run aplay: ") +
+                                    strerror(spawn_err));
+        }
+        player_pid_ = pid;
+
+        // everything the generator does from here on happens on the
+        // render thread
+        render = thread([&]() {
+                microseconds offset(0), took;
+                frame work = handoff.slots[0].f;
+                string policy_err = apply_role_policy(RENDER_THREAD);
+                quality_controller quality;
+                clock_t::time_point start;
+                size_t n;
+                bool more;
+
+                if (!policy_err.empty())
+                        cerr << "render thread: " << policy_err << endl;
+
+                try {
+                        for (n = 1;; ++n) {
+                                // re-read the interval every frame; a
+                                // generator_switch can change it mid song
+                                offset += handoff.slots[(n - 1) % 2].interval;
+                                start = clock_t::now();
+                                more = !stop_ &&
+                                        make_next_frame(song, offset, work);
+                                took = duration_cast<microseconds>(
+                                        clock_t::now() - start);
+                                m.render.observe(took);
+                                if (!more)
+                                        break;
+
+                                // do less per frame if we're falling behind
+                                if (quality.observe(took,
+                                                    get_frame_interval())) {
+                                        set_quality(quality.settings());
+                                        m.quality.set(quality.level());
+                                }
+
+                                unique_lock<mutex> lock(handoff.lock);
+                                while (handoff.consumed.load() + 2 <= n &&
+                                       !stop_)
+                                        handoff.space.wait_for(
+                                                lock, milliseconds(1));
+                                if (stop_)
+                                        break;
+                                handoff.slots[n % 2].f = work;
+                                handoff.slots[n % 2].interval =
+                                        get_frame_interval();
+                                handoff.produced.store(n + 1,
+                                                       memory_order_release);
+                        }
+                } catch (...) {
+                        render_error = current_exception();
                 }
+                handoff.done = true;
+        });
+
+        err = apply_role_policy(OUTPUT_THREAD);
+        if (!err.empty())
+                cerr << "output thread: " << err << endl;
+
+        next_start = steady_clock::now();
+        for (k = 0;; ++k) {
+                // late: show it as soon as it's ready rather than skip it
+                if (handoff.produced.load(memory_order_acquire) <= k &&
+                    !handoff.done) {
+                        m.late_frames.add();
+                        while (handoff.produced.load(memory_order_acquire)
+                               <= k && !handoff.done && !stop_)
+                                this_thread::sleep_for(microseconds(100));
+                }
+                if (stop_ || handoff.produced.load(memory_order_acquire) <= k)
+                        break;
+
+                const frame_handoff::slot& s = handoff.slots[k % 2];
+                before = clock_t::now();
+                output(s.f);
+                after = clock_t::now();
+                m.output.observe(after - before);
+                m.frames.add();
+                m.frame_rate.set(1000*1000/s.interval.count());
+                next_start += s.interval;
+
+                // no lock; the render thread's wait times out anyway
+                handoff.consumed.store(k + 1, memory_order_release);
+                handoff.space.notify_one();
+
+                m.wakeup.observe(timer.wait_until(next_start));
         }
+
+        // a render error stops the song as if we'd been asked to
+        stopped = stop_.exchange(true);
+        render.join();
+        finish();
+        player_pid_ = 0;
+        if (stopped || render_error)
+                kill(pid, SIGTERM);
         waitpid(pid, NULL, 0);
+        if (render_error)
+                rethrow_exception(render_error);
+}
+
+size_t frame_generator::render_song(const wav_reader& song,
+                                    const function<void(const frame&)>& out)
+{
+        size_t frame_count = 0;
+        frame f;
+
+        set_quality(quality_controller::settings(0));
+        prepare(song);
+        while (make_next_frame(song, frame_count*get_frame_interval(), f)) {
+                out(f);
+                ++frame_count;
+        }
+        finish();
+        return frame_count;
 }
 
 bool frame_generator::make_spectrum(const wav_reader& song,
                                     microseconds start,
-                                    vector<complex<float>>& spec)
+                                    spectrum& spec)
 {
-        vector<float> sample = song.get_range(start, get_frame_interval());
-        size_t i, n;
-        float sigma = 0.4;
+        vector<float> sample = song.get_range(
+                start, get_frame_interval()/(1 << quality_.fft_shift));
+        const size_t n = sample.size();
+        static metric_counter& silent_frames =
+                metrics_registry::global().counter(
+                        "musicvis_silent_frames_total",
+                        "Time slices too quiet to be worth analyzing.");
+        const float sigma = 0.4;
+        const float quiet = silence_*song.max_sample();
+        float x, peak = 0;
+        size_t i;
 
-        // use a gaussian window.
+        // use a gaussian window, computed once per size.
         // https://en.wikipedia.org/wiki/Window_function#Gaussian_window
-        n = sample.size();
-        for (i = 0; i < n; ++i)
-                sample.at(i) *= pow(M_E, -0.5*pow((i - (n - 1)/2)/
-                                                  (sigma*(n-1)/2), 2));
+        if (window_.size() != n) {
+                window_.resize(n);
+                for (i = 0; i < n; ++i) {
+                        x = (float(i) - (n - 1)/2.0f)/(sigma*(n - 1)/2);
+                        window_[i] = exp(-0.5f*x*x);
+                }
+        }
+
+        // copy the windowed real sample to a complex sample
+        spec.clear();
+        spec.reserve(n);
+        for (i = 0; i < n; ++i) {
+                peak = max(peak, fabs(sample[i]));
+                spec.push_back(sample[i]*window_[i]);
+        }
+        if (n <= frame::HEIGHT)
+                return false;
 
-        // copy the real sample to a complex sample
-        copy(sample.begin(), sample.end(), back_inserter(spec));
-        return fft(spec) == 0 && spec.size() > frame::HEIGHT;
+        // nothing to see, so don't spend an FFT on it
+        if (peak < quiet) {
+                silent_frames.add(1);
+                spec.clear();
+                return true;
+        }
+        return default_fft_backend().forward(spec) == 0;
 }
 
 // we implement this using guess and check because hey, it works, and it's
@@ -218,9 +651,47 @@ frame_generator::compute_alpha(size_t b_0, size_t n)
 }
 
 scrolling_fft_generator::scrolling_fft_generator()
-        : frame_rate_(0), cutoff_(0.0), max_(0), spec_frac_(0.5)
+        : frame_rate_(0), cutoff_(0.0), max_(0), spec_frac_(0.5),
+          params_loaded_(false), final_count_(0), filtered_(false)
 {}
 
+void scrolling_fft_generator::prepare(const wav_reader& song)
+{
+        size_t fft_size = 1;
+
+        // only read the parameter file once, so values changed with
+        // set_parameter stick across songs
+        if (!params_loaded_) {
+                calc_parameters(song);
+                params_loaded_ = true;
+        }
+        max_ = song.max_sample();
+        final_count_ = 0;
+        reset_bands();
+        // the same span of frequencies the FFT bands cover, starting
+        // frame_rate_ bins of a padded FFT up
+        while (fft_size < song.sample_rate()/max(1u, frame_rate_))
+                fft_size <<= 1;
+        filters_.configure(song.sample_rate(),
+                           float(frame_rate_)*song.sample_rate()/fft_size,
+                           spec_frac_*song.sample_rate()/2);
+}
+
+bool scrolling_fft_generator::set_parameter(const string& name, float value)
+{
+        if (name == "cutoff")
+                cutoff_ = value;
+        else if (name == "spec_frac")
+                spec_frac_ = value;
+        else if (name == "frame_rate" && value >= 1)
+                frame_rate_ = value;
+        else if (name == "filterbank")
+                filtered_ = value != 0;
+        else
+                return frame_generator::set_parameter(name, value);
+        return true;
+}
+
 void scrolling_fft_generator::calc_parameters(const wav_reader& song)
 {
         max_ = song.max_sample();
@@ -257,34 +728,25 @@ bool scrolling_fft_generator::make_next_frame(const wav_reader& song,
                                               frame& frame)
 {
         size_t x, y;
-        vector<complex<float>> spec;
+        band_levels bands;
         array<pixel, frame::HEIGHT> new_col;
-        static bool called = false;
-        static size_t final_count = 0;
-
-        // if this is our first time being called, calculate/read visualizer
-        // parameters
-        if (!called) {
-                called = true;
-                calc_parameters(song);
-        }
 
-        // generate the spectrum for the current time slice
-        if (!make_spectrum(song, start, spec)) {
-            final_count += 1;
+        // analyze the current time slice
+        if (!next_bands(song, start, bands)) {
+            final_count_ += 1;
             for (y = 0; y < frame::HEIGHT; ++y) {
                 for (x = frame::WIDTH; x-- > 1;)
                         frame.at(x, y) = frame.at(x-1, y);
                 frame.at(0, y) = pixel(0, 0, 0);
             }
-            if (final_count <= 32) {
+            if (final_count_ <= 32) {
                 return true;
             }
             return false;
         }
 
         // pick the pixels for the new column
-        new_col = pick_pixels(spec);
+        new_col = pick_pixels(bands);
 
         // shift the frame over and add the new column on the left edge
         for (y = 0; y < frame::HEIGHT; ++y) {
@@ -309,21 +771,37 @@ pixel scrolling_fft_generator::rainbow(float x)
                      127*(1 + cos(f - 2*phase)));
 }
 
+bool scrolling_fft_generator::compute_bands(const wav_reader& song,
+                                            microseconds start,
+                                            band_levels& bands)
+{
+        spectrum spec;
+        size_t first;
+
+        if (filtered_)
+                return filter_bands(song, start, max_, filters_, bands);
+        if (!make_spectrum(song, start, spec))
+                return false;
+        if (spec.empty()) {
+                bands.fill(0);
+                return true;
+        }
+        first = frame_rate_ >> quality().fft_shift;
+        bin_spectrum(spec, first, spec.size()*spec_frac_ - first, max_,
+                     bands);
+        return true;
+}
+
 array<pixel, frame::HEIGHT>
-scrolling_fft_generator::pick_pixels(const vector<complex<float>>& spec)
+scrolling_fft_generator::pick_pixels(const band_levels& bands)
 {
-        const size_t b_0 = 8;
-        float alpha = compute_alpha(b_0, spec.size()*spec_frac_ - frame_rate_);
-        auto iter = spec.begin() + frame_rate_;
         array<pixel, frame::HEIGHT> col;
-        complex<float> sum;
-        size_t i, b;
+        size_t i;
         float bin;
 
-        for (i = 0; i < col.size(); ++i, iter += b) {
-                b = b_0*pow(alpha, i);
-                sum = accumulate(iter, iter + b, complex<float>(0));
-                bin = log(abs(sum) + 1)/log(b*max_);
+        static_assert(BANDS == frame::HEIGHT, "one band per row");
+        for (i = 0; i < col.size(); ++i) {
+                bin = bands[i];
                 if (bin < cutoff_)
                         col[i] = pixel(0,0,0);
                 else {
@@ -358,10 +836,221 @@ unsigned lambda_generator::get_frame_rate() const
         return frame_rate_;
 }
 
-static_fft_generator::static_fft_generator()
-        : frame_rate_(15), max_(0), rainbow_idx_(0), p_(0, 0, 0)
+generator_switch::generator_switch(frame_generator& initial)
+        : active_(&initial), pending_(nullptr), pending_song_(0),
+          song_(nullptr), songs_(0), params_pending_(false),
+          frame_rate_(initial.get_frame_rate()), passes_(0), playing_(false)
 {}
 
+void generator_switch::switch_to(frame_generator& g)
+{
+        lock_guard<mutex> lock(pending_lock_);
+        pending_song_ = 0;
+        pending_ = &g;
+}
+
+void generator_switch::prepare_and_switch(frame_generator& g)
+{
+        lock_guard<mutex> song_lock(song_lock_);
+        uint64_t prepared = 0;
+
+        if (song_) {
+                g.prepare(*song_);
+                prepared = songs_;
+        }
+        lock_guard<mutex> lock(pending_lock_);
+        pending_song_ = prepared;
+        pending_ = &g;
+}
+
+frame_generator& generator_switch::active() const
+{
+        frame_generator *pending = pending_;
+        return pending ? *pending : *active_;
+}
+
+bool generator_switch::uses(const frame_generator& g) const
+{
+        lock_guard<mutex> lock(pending_lock_);
+        return active_ == &g || pending_ == &g;
+}
+
+void generator_switch::retire(const frame_generator& g, shared_ptr<void> owner)
+{
+        retiree r = { &g, move(owner), false, 0 };
+
+        {
+                lock_guard<mutex> lock(retired_lock_);
+                retired_.push_back(move(r));
+        }
+        collect();
+}
+
+size_t generator_switch::collect()
+{
+        // declared first so the owners are dropped after the locks are
+        // released; a plugin's destructor runs dlclose
+        vector<shared_ptr<void>> dropped;
+
+        // set_parameter picks its target under params_lock_, so once g
+        // is out of use and its changes are gone here, none come back
+        lock_guard<mutex> params_lock(params_lock_);
+        lock_guard<mutex> lock(retired_lock_);
+        auto it = retired_.begin();
+
+        while (it != retired_.end()) {
+                const frame_generator *g = it->gen;
+                if (uses(*g)) {
+                        it->unused = false;
+                        ++it;
+                        continue;
+                }
+                params_.erase(remove_if(params_.begin(), params_.end(),
+                                        [&](const param_change& p) {
+                                                return p.target == g;
+                                        }),
+                              params_.end());
+                params_pending_ = !params_.empty();
+
+                // the pass that switched away from g may still be
+                // applying changes for it, so wait for the next one
+                if (!it->unused) {
+                        it->unused = true;
+                        it->pass = passes_;
+                }
+                if (playing_ && passes_ == it->pass) {
+                        ++it;
+                        continue;
+                }
+                dropped.push_back(move(it->owner));
+                it = retired_.erase(it);
+        }
+        return retired_.size();
+}
+
+bool generator_switch::set_parameter(const string& name, float value)
+{
+        lock_guard<mutex> lock(params_lock_);
+        param_change change = { &active(), name, value };
+        params_.push_back(change);
+        params_pending_ = true;
+        return true;
+}
+
+void generator_switch::apply_pending(const wav_reader& song)
+{
+        frame_generator *next;
+        vector<param_change> params;
+
+        if (pending_) {
+                // under the lock so uses() never sees next in neither place
+                lock_guard<mutex> lock(pending_lock_);
+                next = pending_.exchange(nullptr);
+                if (next) {
+                        next->set_quality(quality());
+                        if (pending_song_ != songs_)
+                                next->prepare(song);
+                        active_ = next;
+                }
+        }
+
+        if (params_pending_) {
+                {
+                        lock_guard<mutex> lock(params_lock_);
+                        params.swap(params_);
+                        params_pending_ = false;
+                }
+                for (auto& p : params)
+                        if (!p.target->set_parameter(p.name, p.value))
+                                cerr << "unknown parameter " << p.name
+                                     << endl;
+        }
+
+        // nothing from before this point is used any more; see collect()
+        ++passes_;
+}
+
+void generator_switch::prepare(const wav_reader& song)
+{
+        {
+                lock_guard<mutex> lock(song_lock_);
+                song_ = &song;
+                ++songs_;
+        }
+        playing_ = true;
+        apply_pending(song);
+        active_.load()->prepare(song);
+        frame_rate_ = active_.load()->get_frame_rate();
+}
+
+void generator_switch::finish()
+{
+        {
+                lock_guard<mutex> lock(song_lock_);
+                song_ = nullptr;
+        }
+        active_.load()->finish();
+        playing_ = false;
+}
+
+bool generator_switch::make_next_frame(const wav_reader& song,
+                                       std::chrono::microseconds start,
+                                       frame& frame)
+{
+        frame_generator *g;
+        bool more;
+
+        apply_pending(song);
+        g = active_;
+        more = g->make_next_frame(song, start, frame);
+        frame_rate_ = g->get_frame_rate();
+        return more;
+}
+
+unsigned generator_switch::get_frame_rate() const
+{
+        return frame_rate_;
+}
+
+void generator_switch::set_quality(const quality_level& q)
+{
+        frame_generator::set_quality(q);
+        active_.load()->set_quality(q);
+}
+
+static_fft_generator::static_fft_generator()
+        : frame_rate_(15), max_(0), rainbow_idx_(0), p_(0, 0, 0),
+          filtered_(false)
+{
+        glow_.configure(0.1, get_frame_interval());
+}
+
+void static_fft_generator::prepare(const wav_reader& song)
+{
+        max_ = song.max_sample();
+        reset_bands();
+        glow_.reset();
+        // up to Nyquist like the FFT bands, which configure brings down
+        // to the highest band it can make
+        filters_.configure(song.sample_rate(), 50, song.sample_rate()/2);
+}
+
+bool static_fft_generator::set_parameter(const string& name, float value)
+{
+        if (name == "frame_rate" && value >= 1)
+                frame_rate_ = value;
+        else if (name == "afterglow" && value >= 0)
+                glow_.configure(value, get_frame_interval());
+        else if (name == "filterbank")
+                filtered_ = value != 0;
+        else
+                return frame_generator::set_parameter(name, value);
+
+        // the per frame decay depends on the frame rate
+        glow_.configure(glow_.half_life(), get_frame_interval());
+        return true;
+}
+
 pixel static_fft_generator::rainbow(float x)
 {
         float f = 2*M_PI*x;
@@ -376,33 +1065,20 @@ bool static_fft_generator::make_next_frame(const wav_reader& song,
                                            std::chrono::microseconds start,
                                            frame& frame)
 {
-        static bool called = false;
-        vector<complex<float>> spec;
-        size_t row, col, b;
-        const size_t b_0 = 8;
-        float alpha, bin;
-        typename vector<complex<float>>::iterator iter;
-        complex<float> sum;
-
-        if (!called) {
-                max_ = song.max_sample();
-                called = true;
-        }
+        band_levels bands;
+        size_t row, col;
 
-        if (!make_spectrum(song, start, spec))
+        static_assert(BANDS == frame::WIDTH, "one band per column");
+        if (!next_bands(song, start, bands))
                 return false;
 
         // clear the frame
         fill(frame.begin(), frame.end(), pixel(0,0,0));
-        alpha = compute_alpha(b_0, spec.size()*0.5 - frame_rate_);
-        iter = spec.begin();
-        for (col = 0; col < frame::WIDTH; ++col, iter += b) {
-                b = b_0*pow(alpha, col);
-                sum = accumulate(iter, iter + b, complex<float>(0));
-                bin = log(abs(sum) + 1)/log(b*max_);
-                for (row = 0; row < bin*frame::HEIGHT; ++row)
+        for (col = 0; col < frame::WIDTH; ++col) {
+                for (row = 0; row < bands[col]*frame::HEIGHT; ++row)
                         frame.at(col, frame::HEIGHT - (1+row)) = p_;
         }
+        glow_.apply(frame);
 
         rainbow_idx_ += 0.005;
         p_ = rainbow(rainbow_idx_);
@@ -410,6 +1086,25 @@ bool static_fft_generator::make_next_frame(const wav_reader& song,
         return true;
 }
 
+bool static_fft_generator::compute_bands(const wav_reader& song,
+                                         microseconds start,
+                                         band_levels& bands)
+{
+        spectrum spec;
+
+        if (filtered_)
+                return filter_bands(song, start, max_, filters_, bands);
+        if (!make_spectrum(song, start, spec))
+                return false;
+        if (spec.empty()) {
+                bands.fill(0);
+                return true;
+        }
+        bin_spectrum(spec, 0, spec.size()*0.5 -
+                     (frame_rate_ >> quality().fft_shift), max_, bands);
+        return true;
+}
+
 unsigned static_fft_generator::get_frame_rate() const
 {
         return frame_rate_;
@@ -8,15 +8,25 @@
 
 #pragma once
 
+#include "afterglow.hpp"
+#include "fft_backend.hpp"
+#include "filterbank.hpp"
+#include "quality.hpp"
 #include "wav_reader.hpp"
 
 #include <array>
+#include <atomic>
 #include <chrono>
 #include <complex>
 #include <cstdint>
 #include <functional>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <tuple>
+#include <vector>
+
+#include <sys/types.h>
 
 // wrapper class for RGB 3-tuples with 8-bit color channels. No alpha
 // because the underlying display doesn't support it.
@@ -47,7 +57,15 @@ public:
         pixel& at(size_t x, size_t y);
         const pixel& at(size_t x, size_t y) const;
 
-        // write the contents of the frame over SPI to the FPGA
+        // the frame as the FPGA expects it on the SPI bus: rows in order,
+        // two 12-bit pixels per 3 bytes
+        static constexpr size_t PACKED_SIZE = 3*32*32/2;
+        typedef std::array<uint8_t, PACKED_SIZE> packed;
+        void pack(packed& out) const;
+
+        // write the contents of the frame over SPI to the FPGA. Skipped
+        // if it packs the same as the last frame written, since the
+        // panel is still showing that.
         void write() const;
 
         // move all of the columns of the frame one to the right, replacing
@@ -58,17 +76,81 @@ public:
         static constexpr unsigned HEIGHT = 32;
 };
 
+// abstract destination for finished frames. play_song hands every frame to
+// each sink attached to the generator; with no sinks attached, frames go
+// straight out over SPI via frame::write.
+class frame_sink {
+public:
+        virtual ~frame_sink() = default;
+
+        virtual void write(const frame& f) = 0;
+};
+
+// sink that writes frames over SPI to the FPGA. Only needed when frames
+// should go to the panel as well as to some other sink.
+class spi_sink : public frame_sink {
+public:
+        void write(const frame& f);
+};
+
 // abstract base class for all frame generating things. music visualizers
 // should inherit from this class and implement all the virtual methods
 // Also provides a song playing method for all frame generators to use
 class frame_generator {
 public:
+        frame_generator();
         virtual ~frame_generator() = default;
 
         // play and visualize a song.
         void play_song(const std::string& fname);
 
+        // play fname unless stop() has been called since stops() returned
+        // seen, so a caller that picks the song under its own lock doesn't
+        // miss a stop that comes before play_song gets going
+        void play_song(const std::string& fname, uint64_t seen);
+
+        // make a play_song running on another thread stop the audio and
+        // return at the next frame
+        void stop();
+
+        // how many times stop() has been called
+        uint64_t stops() const;
+
+        // set a named tuning parameter (e.g. "cutoff"). Every generator
+        // has "silence", the level below which it doesn't bother
+        // analyzing a slice. Returns false if the generator has no such
+        // parameter. Not safe to call while the generator is rendering
+        // on another thread; go through a generator_switch for that.
+        virtual bool set_parameter(const std::string& name, float value);
+
+        // render every frame of a song as fast as possible, without playing
+        // it, handing each frame to out in order. Returns the number of
+        // frames rendered.
+        size_t render_song(const wav_reader& song,
+                           const std::function<void(const frame&)>& out);
+
+        // frames per second this generator renders at. Some generators
+        // only know this once they've seen the song.
+        unsigned frame_rate() const;
+
+        // send frames to sink instead of (or, with an spi_sink, as well as)
+        // the SPI bus. The sink must outlive any calls to play_song.
+        void add_sink(frame_sink& sink);
+
+        // loudness of each log spaced band of a spectrum, roughly 0 to 1
+        static const size_t BANDS = 32;
+        typedef std::array<float, BANDS> band_levels;
+
 protected:
+        // called once per song before the first make_next_frame, so
+        // generators can look at the whole song (e.g. its loudest sample)
+        // and reset any per-song state.
+        virtual void prepare(const wav_reader& song);
+
+        // called once per song after the last make_next_frame, once the
+        // song is about to go away
+        virtual void finish();
+
         // generate the next frame to display based on a set of samples
         // for the next time slice.
         virtual bool
@@ -79,10 +161,46 @@ protected:
 
         std::chrono::microseconds get_frame_interval() const;
 
-        // create the spectrum of the next time sample
+        // how much work to do per frame. play_song lowers this when
+        // rendering falls behind; everywhere else it's full quality.
+        virtual void set_quality(const quality_level& q);
+        const quality_level& quality() const;
+
+        // create the spectrum of the next time sample, at the current
+        // quality. If the slice is silent (its loudest sample under the
+        // "silence" parameter times the song's loudest) the FFT is
+        // skipped and spec is left empty.
         bool make_spectrum(const wav_reader& song,
                            std::chrono::microseconds start,
-                           std::vector<std::complex<float>>& spec);
+                           spectrum& spec);
+
+        // work out band levels for the frame at start. Generators that
+        // use next_bands implement this.
+        virtual bool compute_bands(const wav_reader& song,
+                                   std::chrono::microseconds start,
+                                   band_levels& bands);
+
+        // compute_bands, or when quality().interpolate is set, every
+        // other frame interpolated from its neighbours. Call reset_bands
+        // in prepare so nothing carries over between songs.
+        bool next_bands(const wav_reader& song,
+                        std::chrono::microseconds start,
+                        band_levels& bands);
+        void reset_bands();
+
+        // bin spec into bands of logarithmically growing width, starting
+        // at bin first and spreading over span bins, scaled against the
+        // song's loudest sample. Follows quality().
+        void bin_spectrum(const spectrum& spec, size_t first, size_t span,
+                          float max, band_levels& bands) const;
+
+        // the compute_bands of generators with a "filterbank" parameter:
+        // run the frame's slice of the song (its last interval >>
+        // fft_shift, at lower quality) through filters and read off their
+        // envelopes, scaled against max
+        bool filter_bands(const wav_reader& song,
+                          std::chrono::microseconds start, float max,
+                          filterbank& filters, band_levels& bands);
 
         // In pick_pixels we want to bin the spectrum into bins of
         // logrithmic size where each bin size is b_i = alpha*b_{i-1}.
@@ -92,6 +210,34 @@ protected:
 
 private:
         using clock_t = std::chrono::high_resolution_clock;
+
+        // forwards make_next_frame and friends to other generators
+        friend class generator_switch;
+
+        // lends make_spectrum and bin_spectrum to pipeline stages
+        friend class frame_context;
+
+        // hand a finished frame to the sinks
+        void output(const frame& f);
+
+        quality_level quality_;
+
+        // make_spectrum's silence gate, relative to the loudest sample
+        float silence_;
+
+        // the make_spectrum window, cached for its size
+        std::vector<float> window_;
+
+        // next_bands' neighbours: the last frame analyzed, and the frame
+        // after an interpolated one, which had to be analyzed early
+        band_levels last_bands_, ahead_bands_;
+        std::chrono::microseconds last_start_, ahead_start_;
+        bool have_last_, have_ahead_;
+
+        std::vector<frame_sink*> sinks_;
+        std::atomic<bool> stop_;
+        std::atomic<uint64_t> stops_;
+        std::atomic<pid_t> player_pid_;
 };
 
 // basic fft frame generator. not yet implemented
@@ -100,7 +246,11 @@ public:
         scrolling_fft_generator();
         ~scrolling_fft_generator() = default;
 
+        bool set_parameter(const std::string& name, float value);
+
 protected:
+        void prepare(const wav_reader& song);
+
         bool make_next_frame(const wav_reader& song,
                              std::chrono::microseconds start,
                              frame& frame);
@@ -110,11 +260,14 @@ protected:
 private:
         // find what fraction of the spectrum has interesting data
         void calc_parameters(const wav_reader& song);
-       
 
-        // use spectrum to choose the next column of pixels to display
+        bool compute_bands(const wav_reader& song,
+                           std::chrono::microseconds start,
+                           band_levels& bands);
+
+        // use band levels to choose the next column of pixels to display
         std::array<pixel, frame::HEIGHT>
-        pick_pixels(const std::vector<std::complex<float>>& spec);
+        pick_pixels(const band_levels& bands);
 
         // given a float in the range 0 <= x < 1, compute the pixel value
         // that is x percent of the way through a rainbow
@@ -124,6 +277,12 @@ private:
         float cutoff_;
         float max_;
         float spec_frac_;
+        bool params_loaded_;
+        size_t final_count_;
+
+        // "filterbank": use filters_ instead of the FFT
+        bool filtered_;
+        filterbank filters_;
 };
 
 // lambda generator. holds a function that is called in place of
@@ -146,19 +305,129 @@ protected:
         unsigned get_frame_rate() const;
 };
 
+// generator that forwards to another generator, which can be swapped
+// while a song is playing. Switches and parameter changes requested from
+// other threads are applied between frames, on the rendering thread.
+class generator_switch : public frame_generator {
+public:
+        explicit generator_switch(frame_generator& initial);
+        ~generator_switch() = default;
+
+        // render with g from the next frame on
+        void switch_to(frame_generator& g);
+
+        // prepare g for the song playing now (if any) on the calling
+        // thread, then render with it from the next frame on. The
+        // rendering thread just swaps a pointer. The end of the song
+        // waits for this, but frames don't.
+        void prepare_and_switch(frame_generator& g);
+
+        // the generator frames currently come from
+        frame_generator& active() const;
+
+        // true if g is active or about to be
+        bool uses(const frame_generator& g) const;
+
+        // keep owner, which keeps g alive (or the plugin g came from),
+        // until the rendering thread can't be using g any more, then drop
+        // it. That's once g is neither active nor pending and the
+        // rendering thread has come back round to the next frame, or
+        // finished the song, since. g mustn't be switched to again.
+        void retire(const frame_generator& g, std::shared_ptr<void> owner);
+
+        // drop whatever retire() has been keeping that is now safe to
+        // drop, on the calling thread. Returns how many are still kept.
+        size_t collect();
+
+        // queue a parameter change for the active generator (the one
+        // most recently switched to). Always returns true; unknown
+        // parameters are reported when applied.
+        bool set_parameter(const std::string& name, float value);
+
+protected:
+        void prepare(const wav_reader& song);
+        void finish();
+
+        bool make_next_frame(const wav_reader& song,
+                             std::chrono::microseconds start,
+                             frame& frame);
+
+        unsigned get_frame_rate() const;
+
+        // passed on to the active generator, and to each one switched to
+        void set_quality(const quality_level& q);
+
+private:
+        // apply any queued switch and parameter changes
+        void apply_pending(const wav_reader& song);
+
+        std::atomic<frame_generator*> active_;
+        std::atomic<frame_generator*> pending_;
+
+        // which song pending_ was prepared for (0 for none), set along
+        // with pending_ under pending_lock_
+        mutable std::mutex pending_lock_;
+        uint64_t pending_song_;
+
+        // the song being played, for prepare_and_switch. songs_ counts
+        // the songs prepared so far.
+        std::mutex song_lock_;
+        const wav_reader *song_;
+        uint64_t songs_;
+
+        struct param_change {
+                frame_generator *target;
+                std::string name;
+                float value;
+        };
+
+        std::mutex params_lock_;
+        std::vector<param_change> params_;
+        std::atomic<bool> params_pending_;
+
+        // the active generator's frame rate, refreshed by the rendering
+        // thread, so other threads needn't touch the generator
+        std::atomic<unsigned> frame_rate_;
+
+        // generators waiting to be dropped. pass is passes_ as of the
+        // first collect() that found gen out of use.
+        struct retiree {
+                const frame_generator *gen;
+                std::shared_ptr<void> owner;
+                bool unused;
+                uint64_t pass;
+        };
+
+        std::mutex retired_lock_;
+        std::vector<retiree> retired_;
+
+        // counts the rendering thread's trips through apply_pending, and
+        // whether it's between prepare and finish
+        std::atomic<uint64_t> passes_;
+        std::atomic<bool> playing_;
+};
+
 // just display the FFT
 class static_fft_generator : public frame_generator {
 public:
         static_fft_generator();
         ~static_fft_generator() = default;
 
+        bool set_parameter(const std::string& name, float value);
+
 protected:
+        void prepare(const wav_reader& song);
+
         bool make_next_frame(const wav_reader& song,
                              std::chrono::microseconds start,
                              frame& frame);
 
         unsigned get_frame_rate() const;
 
+        bool compute_bands(const wav_reader& song,
+                           std::chrono::microseconds start,
+                           band_levels& bands);
+
 private:
         static pixel rainbow(float x);
 
@@ -166,4 +435,11 @@ private:
         float max_;
         float rainbow_idx_;
         pixel p_;
+
+        // bars fade out over "afterglow" seconds instead of vanishing
+        afterglow glow_;
+
+        // "filterbank": use filters_ instead of the FFT
+        bool filtered_;
+        filterbank filters_;
 };
@@ -0,0 +1,160 @@
+/**
+ * \file frame_ring.cpp
+ *
+ * \brief Shared memory frame ring implementation.
+ */
+
+#include "frame_ring.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+constexpr unsigned frame_ring::SLOTS;
+constexpr unsigned frame_ring::FRAME_BYTES;
+const char *const frame_ring::DEFAULT_NAME = "/musicvis_frames";
+
+static const uint32_t RING_MAGIC = 0x6d767266; // "mvrf"
+
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2,
+              "the frame ring needs lock free 64 bit atomics");
+
+frame_ring::frame_ring(const string& name, bool writer)
+        : mem_(NULL)
+{
+        struct stat st;
+        void *addr;
+        int fd;
+
+        fd = shm_open(name.c_str(), writer ? O_RDWR | O_CREAT : O_RDONLY,
+                      0644);
+        if (fd < 0)
+                throw runtime_error("frame_ring: shm_open " + name + ": "
+                                    + strerror(errno));
+
+        if (fstat(fd, &st) < 0 ||
+            (writer && size_t(st.st_size) != sizeof(layout) &&
+             ftruncate(fd, sizeof(layout)) < 0)) {
+                close(fd);
+                throw runtime_error("frame_ring: can't size " + name + ": "
+                                    + strerror(errno));
+        }
+        if (!writer && size_t(st.st_size) != sizeof(layout)) {
+                close(fd);
+                throw runtime_error("frame_ring: " + name +
+                                    " has the wrong size");
+        }
+
+        addr = mmap(NULL, sizeof(layout),
+                    writer ? PROT_READ | PROT_WRITE : PROT_READ,
+                    MAP_SHARED, fd, 0);
+        close(fd);
+        if (addr == MAP_FAILED)
+                throw runtime_error("frame_ring: mmap " + name + ": "
+                                    + strerror(errno));
+        mem_ = (layout *)addr;
+
+        // An existing ring we keep appending to, so viewers that are
+        // already attached carry on across songs. Anything else the writer
+        // clears; all zeros is a valid empty ring once the header is set.
+        if (mem_->magic == RING_MAGIC && mem_->slots == SLOTS &&
+            mem_->width == frame::WIDTH && mem_->height == frame::HEIGHT)
+                return;
+
+        if (!writer) {
+                munmap(mem_, sizeof(layout));
+                throw runtime_error("frame_ring: " + name +
+                                    " isn't a frame ring");
+        }
+        memset((void *)mem_, 0, sizeof(layout));
+        mem_->slots = SLOTS;
+        mem_->width = frame::WIDTH;
+        mem_->height = frame::HEIGHT;
+        mem_->magic = RING_MAGIC;
+}
+
+frame_ring::~frame_ring()
+{
+        munmap(mem_, sizeof(layout));
+}
+
+void frame_ring::push(const frame& f)
+{
+        uint64_t n = mem_->head.load(memory_order_relaxed);
+        slot& s = mem_->ring[n % SLOTS];
+        uint8_t *p = s.rgb;
+        size_t i;
+
+        s.seq.store(2*n + 1, memory_order_relaxed);
+        atomic_thread_fence(memory_order_release);
+
+        for (i = 0; i < f.size(); ++i) {
+                *p++ = f[i].red();
+                *p++ = f[i].green();
+                *p++ = f[i].blue();
+        }
+
+        s.seq.store(2*n + 2, memory_order_release);
+        mem_->head.store(n + 1, memory_order_release);
+}
+
+uint64_t frame_ring::head() const
+{
+        return mem_->head.load(memory_order_acquire);
+}
+
+bool frame_ring::read(uint64_t index, frame& f) const
+{
+        const slot& s = mem_->ring[index % SLOTS];
+        uint8_t rgb[FRAME_BYTES];
+        const uint8_t *p = rgb;
+        uint64_t before, after;
+        size_t i;
+
+        before = s.seq.load(memory_order_acquire);
+        if (before != 2*index + 2)
+                return false;
+
+        memcpy(rgb, s.rgb, sizeof rgb);
+
+        atomic_thread_fence(memory_order_acquire);
+        after = s.seq.load(memory_order_relaxed);
+        if (after != before)
+                return false;
+
+        for (i = 0; i < f.size(); ++i, p += 3)
+                f[i] = pixel(p[0], p[1], p[2]);
+        return true;
+}
+
+bool frame_ring::read_latest(uint64_t& index, frame& f) const
+{
+        uint64_t h;
+
+        // if the writer laps us mid copy, just try again with the new head
+        for (;;) {
+                h = head();
+                if (h == 0)
+                        return false;
+                if (read(h - 1, f)) {
+                        index = h - 1;
+                        return true;
+                }
+        }
+}
+
+frame_ring_sink::frame_ring_sink(const string& name)
+        : ring_(name, true)
+{}
+
+void frame_ring_sink::write(const frame& f)
+{
+        ring_.push(f);
+}
@@ -0,0 +1,82 @@
+/**
+ * \file frame_ring.hpp
+ *
+ * \brief A ring of recent frames in POSIX shared memory, so frames can be
+ * watched from another process (see frame_viewer.cpp) without a panel.
+ *
+ * \detail The writer never waits for readers. Each slot carries a sequence
+ * number that is odd while the slot is being written (a seqlock): the
+ * writer bumps it, copies the pixels and bumps it again, then publishes
+ * the new head. A reader copies a slot out and only trusts the copy if the
+ * sequence number was even and unchanged across the copy, so a slow reader
+ * just loses frames instead of holding up the renderer.
+ */
+
+#pragma once
+
+#include "frame.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+class frame_ring {
+public:
+        static constexpr unsigned SLOTS = 64;
+        static constexpr unsigned FRAME_BYTES = 3*frame::WIDTH*frame::HEIGHT;
+
+        // default shared memory object name
+        static const char *const DEFAULT_NAME;
+
+        // map the ring called name. The writer creates it if needed; a
+        // reader fails if it doesn't exist. Throws std::runtime_error if
+        // the shared memory can't be opened or has the wrong layout.
+        frame_ring(const std::string& name, bool writer);
+        ~frame_ring();
+
+        frame_ring(const frame_ring&) = delete;
+        frame_ring& operator=(const frame_ring&) = delete;
+
+        // publish a frame. Wait-free; only one writer per ring.
+        void push(const frame& f);
+
+        // number of frames ever published; the newest is head() - 1
+        uint64_t head() const;
+
+        // copy frame number index into f. Returns false if that frame
+        // hasn't been published yet or has already been overwritten.
+        bool read(uint64_t index, frame& f) const;
+
+        // copy the newest frame into f and its number into index. Returns
+        // false if nothing has been published yet.
+        bool read_latest(uint64_t& index, frame& f) const;
+
+private:
+        struct slot {
+                std::atomic<uint64_t> seq;
+                uint8_t rgb[FRAME_BYTES];
+        };
+
+        struct layout {
+                uint32_t magic;
+                uint32_t slots;
+                uint32_t width;
+                uint32_t height;
+                std::atomic<uint64_t> head;
+                slot ring[SLOTS];
+        };
+
+        layout *mem_;
+};
+
+// frame sink that publishes every frame to a frame_ring
+class frame_ring_sink : public frame_sink {
+public:
+        explicit frame_ring_sink(const std::string& name =
+                                 frame_ring::DEFAULT_NAME);
+
+        void write(const frame& f);
+
+private:
+        frame_ring ring_;
+};
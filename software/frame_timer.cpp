@@ -0,0 +1,90 @@
+/**
+ * \file frame_timer.cpp
+ *
+ * \brief Hybrid sleep/spin frame timer implementation.
+ */
+
+#include "frame_timer.hpp"
+#include "piHelpers.h"
+
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+
+#include <time.h>
+
+using namespace std;
+using namespace chrono;
+
+const microseconds frame_timer::DEFAULT_SPIN(500);
+
+static atomic<long> default_spin_us(frame_timer::DEFAULT_SPIN.count());
+
+// tell the core we're spinning, so a hyperthread sibling gets the
+// pipeline and the Pi doesn't heat up for nothing
+static inline void cpu_relax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#elif defined(__arm__) || defined(__aarch64__)
+        __asm__ __volatile__("yield");
+#endif
+}
+
+void frame_timer::set_default_spin(microseconds spin)
+{
+        default_spin_us = spin.count() < 0 ? 0 : spin.count();
+}
+
+microseconds frame_timer::default_spin()
+{
+        return microseconds(default_spin_us.load());
+}
+
+frame_timer::frame_timer()
+        : spin_(default_spin())
+{}
+
+frame_timer::frame_timer(microseconds spin)
+        : spin_(spin.count() < 0 ? microseconds(0) : spin)
+{}
+
+microseconds frame_timer::spin() const
+{
+        return spin_;
+}
+
+nanoseconds frame_timer::wait_until(steady_clock::time_point deadline)
+{
+        const steady_clock::time_point wake = deadline - spin_;
+        volatile unsigned int *timer = sysTimer();
+        nanoseconds left, late;
+        uint32_t target;
+        timespec ts;
+
+        // sleep for the bulk of it. An absolute sleep doesn't drift if
+        // we're preempted on the way in. steady_clock is CLOCK_MONOTONIC
+        // in both libstdc++ and libc++ on Linux.
+        if (steady_clock::now() < wake) {
+                left = wake.time_since_epoch();
+                ts.tv_sec = duration_cast<seconds>(left).count();
+                ts.tv_nsec = (left % seconds(1)).count();
+                while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts,
+                                       NULL) == EINTR)
+                        ;
+        }
+
+        // and spin the rest of the way
+        left = deadline - steady_clock::now();
+        if (timer && left > microseconds(1)) {
+                target = timer[1] + duration_cast<microseconds>(left).count();
+                while (int32_t(timer[1] - target) < 0)
+                        cpu_relax();
+        } else {
+                while (steady_clock::now() < deadline)
+                        cpu_relax();
+        }
+
+        late = steady_clock::now() - deadline;
+        return late.count() < 0 ? nanoseconds(0) : late;
+}
@@ -0,0 +1,41 @@
+/**
+ * \file frame_timer.hpp
+ *
+ * \brief Wake up on a frame edge to within a few microseconds.
+ *
+ * \detail A stock kernel wakes a sleeping thread anywhere from 50 to 500us
+ * late, which shows up as jitter between frames. frame_timer sleeps until
+ * the spin budget before the deadline, then busy waits the rest of the
+ * way. On the Pi, once pTimerInit has mapped it, the busy wait watches the
+ * 1MHz system timer, which is a load from a register rather than a trip
+ * through the clock code; anywhere else it watches CLOCK_MONOTONIC.
+ *
+ * A bigger budget covers worse sleep latency but burns more CPU: at 20
+ * frames/s the default 500us is 1% of a core.
+ */
+
+#pragma once
+
+#include <chrono>
+
+class frame_timer {
+public:
+        static const std::chrono::microseconds DEFAULT_SPIN;
+
+        // spin is the budget used by timers made from now on
+        static void set_default_spin(std::chrono::microseconds spin);
+        static std::chrono::microseconds default_spin();
+
+        frame_timer();
+        explicit frame_timer(std::chrono::microseconds spin);
+
+        // wait for deadline. Returns how late we actually woke up (never
+        // negative; a deadline that has already passed returns at once).
+        std::chrono::nanoseconds
+        wait_until(std::chrono::steady_clock::time_point deadline);
+
+        std::chrono::microseconds spin() const;
+
+private:
+        std::chrono::microseconds spin_;
+};
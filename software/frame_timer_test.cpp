@@ -0,0 +1,81 @@
+/**
+ * \file frame_timer_test.cpp
+ *
+ * \brief Tests for frame_timer: it never wakes early, returns straight away
+ * from a deadline that has passed, and with a spin window really spins
+ * rather than sleeping to the deadline. How close each lands is only
+ * reported, since a loaded machine can make either late.
+ */
+
+#include "frame_timer.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <iostream>
+#include <vector>
+
+#include <time.h>
+
+using namespace std;
+using namespace chrono;
+
+// CPU time the calling thread has used
+static nanoseconds thread_cpu()
+{
+        timespec ts;
+
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+        return seconds(ts.tv_sec) + nanoseconds(ts.tv_nsec);
+}
+
+// median lateness over a run of 2ms frames, and the CPU time it took
+static nanoseconds median_error(frame_timer& timer, nanoseconds& cpu)
+{
+        steady_clock::time_point next = steady_clock::now();
+        vector<nanoseconds> errors;
+        nanoseconds late;
+        int i;
+
+        cpu = thread_cpu();
+
+        for (i = 0; i < 100; ++i) {
+                next += milliseconds(2);
+                late = timer.wait_until(next);
+                assert(late.count() >= 0);
+                assert(steady_clock::now() >= next);
+                errors.push_back(late);
+        }
+        cpu = thread_cpu() - cpu;
+        sort(errors.begin(), errors.end());
+        return errors[errors.size()/2];
+}
+
+int main(void)
+{
+        frame_timer sleeper(microseconds(0)), spinner(milliseconds(1));
+        steady_clock::time_point start;
+        nanoseconds slept, spun, sleep_cpu, spin_cpu;
+
+        assert(frame_timer().spin() == frame_timer::DEFAULT_SPIN);
+        frame_timer::set_default_spin(microseconds(-5));
+        assert(frame_timer().spin() == microseconds(0));
+        frame_timer::set_default_spin(frame_timer::DEFAULT_SPIN);
+
+        // a deadline in the past returns straight away
+        start = steady_clock::now();
+        spinner.wait_until(start - milliseconds(10));
+        assert(steady_clock::now() - start < milliseconds(1));
+
+        slept = median_error(sleeper, sleep_cpu);
+        spun = median_error(spinner, spin_cpu);
+        cout << "median wake error: sleep " << slept.count()/1000.0
+             << "us, sleep+spin " << spun.count()/1000.0 << "us" << endl;
+
+        // under load the spinner can be preempted and land later than the
+        // sleeper, but it still burns its share of the last millisecond
+        // of every frame, which sleeping never does
+        assert(spin_cpu > 2*sleep_cpu + milliseconds(5));
+
+        cout << "test passed" << endl;
+        return 0;
+}
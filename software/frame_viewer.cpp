@@ -0,0 +1,165 @@
+/**
+ * \file frame_viewer.cpp
+ *
+ * \brief Watch the frames a visualizer publishes to its frame_ring (run it
+ * with --shm) without a panel attached. Frames are drawn in the terminal
+ * using 24-bit ANSI colors, two pixel rows per text row with the upper
+ * half block character, or dumped to a numbered sequence of PPM files.
+ */
+
+#include "frame_ring.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+using namespace std;
+using namespace chrono;
+
+static void usage(const char *prog)
+{
+        cout << "usage: " << prog << " [--name /shm_name] [--ppm prefix] "
+             << "[--count n]" << endl;
+}
+
+static void draw(const frame& f, uint64_t index, uint64_t dropped)
+{
+        string out;
+        char buf[64];
+        size_t x, y;
+
+        // home the cursor and redraw in place rather than scrolling
+        out += "\x1b[H";
+        for (y = 0; y < frame::HEIGHT; y += 2) {
+                for (x = 0; x < frame::WIDTH; ++x) {
+                        const pixel& top = f.at(x, y);
+                        const pixel& bot = f.at(x, y + 1);
+                        snprintf(buf, sizeof buf,
+                                 "\x1b[38;2;%u;%u;%um\x1b[48;2;%u;%u;%um",
+                                 top.red(), top.green(), top.blue(),
+                                 bot.red(), bot.green(), bot.blue());
+                        out += buf;
+                        out += "▀";
+                }
+                out += "\x1b[0m\n";
+        }
+        snprintf(buf, sizeof buf, "frame %llu, %llu dropped\x1b[K\n",
+                 (unsigned long long)index, (unsigned long long)dropped);
+        out += buf;
+        fwrite(out.data(), 1, out.size(), stdout);
+        fflush(stdout);
+}
+
+static bool dump_ppm(const frame& f, const string& prefix, uint64_t index)
+{
+        char name[32];
+        size_t x, y;
+        FILE *fp;
+
+        snprintf(name, sizeof name, "%08llu.ppm", (unsigned long long)index);
+        fp = fopen((prefix + name).c_str(), "wb");
+        if (!fp)
+                return false;
+
+        fprintf(fp, "P6\n%u %u\n255\n", frame::WIDTH, frame::HEIGHT);
+        for (y = 0; y < frame::HEIGHT; ++y) {
+                for (x = 0; x < frame::WIDTH; ++x) {
+                        const pixel& p = f.at(x, y);
+                        fputc(p.red(), fp);
+                        fputc(p.green(), fp);
+                        fputc(p.blue(), fp);
+                }
+        }
+        return fclose(fp) == 0;
+}
+
+static int view(const frame_ring& ring, const string& ppm_prefix,
+                uint64_t count)
+{
+        uint64_t shown = 0, dropped = 0;
+        uint64_t next = 0, index, head;
+        bool have_prev = false;
+        frame f;
+
+        if (ppm_prefix.empty())
+                cout << "\x1b[2J";
+
+        while (count == 0 || shown < count) {
+                head = ring.head();
+                if (!have_prev && head > 0) {
+                        next = head - 1;
+                        have_prev = true;
+                }
+
+                if (!have_prev || next >= head) {
+                        this_thread::sleep_for(milliseconds(5));
+                        continue;
+                }
+
+                if (ppm_prefix.empty()) {
+                        // the terminal only wants the newest frame
+                        if (!ring.read_latest(index, f))
+                                continue;
+                        dropped += index - next;
+                        draw(f, index, dropped);
+                } else {
+                        // a PPM sequence wants every frame we can get. If
+                        // the producer has lapped us, skip ahead to the
+                        // oldest frame still in the ring.
+                        if (head - next > frame_ring::SLOTS) {
+                                dropped += head - frame_ring::SLOTS - next;
+                                next = head - frame_ring::SLOTS;
+                        }
+                        index = next;
+                        if (!ring.read(index, f)) {
+                                ++dropped;
+                                ++next;
+                                continue;
+                        }
+                        if (!dump_ppm(f, ppm_prefix, index)) {
+                                cerr << "can't write " << ppm_prefix
+                                     << index << ".ppm" << endl;
+                                return 1;
+                        }
+                }
+                next = index + 1;
+                ++shown;
+        }
+
+        if (!ppm_prefix.empty())
+                cerr << shown << " frames written, " << dropped
+                     << " dropped" << endl;
+        return 0;
+}
+
+int main(int argc, char **argv)
+{
+        string name = frame_ring::DEFAULT_NAME;
+        string ppm_prefix;
+        uint64_t count = 0;
+        int i;
+
+        for (i = 1; i < argc; ++i) {
+                if (strcmp(argv[i], "--name") == 0 && i+1 < argc) {
+                        name = argv[++i];
+                } else if (strcmp(argv[i], "--ppm") == 0 && i+1 < argc) {
+                        ppm_prefix = argv[++i];
+                } else if (strcmp(argv[i], "--count") == 0 && i+1 < argc) {
+                        count = stoull(argv[++i]);
+                } else {
+                        usage(argv[0]);
+                        return 1;
+                }
+        }
+
+        try {
+                frame_ring ring(name, false);
+                return view(ring, ppm_prefix, count);
+        } catch (const runtime_error& e) {
+                cerr << e.what() << endl;
+                return 1;
+        }
+}
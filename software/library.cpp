@@ -0,0 +1,454 @@
+/**
+ * \file library.cpp
+ *
+ * \brief Track analysis, the index file and library scanning.
+ */
+
+#include "library.hpp"
+#include "fft_backend.hpp"
+#include "task_pool.hpp"
+#include "wav_reader.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <stdexcept>
+#include <vector>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+using namespace chrono;
+
+const unsigned track_features::THUMB_COLUMNS;
+const unsigned track_features::THUMB_BANDS;
+
+static const uint32_t INDEX_MAGIC = 0x6d766c78; // "mvlx"
+static const uint32_t INDEX_VERSION = 1;
+
+struct index_header {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t record_size;
+        uint32_t count;
+        uint64_t paths_offset;
+        uint64_t paths_size;
+};
+
+// analysis window and hop, in samples. The hop sets the onset envelope's
+// rate, and so how finely tempo can be told apart.
+static const size_t WINDOW = 2048;
+static const size_t HOP = 512;
+
+// tempos considered, and the one guessed when a beat fits several
+static const float SLOWEST = 60, FASTEST = 200, LIKELY = 120;
+
+// thumbnail bands span these, in Hz
+static const float THUMB_LOW = 40, THUMB_HIGH = 16000;
+
+// save the index every this many files analyzed
+static const size_t CHECKPOINT = 32;
+
+// pick the beat period out of an onset envelope sampled at rate Hz.
+// Returns 0 if nothing repeats.
+static float estimate_tempo(vector<float>& onset, float rate)
+{
+        const size_t shortest = floor(rate*60/FASTEST);
+        const size_t longest = ceil(rate*60/SLOWEST);
+        const size_t n = onset.size();
+        float mean = 0, score, best_score = 0, a, b, c, shift = 0;
+        size_t i, lag, best = 0;
+        vector<float> r(longest + 2, 0);
+
+        if (shortest < 2 || n < 2*longest)
+                return 0;
+
+        // only rises above the usual level count as onsets
+        for (i = 0; i < n; ++i)
+                mean += onset[i]/n;
+        for (i = 0; i < n; ++i)
+                onset[i] = max(0.0f, onset[i] - mean);
+
+        for (lag = shortest - 1; lag <= longest + 1; ++lag) {
+                for (i = 0; i + lag < n; ++i)
+                        r[lag] += onset[i]*onset[i + lag];
+                r[lag] /= n - lag;
+        }
+
+        // a beat also correlates at twice its period, and half if there
+        // are off beats, so lean towards the commonest tempos
+        for (lag = shortest; lag <= longest; ++lag) {
+                score = log2(60*rate/lag/LIKELY);
+                score = r[lag]*exp(-0.5f*score*score);
+                if (score > best_score) {
+                        best_score = score;
+                        best = lag;
+                }
+        }
+        if (best == 0)
+                return 0;
+
+        a = r[best - 1];
+        b = r[best];
+        c = r[best + 1];
+        if (a - 2*b + c < 0)
+                shift = 0.5f*(a - c)/(a - 2*b + c);
+        return 60*rate/(best + shift);
+}
+
+bool analyze_track(const string& path, track_features& out)
+{
+        const float sigma = 0.4;
+
+        if (!wav_reader::readable(path))
+                return false;
+
+        wav_reader song(path);
+        const unsigned rate = song.sample_rate();
+        const size_t bins = WINDOW/2;
+        const size_t frames = song.size() < WINDOW ? 1 :
+                (song.size() - WINDOW)/HOP + 1;
+        const microseconds length((WINDOW*1000000 + rate - 1)/rate);
+        const float scale = 1000/max(1.0f, song.max_sample());
+        const float high = min(THUMB_HIGH, rate/2.0f);
+        vector<float> window(WINDOW), last(bins, 0), onset(frames), sample;
+        vector<int> band(bins, -1);
+        vector<double> cells(track_features::THUMB_COLUMNS*
+                             track_features::THUMB_BANDS, 0);
+        vector<size_t> column_frames(track_features::THUMB_COLUMNS, 0);
+        double energy = 0, weighted = 0, power = 0, loudest = 0;
+        size_t i, k, count = 0, column;
+        spectrum spec;
+        float x, m, hz, flux, db;
+
+        for (i = 0; i < WINDOW; ++i) {
+                x = (float(i) - (WINDOW - 1)/2.0f)/(sigma*(WINDOW - 1)/2);
+                window[i] = exp(-0.5f*x*x);
+        }
+        for (k = 1; k < bins; ++k) {
+                hz = float(k)*rate/WINDOW;
+                if (hz >= THUMB_LOW && hz < high)
+                        band[k] = min<int>(track_features::THUMB_BANDS - 1,
+                                track_features::THUMB_BANDS*
+                                log(hz/THUMB_LOW)/log(high/THUMB_LOW));
+        }
+
+        for (i = 0; i < frames; ++i) {
+                sample = song.get_range(
+                        microseconds(uint64_t(i)*HOP*1000000/rate), length);
+                sample.resize(min(sample.size(), WINDOW));
+
+                spec.clear();
+                for (k = 0; k < sample.size(); ++k) {
+                        energy += sample[k]*sample[k];
+                        spec.push_back(sample[k]*window[k]);
+                }
+                count += sample.size();
+                spec.resize(WINDOW);
+                default_fft_backend().forward(spec);
+
+                column = i*track_features::THUMB_COLUMNS/frames;
+                ++column_frames[column];
+                flux = 0;
+                for (k = 1; k < bins; ++k) {
+                        m = abs(spec[k]);
+                        power += m*m;
+                        weighted += double(m*m)*k*rate/WINDOW;
+                        if (band[k] >= 0)
+                                cells[column*track_features::THUMB_BANDS +
+                                      band[k]] += m*m;
+
+                        // onsets are rises in log magnitude, which
+                        // quieter instruments can make too
+                        m = log1p(scale*m);
+                        flux += max(0.0f, m - last[k]);
+                        last[k] = m;
+                }
+                onset[i] = flux;
+        }
+
+        out.seconds = float(song.size())/rate;
+        out.tempo = estimate_tempo(onset, float(rate)/HOP);
+        out.loudness = count && energy > 0 ?
+                10*log10(energy/count/(32768.0*32768.0)) : -120;
+        out.centroid = power > 0 ? weighted/power : 0;
+
+        for (column = 0; column < track_features::THUMB_COLUMNS; ++column)
+                for (k = 0; k < track_features::THUMB_BANDS; ++k) {
+                        double& cell =
+                                cells[column*track_features::THUMB_BANDS + k];
+                        cell /= max<size_t>(1, column_frames[column]);
+                        loudest = max(loudest, cell);
+                }
+        for (column = 0; column < track_features::THUMB_COLUMNS; ++column)
+                for (k = 0; k < track_features::THUMB_BANDS; ++k) {
+                        db = 10*log10(cells[column*
+                                            track_features::THUMB_BANDS + k]/
+                                      loudest);
+                        out.thumbnail[column][k] = loudest > 0 && db > -60 ?
+                                uint8_t(255*(1 + db/60)) : 0;
+                }
+        return true;
+}
+
+library_index::library_index(const string& path)
+        : mem_(NULL), length_(0), count_(0), records_(NULL), paths_(NULL),
+          paths_size_(0)
+{
+        const index_header *h;
+        struct stat st;
+        size_t i;
+        int fd;
+
+        fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+                throw runtime_error("library: can't open " + path + ": " +
+                                    strerror(errno));
+        if (fstat(fd, &st) < 0 || size_t(st.st_size) < sizeof(*h)) {
+                close(fd);
+                throw runtime_error("library: " + path +
+                                    " isn't a library index");
+        }
+        length_ = st.st_size;
+        mem_ = mmap(NULL, length_, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (mem_ == MAP_FAILED) {
+                mem_ = NULL;
+                throw runtime_error("library: mmap " + path + ": " +
+                                    strerror(errno));
+        }
+
+        h = (const index_header *)mem_;
+        count_ = h->count;
+        records_ = (const track_features *)(h + 1);
+        paths_ = (const char *)mem_ + h->paths_offset;
+        paths_size_ = h->paths_size;
+        bool valid = h->magic == INDEX_MAGIC &&
+                h->version == INDEX_VERSION &&
+                h->record_size == sizeof(track_features) &&
+                h->paths_offset == sizeof(*h) +
+                        uint64_t(count_)*sizeof(track_features) &&
+                h->paths_offset <= length_ &&
+                paths_size_ == length_ - h->paths_offset;
+
+        // a path that runs off the end would have readers run off too
+        for (i = 0; valid && i < count_; ++i)
+                valid = uint64_t(records_[i].path_offset) +
+                        records_[i].path_length < paths_size_ &&
+                        paths_[records_[i].path_offset +
+                               records_[i].path_length] == '\0';
+        if (!valid) {
+                munmap(mem_, length_);
+                throw runtime_error("library: " + path +
+                                    " isn't a version " +
+                                    to_string(INDEX_VERSION) +
+                                    " library index");
+        }
+}
+
+library_index::~library_index()
+{
+        munmap(mem_, length_);
+}
+
+size_t library_index::size() const
+{
+        return count_;
+}
+
+const track_features& library_index::operator[](size_t i) const
+{
+        return records_[i];
+}
+
+const char *library_index::path(size_t i) const
+{
+        return paths_ + records_[i].path_offset;
+}
+
+const track_features *library_index::find(const string& path) const
+{
+        size_t low = 0, high = count_, mid;
+        int order;
+
+        while (low < high) {
+                mid = low + (high - low)/2;
+                order = path.compare(this->path(mid));
+                if (order == 0)
+                        return &records_[mid];
+                if (order < 0)
+                        high = mid;
+                else
+                        low = mid + 1;
+        }
+        return nullptr;
+}
+
+// write tracks, in path order, to a temporary file and move it over path
+static void write_index(const string& path,
+                        const map<string, track_features>& tracks)
+{
+        const string tmp = path + ".tmp";
+        vector<track_features> records;
+        index_header h;
+        string paths;
+
+        for (const auto& t : tracks) {
+                records.push_back(t.second);
+                records.back().path_offset = paths.size();
+                records.back().path_length = t.first.size();
+                paths += t.first;
+                paths += '\0';
+        }
+        h.magic = INDEX_MAGIC;
+        h.version = INDEX_VERSION;
+        h.record_size = sizeof(track_features);
+        h.count = records.size();
+        h.paths_offset = sizeof(h) + records.size()*sizeof(track_features);
+        h.paths_size = paths.size();
+
+        ofstream out(tmp, ios::binary);
+        out.write((const char *)&h, sizeof(h));
+        out.write((const char *)records.data(),
+                  records.size()*sizeof(track_features));
+        out.write(paths.data(), paths.size());
+        out.close();
+        if (!out || rename(tmp.c_str(), path.c_str()) != 0)
+                throw runtime_error("library: can't write " + path);
+}
+
+static bool is_wav(const string& name)
+{
+        string ext;
+
+        if (name.size() < 4)
+                return false;
+        ext = name.substr(name.size() - 4);
+        transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+        return ext == ".wav";
+}
+
+// add every *.wav under dir to files. Hidden files and directories are
+// skipped, and so are symlinks to directories, which could loop.
+static void list_wavs(const string& dir, vector<string>& files, bool top)
+{
+        vector<string> subdirs;
+        struct dirent *e;
+        struct stat st;
+        string path;
+        DIR *d;
+
+        d = opendir(dir.c_str());
+        if (!d) {
+                if (top)
+                        throw runtime_error("library: can't read " + dir +
+                                            ": " + strerror(errno));
+                return;
+        }
+        while ((e = readdir(d))) {
+                if (e->d_name[0] == '.')
+                        continue;
+                path = dir + "/" + e->d_name;
+                if (lstat(path.c_str(), &st) < 0)
+                        continue;
+                if (S_ISDIR(st.st_mode))
+                        subdirs.push_back(path);
+                else if (is_wav(e->d_name) && stat(path.c_str(), &st) == 0
+                         && S_ISREG(st.st_mode))
+                        files.push_back(path);
+        }
+        closedir(d);
+
+        for (const string& sub : subdirs)
+                list_wavs(sub, files, false);
+}
+
+library_scan_stats scan_library(const string& dir, const string& index_path,
+                                task_pool& pool, ostream *log)
+{
+        struct pending {
+                string path;
+                int64_t mtime;
+                uint64_t size;
+        };
+        library_scan_stats stats = {0, 0, 0, 0};
+        map<string, track_features> old, tracks;
+        vector<pending> todo;
+        vector<string> files;
+        string root = dir;
+        size_t i, unsaved = 0;
+        struct stat st;
+        mutex lock;
+
+        while (root.size() > 1 && root.back() == '/')
+                root.pop_back();
+        list_wavs(root, files, true);
+
+        // no index yet, or one from another version, means starting over
+        try {
+                library_index index(index_path);
+                for (i = 0; i < index.size(); ++i)
+                        old[index.path(i)] = index[i];
+        } catch (const runtime_error&) {
+        }
+
+        for (const string& f : files) {
+                if (stat(f.c_str(), &st) < 0)
+                        continue;
+                const int64_t mtime = int64_t(st.st_mtim.tv_sec)*1000000000
+                        + st.st_mtim.tv_nsec;
+                auto found = old.find(f);
+                if (found != old.end() && found->second.mtime == mtime &&
+                    found->second.size == uint64_t(st.st_size)) {
+                        tracks[f] = found->second;
+                        ++stats.reused;
+                } else {
+                        todo.push_back({f, mtime, uint64_t(st.st_size)});
+                }
+                if (found != old.end())
+                        old.erase(found);
+        }
+        stats.removed = old.size();
+
+        task_group group(pool);
+        for (const pending& p : todo) {
+                group.run([&, p]() {
+                        track_features t;
+                        bool ok = analyze_track(p.path, t);
+                        lock_guard<mutex> guard(lock);
+
+                        if (!ok) {
+                                ++stats.failed;
+                                if (log)
+                                        *log << "can't read " << p.path
+                                             << endl;
+                                return;
+                        }
+                        t.mtime = p.mtime;
+                        t.size = p.size;
+                        tracks[p.path] = t;
+                        ++stats.analyzed;
+                        if (log)
+                                *log << stats.analyzed + stats.failed << "/"
+                                     << todo.size() << " " << p.path << endl;
+                        if (++unsaved == CHECKPOINT) {
+                                write_index(index_path, tracks);
+                                unsaved = 0;
+                        }
+                });
+        }
+        group.wait();
+
+        write_index(index_path, tracks);
+        return stats;
+}
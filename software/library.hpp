@@ -0,0 +1,105 @@
+/**
+ * \file library.hpp
+ *
+ * \brief Whole library analysis: tempo, loudness, spectral centroid and a
+ * spectrogram thumbnail for every WAV under a directory, kept in an index
+ * file that playlist tools map and query without parsing anything.
+ *
+ * \detail The index is a header, then one fixed size track_features
+ * record per file sorted by path, then the paths themselves:
+ *
+ *     header      magic "mvlx", version, record size, record count,
+ *                 where the paths start and how many bytes they take
+ *     records     track_features[count]
+ *     paths       each path and a NUL, in record order
+ *
+ * so library_index maps the file and hands out pointers into it, and
+ * finding a path is a binary search. Files are written to a temporary
+ * name and renamed into place, so readers never see half an index.
+ *
+ * scan_library only analyzes files whose size or modification time
+ * differ from their record in the existing index, and saves the index
+ * every few files as it goes, so an interrupted scan picks up where it
+ * left off. Each file is analyzed by one task on a task_pool, so at most
+ * one song per worker is in memory at once.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <iosfwd>
+#include <string>
+
+class task_pool;
+
+struct track_features {
+        static const unsigned THUMB_COLUMNS = 64;
+        static const unsigned THUMB_BANDS = 16;
+
+        // what the file looked like when it was analyzed
+        int64_t mtime;          // nanoseconds since the epoch
+        uint64_t size;          // bytes
+
+        // where the path is in the index
+        uint32_t path_offset;
+        uint32_t path_length;
+
+        float seconds;
+        float tempo;            // beats per minute, 0 if none was found
+        float loudness;         // RMS, in dB below full scale
+        float centroid;         // Hz, of the power over the whole song
+
+        // log spaced bands (low first) over equal slices of the song,
+        // 255 for the loudest cell down to 0 for 60dB quieter or less
+        uint8_t thumbnail[THUMB_COLUMNS][THUMB_BANDS];
+};
+
+// analyze one file, filling in everything but mtime, size and the path.
+// Returns false if it isn't a WAV wav_reader can read.
+bool analyze_track(const std::string& path, track_features& out);
+
+// a mapped index file
+class library_index {
+public:
+        // Throws std::runtime_error if path can't be mapped or isn't an
+        // index of this version.
+        explicit library_index(const std::string& path);
+        ~library_index();
+
+        library_index(const library_index&) = delete;
+        library_index& operator=(const library_index&) = delete;
+
+        size_t size() const;
+
+        // records in path order
+        const track_features& operator[](size_t i) const;
+        const char *path(size_t i) const;
+
+        // the record for path, spelled as it was scanned, or null
+        const track_features *find(const std::string& path) const;
+
+private:
+        void *mem_;
+        size_t length_;
+        size_t count_;
+        const track_features *records_;
+        const char *paths_;
+        size_t paths_size_;
+};
+
+struct library_scan_stats {
+        size_t analyzed;        // new or changed, and analyzed
+        size_t reused;          // unchanged since the last scan
+        size_t failed;          // not readable WAVs
+        size_t removed;         // in the old index but gone now
+};
+
+// analyze every *.wav under dir (recursively) that isn't already up to
+// date in the index at index_path, and rewrite the index. Records are
+// keyed by dir joined with the file's path under it. Reports progress on
+// log, if given. Throws std::runtime_error if dir can't be read or the
+// index can't be written.
+library_scan_stats scan_library(const std::string& dir,
+                                const std::string& index_path,
+                                task_pool& pool, std::ostream *log = nullptr);
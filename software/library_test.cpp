@@ -0,0 +1,188 @@
+/**
+ * \file library_test.cpp
+ *
+ * \brief Tests for the library analyzer: features of synthetic songs come
+ * out right, the index maps and finds them, rescans only analyze what
+ * changed, and junk is skipped. Reads AmpUp.wav, so run it from the
+ * software directory.
+ */
+
+#include "library.hpp"
+#include "task_pool.hpp"
+
+#include <cassert>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+// write seconds of mono 16 bit audio at 44.1kHz, sample(t) for each
+static void write_wav(const string& path, float seconds,
+                      const function<float(float)>& sample)
+{
+        const uint32_t rate = 44100, n = seconds*rate, data = 2*n;
+        const uint32_t riff = 36 + data, fmt_size = 16, byte_rate = 2*rate;
+        const uint16_t pcm = 1, channels = 1, align = 2, bits = 16;
+        ofstream out(path, ios::binary);
+        uint32_t i;
+        int16_t s;
+
+        out.write("RIFF", 4);
+        out.write((const char *)&riff, 4);
+        out.write("WAVEfmt ", 8);
+        out.write((const char *)&fmt_size, 4);
+        out.write((const char *)&pcm, 2);
+        out.write((const char *)&channels, 2);
+        out.write((const char *)&rate, 4);
+        out.write((const char *)&byte_rate, 4);
+        out.write((const char *)&align, 2);
+        out.write((const char *)&bits, 2);
+        out.write("data", 4);
+        out.write((const char *)&data, 4);
+        for (i = 0; i < n; ++i) {
+                s = sample(float(i)/rate);
+                out.write((const char *)&s, 2);
+        }
+}
+
+static float tone(float t)
+{
+        return 16384*sin(2*float(M_PI)*1000*t);
+}
+
+// 10ms clicks at 100 beats per minute
+static float clicks(float t)
+{
+        const float since = fmod(t, 0.6f);
+
+        return since < 0.01f ?
+                20000*exp(-since*400)*sin(2*float(M_PI)*2000*t) : 0;
+}
+
+int main(void)
+{
+        char dir_template[] = "/tmp/library_testXXXXXX";
+        const string dir = mkdtemp(dir_template);
+        const string index_path = dir + "/library.idx";
+        const string click = dir + "/click.wav";
+        const string sine = dir + "/sub/tone.wav";
+        library_scan_stats stats;
+        track_features amp;
+        task_pool pool(2);
+        unsigned band;
+
+        mkdir((dir + "/sub").c_str(), 0755);
+        write_wav(click, 12, clicks);
+        write_wav(sine, 4, tone);
+        ofstream(dir + "/junk.wav") << "not a wav";
+        ofstream(dir + "/notes.txt") << "not a wav either";
+        write_wav(dir + "/.hidden.wav", 1, tone);
+
+        stats = scan_library(dir + "/", index_path, pool);
+        assert(stats.analyzed == 2 && stats.failed == 1);
+        assert(stats.reused == 0 && stats.removed == 0);
+        {
+                library_index index(index_path);
+                assert(index.size() == 2);
+                assert(index.path(0) == click && index.path(1) == sine);
+                assert(!index.find(dir + "/junk.wav"));
+
+                const track_features *t = index.find(sine);
+                assert(t && t == &index[1]);
+                assert(fabs(t->seconds - 4) < 0.01);
+                assert(fabs(t->loudness - 20*log10(0.5/sqrt(2))) < 0.1);
+                assert(fabs(t->centroid - 1000) < 50);
+
+                // 1kHz lands in one band, all the way along
+                band = 16*log(1000/40.0)/log(16000/40.0);
+                assert(t->thumbnail[0][band] > 250);
+                assert(t->thumbnail[32][band] > 250);
+                assert(t->thumbnail[32][0] == 0);
+
+                t = index.find(click);
+                assert(t && fabs(t->tempo - 100) < 2);
+        }
+
+        // nothing changed, so nothing is analyzed again
+        stats = scan_library(dir, index_path, pool);
+        assert(stats.analyzed == 0 && stats.reused == 2);
+
+        // a changed file is, and a deleted one drops out
+        write_wav(sine, 2, tone);
+        unlink(click.c_str());
+        stats = scan_library(dir, index_path, pool);
+        assert(stats.analyzed == 1 && stats.reused == 0);
+        assert(stats.removed == 1);
+        {
+                library_index index(index_path);
+                assert(index.size() == 1);
+                assert(fabs(index.find(sine)->seconds - 2) < 0.01);
+        }
+
+        // a broken index is refused, and a scan starts over
+        ofstream(index_path) << "mvlx but not really";
+        try {
+                library_index index(index_path);
+                assert(false);
+        } catch (const runtime_error&) {
+        }
+        stats = scan_library(dir, index_path, pool);
+        assert(stats.analyzed == 1);
+        assert(library_index(index_path).size() == 1);
+
+        // so is one whose header claims records past the end of the file,
+        // with a path size that wraps round to fit
+        {
+                ifstream in(index_path, ios::binary);
+                char header[32];
+                uint32_t count = 100000;
+                uint64_t offset = sizeof header + uint64_t(count)*
+                        sizeof(track_features), size = sizeof header - offset;
+
+                assert(in.read(header, sizeof header));
+                memcpy(header + 12, &count, 4);
+                memcpy(header + 16, &offset, 8);
+                memcpy(header + 24, &size, 8);
+                ofstream(index_path, ios::binary).write(header,
+                                                        sizeof header);
+                try {
+                        library_index index(index_path);
+                        assert(false);
+                } catch (const runtime_error&) {
+                }
+        }
+
+        bool missing = false;
+        try {
+                scan_library(dir + "/nope", index_path, pool);
+        } catch (const runtime_error&) {
+                missing = true;
+        }
+        assert(missing);
+
+        // a real song has a beat somewhere in range
+        assert(analyze_track("AmpUp.wav", amp));
+        assert(amp.tempo >= 60 && amp.tempo <= 200);
+        assert(amp.loudness < 0 && amp.centroid > 0);
+
+        unlink(index_path.c_str());
+        unlink(sine.c_str());
+        unlink((dir + "/junk.wav").c_str());
+        unlink((dir + "/notes.txt").c_str());
+        unlink((dir + "/.hidden.wav").c_str());
+        rmdir((dir + "/sub").c_str());
+        rmdir(dir.c_str());
+
+        cout << "test passed" << endl;
+        return 0;
+}
@@ -0,0 +1,317 @@
+/**
+ * \file metrics.cpp
+ *
+ * \brief Metrics registry and Prometheus endpoint implementation.
+ */
+
+#include "metrics.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using namespace std;
+
+constexpr unsigned metric_latency::BUCKETS;
+
+metric_counter::metric_counter()
+        : value_(0)
+{}
+
+uint64_t metric_counter::value() const
+{
+        return value_.load(memory_order_relaxed);
+}
+
+metric_gauge::metric_gauge()
+        : value_(0)
+{}
+
+int64_t metric_gauge::value() const
+{
+        return value_.load(memory_order_relaxed);
+}
+
+metric_latency::metric_latency()
+        : sum_ns_(0)
+{
+        for (auto& b : buckets_)
+                b.store(0, memory_order_relaxed);
+}
+
+uint64_t metric_latency::bucket_floor(unsigned b)
+{
+        unsigned lg;
+
+        if (b < 4)
+                return b;
+        lg = b/4 + 1;
+        return uint64_t(4 + b%4) << (lg - 2);
+}
+
+uint64_t metric_latency::count() const
+{
+        uint64_t n = 0;
+
+        for (auto& b : buckets_)
+                n += b.load(memory_order_relaxed);
+        return n;
+}
+
+double metric_latency::sum_seconds() const
+{
+        return sum_ns_.load(memory_order_relaxed) / 1e9;
+}
+
+double metric_latency::quantile(double q) const
+{
+        array<uint64_t, BUCKETS> counts;
+        uint64_t total = 0, seen = 0, rank;
+        unsigned b;
+
+        // take one snapshot so the walk below is consistent
+        for (b = 0; b < BUCKETS; ++b)
+                total += counts[b] = buckets_[b].load(memory_order_relaxed);
+        if (total == 0)
+                return 0;
+
+        rank = q*(total - 1);
+        for (b = 0; b < BUCKETS; ++b) {
+                seen += counts[b];
+                if (seen > rank)
+                        break;
+        }
+
+        // report the middle of the bucket
+        if (b + 1 >= BUCKETS)
+                return bucket_floor(b) / 1e9;
+        return (bucket_floor(b) + bucket_floor(b + 1)) / 2e9;
+}
+
+metrics_registry& metrics_registry::global()
+{
+        static metrics_registry registry;
+        return registry;
+}
+
+metrics_registry::entry&
+metrics_registry::find_or_add(kind type, const string& name,
+                              const string& help, const string& labels)
+{
+        lock_guard<mutex> lock(lock_);
+
+        for (entry& e : entries_)
+                if (e.name == name && e.labels == labels) {
+                        if (e.type != type)
+                                throw logic_error("metric " + name +
+                                                  " registered twice");
+                        return e;
+                }
+
+        entries_.emplace_back();
+        entry& e = entries_.back();
+        e.type = type;
+        e.name = name;
+        e.help = help;
+        e.labels = labels;
+        if (type == COUNTER)
+                e.c.reset(new metric_counter);
+        else if (type == GAUGE)
+                e.g.reset(new metric_gauge);
+        else
+                e.l.reset(new metric_latency);
+        return e;
+}
+
+metric_counter& metrics_registry::counter(const string& name,
+                                          const string& help,
+                                          const string& labels)
+{
+        return *find_or_add(COUNTER, name, help, labels).c;
+}
+
+metric_gauge& metrics_registry::gauge(const string& name, const string& help,
+                                      const string& labels)
+{
+        return *find_or_add(GAUGE, name, help, labels).g;
+}
+
+metric_latency& metrics_registry::latency(const string& name,
+                                          const string& help,
+                                          const string& labels)
+{
+        return *find_or_add(LATENCY, name, help, labels).l;
+}
+
+// "{labels}" or "{labels,extra}", or nothing if both are empty
+static string braces(const string& labels, const string& extra = "")
+{
+        if (labels.empty() && extra.empty())
+                return "";
+        if (labels.empty() || extra.empty())
+                return "{" + labels + extra + "}";
+        return "{" + labels + "," + extra + "}";
+}
+
+string metrics_registry::render() const
+{
+        static const char *const quantiles[] = { "0.5", "0.9", "0.99",
+                                                  "0.999" };
+        static const char *const types[] = { "counter", "gauge", "summary" };
+        ostringstream out;
+        vector<const entry*> sorted;
+        string last_name;
+        rusage ru;
+
+        lock_guard<mutex> lock(lock_);
+
+        // each name gets one HELP and TYPE, followed by all its series,
+        // or the exposition format is invalid. Threads register the same
+        // name with their own labels at any time, so group them here,
+        // keeping registration order otherwise.
+        for (const entry& e : entries_)
+                sorted.push_back(&e);
+        stable_sort(sorted.begin(), sorted.end(),
+                    [](const entry *a, const entry *b) {
+                            return a->name < b->name;
+                    });
+        for (const entry *ep : sorted) {
+                const entry& e = *ep;
+                if (e.name != last_name) {
+                        out << "# HELP " << e.name << " " << e.help << "\n"
+                            << "# TYPE " << e.name << " " << types[e.type]
+                            << "\n";
+                        last_name = e.name;
+                }
+                if (e.type == COUNTER) {
+                        out << e.name << braces(e.labels) << " "
+                            << e.c->value() << "\n";
+                } else if (e.type == GAUGE) {
+                        out << e.name << braces(e.labels) << " "
+                            << e.g->value() << "\n";
+                } else {
+                        for (const char *q : quantiles)
+                                out << e.name << braces(e.labels,
+                                        string("quantile=\"") + q + "\"")
+                                    << " " << e.l->quantile(stod(q)) << "\n";
+                        out << e.name << "_sum" << braces(e.labels) << " "
+                            << e.l->sum_seconds() << "\n"
+                            << e.name << "_count" << braces(e.labels) << " "
+                            << e.l->count() << "\n";
+                }
+        }
+
+        getrusage(RUSAGE_SELF, &ru);
+        out << "# HELP process_cpu_seconds_total Total user and system CPU "
+            << "time spent in seconds.\n"
+            << "# TYPE process_cpu_seconds_total counter\n"
+            << "process_cpu_seconds_total "
+            << ru.ru_utime.tv_sec + ru.ru_utime.tv_usec/1e6 +
+               ru.ru_stime.tv_sec + ru.ru_stime.tv_usec/1e6 << "\n";
+        return out.str();
+}
+
+metrics_server::metrics_server(const string& where,
+                               const metrics_registry& registry)
+        : registry_(registry), fd_(-1), stop_(false)
+{
+        sockaddr_un un;
+        sockaddr_in in;
+        int on = 1;
+
+        if (where.empty())
+                throw runtime_error("metrics_server: nowhere to listen");
+
+        if (where[0] == '/' || where[0] == '.') {
+                if (where.size() >= sizeof un.sun_path)
+                        throw runtime_error("metrics_server: path too long");
+                unix_path_ = where;
+                memset(&un, 0, sizeof un);
+                un.sun_family = AF_UNIX;
+                strcpy(un.sun_path, where.c_str());
+                unlink(where.c_str());
+                fd_ = socket(AF_UNIX, SOCK_STREAM, 0);
+                if (fd_ >= 0 && bind(fd_, (sockaddr *)&un, sizeof un) < 0) {
+                        close(fd_);
+                        fd_ = -1;
+                }
+        } else {
+                // only ever listen on localhost; anything further afield
+                // should go through a real exporter or a proxy
+                memset(&in, 0, sizeof in);
+                in.sin_family = AF_INET;
+                in.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+                in.sin_port = htons(stoul(where));
+                fd_ = socket(AF_INET, SOCK_STREAM, 0);
+                if (fd_ >= 0)
+                        setsockopt(fd_, SOL_SOCKET, SO_REUSEADDR, &on,
+                                   sizeof on);
+                if (fd_ >= 0 && bind(fd_, (sockaddr *)&in, sizeof in) < 0) {
+                        close(fd_);
+                        fd_ = -1;
+                }
+        }
+
+        if (fd_ < 0 || listen(fd_, 4) < 0)
+                throw runtime_error("metrics_server: can't listen on " +
+                                    where + ": " + strerror(errno));
+
+        thread_ = thread(&metrics_server::serve, this);
+}
+
+metrics_server::~metrics_server()
+{
+        stop_ = true;
+        thread_.join();
+        close(fd_);
+        if (!unix_path_.empty())
+                unlink(unix_path_.c_str());
+}
+
+void metrics_server::serve()
+{
+        timeval timeout = { 1, 0 };
+        pollfd pfd;
+        string body, reply;
+        char request[1024];
+        int client;
+
+        pfd.fd = fd_;
+        pfd.events = POLLIN;
+
+        // wake up now and then to notice stop_
+        while (!stop_) {
+                if (poll(&pfd, 1, 200) <= 0)
+                        continue;
+                client = accept(fd_, NULL, NULL);
+                if (client < 0)
+                        continue;
+                setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout,
+                           sizeof timeout);
+
+                // whatever was asked for, the answer is the metrics. We
+                // just need to have read the request before replying.
+                if (read(client, request, sizeof request) >= 0) {
+                        body = registry_.render();
+                        reply = "HTTP/1.0 200 OK\r\n"
+                                "Content-Type: text/plain; version=0.0.4\r\n"
+                                "Content-Length: " + to_string(body.size()) +
+                                "\r\n\r\n" + body;
+                        if (write(client, reply.data(), reply.size()) < 0) {
+                                // client went away; nothing to do
+                        }
+                }
+                close(client);
+        }
+}
@@ -0,0 +1,167 @@
+/**
+ * \file metrics.hpp
+ *
+ * \brief Render loop health metrics, served in the Prometheus text format.
+ *
+ * \detail Metrics are registered once, up front, and the hot path only
+ * ever touches them through relaxed atomic adds and stores. Everything
+ * that needs more work (percentiles, formatting, CPU time) happens when a
+ * scrape comes in, on the metrics_server's own thread.
+ *
+ * Latencies go into a log scale histogram with four buckets per octave of
+ * nanoseconds, so percentiles come out within about 12% without any
+ * locking or sorting on the hot path.
+ *
+ * Text format reference:
+ *     https://prometheus.io/docs/instrumenting/exposition_formats/
+ */
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// a count that only goes up
+class metric_counter {
+public:
+        metric_counter();
+
+        void add(uint64_t n = 1)
+        {
+                value_.fetch_add(n, std::memory_order_relaxed);
+        }
+
+        uint64_t value() const;
+
+private:
+        std::atomic<uint64_t> value_;
+};
+
+// a value that can go up and down, e.g. a queue depth
+class metric_gauge {
+public:
+        metric_gauge();
+
+        void set(int64_t v)
+        {
+                value_.store(v, std::memory_order_relaxed);
+        }
+
+        int64_t value() const;
+
+private:
+        std::atomic<int64_t> value_;
+};
+
+// distribution of durations, reported as a summary with percentiles
+class metric_latency {
+public:
+        metric_latency();
+
+        void observe(std::chrono::nanoseconds d)
+        {
+                uint64_t ns = d.count() < 0 ? 0 : d.count();
+                buckets_[bucket(ns)].fetch_add(1, std::memory_order_relaxed);
+                sum_ns_.fetch_add(ns, std::memory_order_relaxed);
+        }
+
+        // estimate the q'th quantile (0 <= q <= 1) in seconds
+        double quantile(double q) const;
+
+        uint64_t count() const;
+        double sum_seconds() const;
+
+        static constexpr unsigned BUCKETS = 252;
+
+private:
+        static unsigned bucket(uint64_t ns)
+        {
+                unsigned lg;
+
+                if (ns < 4)
+                        return ns;
+                lg = 63 - __builtin_clzll(ns);
+                return 4*(lg - 1) + ((ns >> (lg - 2)) & 3);
+        }
+
+        // smallest value that lands in bucket b
+        static uint64_t bucket_floor(unsigned b);
+
+        std::array<std::atomic<uint64_t>, BUCKETS> buckets_;
+        std::atomic<uint64_t> sum_ns_;
+};
+
+// all the metrics of a process. Registering takes a lock; updating a
+// registered metric never does. Metrics live as long as the registry.
+class metrics_registry {
+public:
+        // the process wide registry
+        static metrics_registry& global();
+
+        // labels are in Prometheus syntax without braces, e.g.
+        // stage="render". Registering the same name and labels twice
+        // returns the same metric.
+        metric_counter& counter(const std::string& name,
+                                const std::string& help,
+                                const std::string& labels = "");
+        metric_gauge& gauge(const std::string& name, const std::string& help,
+                            const std::string& labels = "");
+        metric_latency& latency(const std::string& name,
+                                const std::string& help,
+                                const std::string& labels = "");
+
+        // the whole registry in the Prometheus text format, plus process
+        // CPU time
+        std::string render() const;
+
+private:
+        enum kind { COUNTER, GAUGE, LATENCY };
+
+        struct entry {
+                kind type;
+                std::string name;
+                std::string help;
+                std::string labels;
+                std::unique_ptr<metric_counter> c;
+                std::unique_ptr<metric_gauge> g;
+                std::unique_ptr<metric_latency> l;
+        };
+
+        entry& find_or_add(kind type, const std::string& name,
+                           const std::string& help,
+                           const std::string& labels);
+
+        mutable std::mutex lock_;
+        std::deque<entry> entries_;
+};
+
+// serves a registry over HTTP on a background thread, either on a TCP port
+// on localhost or on a Unix domain socket
+class metrics_server {
+public:
+        // where is a port number, or a path for a Unix socket. Throws
+        // std::runtime_error if it can't listen there.
+        explicit metrics_server(const std::string& where,
+                                const metrics_registry& registry =
+                                metrics_registry::global());
+        ~metrics_server();
+
+        metrics_server(const metrics_server&) = delete;
+        metrics_server& operator=(const metrics_server&) = delete;
+
+private:
+        void serve();
+
+        const metrics_registry& registry_;
+        std::string unix_path_;
+        int fd_;
+        std::atomic<bool> stop_;
+        std::thread thread_;
+};
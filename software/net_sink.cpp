@@ -0,0 +1,253 @@
+/**
+ * \file net_sink.cpp
+ *
+ * \brief E1.31 / Art-Net frame sink implementation.
+ */
+
+#include "net_sink.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <unistd.h>
+
+using namespace std;
+using namespace chrono;
+
+constexpr unsigned net_sink::CHANNELS_PER_UNIVERSE;
+constexpr unsigned net_sink::PIXELS_PER_UNIVERSE;
+constexpr uint16_t net_sink::E131_PORT;
+constexpr uint16_t net_sink::ARTNET_PORT;
+constexpr size_t net_sink::E131_HEADER;
+constexpr size_t net_sink::ARTNET_HEADER;
+constexpr size_t net_sink::MAX_PACKET;
+
+// write a 16 bit value in network (big endian) order
+static void put16(uint8_t *p, uint16_t v)
+{
+        p[0] = v >> 8;
+        p[1] = v & 0xff;
+}
+
+static void put32(uint8_t *p, uint32_t v)
+{
+        put16(p, v >> 16);
+        put16(p + 2, v & 0xffff);
+}
+
+// E1.31 wants a fixed component identifier for the lifetime of a source.
+// Any UUID will do, this one was generated once with uuidgen.
+static const uint8_t e131_cid[16] = {
+        0x5c, 0x1e, 0x0b, 0x3a, 0x8f, 0x27, 0x4d, 0x61,
+        0x9a, 0x42, 0xd3, 0x7e, 0x15, 0x60, 0xc8, 0x2b
+};
+
+static sockaddr_in make_addr(const string& host, uint16_t port)
+{
+        sockaddr_in addr;
+        addrinfo hints, *res;
+        int err;
+
+        memset(&addr, 0, sizeof addr);
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+
+        memset(&hints, 0, sizeof hints);
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_DGRAM;
+        err = getaddrinfo(host.c_str(), NULL, &hints, &res);
+        if (err != 0)
+                throw runtime_error("net_sink: can't resolve " + host + ": "
+                                    + gai_strerror(err));
+        addr.sin_addr = ((sockaddr_in *)res->ai_addr)->sin_addr;
+        freeaddrinfo(res);
+        return addr;
+}
+
+net_sink::net_sink(protocol proto, const string& host, uint16_t port,
+                   uint16_t first_universe)
+        : proto_(proto), sock_(-1),
+          header_len_(proto == E131 ? E131_HEADER : ARTNET_HEADER),
+          sequence_(0), short_sends_(0), last_send_time_(0)
+{
+        const size_t n_pixels = frame::WIDTH*frame::HEIGHT;
+        const size_t n_universes = (n_pixels + PIXELS_PER_UNIVERSE - 1) /
+                PIXELS_PER_UNIVERSE;
+        size_t i, channels;
+        uint16_t universe;
+        int on = 1;
+
+        if (port == 0)
+                port = proto == E131 ? E131_PORT : ARTNET_PORT;
+
+        sock_ = socket(AF_INET, SOCK_DGRAM, 0);
+        if (sock_ < 0)
+                throw runtime_error(string("net_sink: socket: ")
+                                    + strerror(errno));
+        if (host.empty() && proto == ARTNET &&
+            setsockopt(sock_, SOL_SOCKET, SO_BROADCAST, &on, sizeof on) < 0) {
+                close(sock_);
+                throw runtime_error(string("net_sink: SO_BROADCAST: ")
+                                    + strerror(errno));
+        }
+
+        packets_.resize(n_universes);
+        dests_.resize(n_universes);
+        iov_.resize(n_universes);
+        msgs_.resize(n_universes);
+
+        for (i = 0; i < n_universes; ++i) {
+                universe = first_universe + i;
+                channels = 3*min<size_t>(PIXELS_PER_UNIVERSE,
+                                         n_pixels - i*PIXELS_PER_UNIVERSE);
+
+                packets_[i].fill(0);
+                if (proto == E131) {
+                        build_e131_header(packets_[i], universe, channels);
+                } else {
+                        // Art-Net data lengths must be even
+                        channels += channels & 1;
+                        build_artnet_header(packets_[i], universe, channels);
+                }
+
+                if (!host.empty()) {
+                        dests_[i] = make_addr(host, port);
+                } else {
+                        memset(&dests_[i], 0, sizeof dests_[i]);
+                        dests_[i].sin_family = AF_INET;
+                        dests_[i].sin_port = htons(port);
+                        dests_[i].sin_addr.s_addr = proto == E131 ?
+                                htonl(0xefff0000 | universe) :
+                                htonl(INADDR_BROADCAST);
+                }
+
+                iov_[i].iov_base = packets_[i].data();
+                iov_[i].iov_len = header_len_ + channels;
+
+                memset(&msgs_[i], 0, sizeof msgs_[i]);
+                msgs_[i].msg_hdr.msg_name = &dests_[i];
+                msgs_[i].msg_hdr.msg_namelen = sizeof dests_[i];
+                msgs_[i].msg_hdr.msg_iov = &iov_[i];
+                msgs_[i].msg_hdr.msg_iovlen = 1;
+        }
+}
+
+net_sink::~net_sink()
+{
+        if (sock_ >= 0)
+                close(sock_);
+}
+
+void net_sink::build_e131_header(packet_t& p, uint16_t universe,
+                                 size_t channels)
+{
+        const size_t len = E131_HEADER + channels;
+        static const char acn_id[12] = "ASC-E1.17";
+        static const char source[] = "musicVisualization";
+
+        // root layer
+        put16(&p[0], 0x0010);                   // preamble size
+        put16(&p[2], 0x0000);                   // postamble size
+        memcpy(&p[4], acn_id, sizeof acn_id);
+        put16(&p[16], 0x7000 | (len - 16));     // flags and length
+        put32(&p[18], 0x00000004);              // VECTOR_ROOT_E131_DATA
+        memcpy(&p[22], e131_cid, sizeof e131_cid);
+
+        // framing layer
+        put16(&p[38], 0x7000 | (len - 38));
+        put32(&p[40], 0x00000002);              // VECTOR_E131_DATA_PACKET
+        memcpy(&p[44], source, sizeof source);  // 64 byte source name
+        p[108] = 100;                           // default priority
+        put16(&p[109], 0);                      // no synchronization
+        p[111] = 0;                             // sequence, set per frame
+        p[112] = 0;                             // options
+        put16(&p[113], universe);
+
+        // DMP layer
+        put16(&p[115], 0x7000 | (len - 115));
+        p[117] = 0x02;                          // VECTOR_DMP_SET_PROPERTY
+        p[118] = 0xa1;                          // address and data type
+        put16(&p[119], 0);                      // first property address
+        put16(&p[121], 1);                      // address increment
+        put16(&p[123], channels + 1);           // values incl. start code
+        p[125] = 0;                             // DMX start code
+}
+
+void net_sink::build_artnet_header(packet_t& p, uint16_t universe,
+                                   size_t channels)
+{
+        static const char id[8] = "Art-Net";
+
+        memcpy(&p[0], id, sizeof id);
+        p[8] = 0x00;                            // OpDmx, little endian
+        p[9] = 0x50;
+        put16(&p[10], 14);                      // protocol version
+        p[12] = 0;                              // sequence, set per frame
+        p[13] = 0;                              // physical port
+        p[14] = universe & 0xff;                // SubUni
+        p[15] = (universe >> 8) & 0x7f;         // Net
+        put16(&p[16], channels);
+}
+
+void net_sink::write(const frame& f)
+{
+        const size_t n_pixels = frame::WIDTH*frame::HEIGHT;
+        size_t x, y, i, n, sent;
+        uint8_t *data;
+        int ret;
+
+        // Art-Net reserves sequence 0 for "sequencing disabled"
+        if (++sequence_ == 0 && proto_ == ARTNET)
+                sequence_ = 1;
+
+        for (i = 0; i < packets_.size(); ++i)
+                packets_[i][proto_ == E131 ? 111 : 12] = sequence_;
+
+        // same pixel order as frame::write: row by row, column 0 first
+        for (n = 0; n < n_pixels; ++n) {
+                x = n % frame::WIDTH;
+                y = n / frame::WIDTH;
+                data = &packets_[n / PIXELS_PER_UNIVERSE][header_len_] +
+                        3*(n % PIXELS_PER_UNIVERSE);
+                data[0] = f.at(x, y).red();
+                data[1] = f.at(x, y).green();
+                data[2] = f.at(x, y).blue();
+        }
+
+        auto start = steady_clock::now();
+        for (sent = 0; sent < msgs_.size(); sent += ret) {
+                ret = sendmmsg(sock_, &msgs_[sent], msgs_.size() - sent, 0);
+                if (ret < 0 && errno == EINTR) {
+                        ret = 0;
+                        continue;
+                }
+                if (ret <= 0)
+                        break;
+        }
+        last_send_time_ = duration_cast<nanoseconds>(steady_clock::now() -
+                                                      start);
+
+        // a dropped frame on a UDP wall is no reason to stop the song, so
+        // just keep count
+        if (sent < msgs_.size())
+                ++short_sends_;
+}
+
+size_t net_sink::universe_count() const
+{
+        return packets_.size();
+}
+
+nanoseconds net_sink::last_send_time() const
+{
+        return last_send_time_;
+}
+
+size_t net_sink::short_sends() const
+{
+        return short_sends_;
+}
@@ -0,0 +1,91 @@
+/**
+ * \file net_sink.hpp
+ *
+ * \brief Frame sink that drives pixel walls over Ethernet using E1.31
+ * (streaming ACN) or Art-Net.
+ *
+ * \detail Pixels are sent in the same order as frame::write sends them over
+ * SPI (row by row, column 0 first), three channels (R, G, B) per pixel and
+ * 170 pixels per universe, so a 32x32 frame takes 7 universes. Every
+ * universe of a frame goes out in one sendmmsg call. Packets are built in
+ * buffers allocated once in the constructor; write only patches the
+ * sequence number and pixel data.
+ *
+ * Protocol references:
+ *     ANSI E1.31-2016 (Streaming ACN):
+ *         https://tsp.esta.org/tsp/documents/docs/ANSI_E1-31-2016.pdf
+ *     Art-Net 4:
+ *         https://art-net.org.uk/resources/art-net-specification/
+ */
+
+#pragma once
+
+#include "frame.hpp"
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+class net_sink : public frame_sink {
+public:
+        enum protocol { E131, ARTNET };
+
+        // send frames to host. If host is empty, E1.31 frames are multicast
+        // to each universe's group (239.255.u_hi.u_lo) and Art-Net frames
+        // are broadcast. A port of 0 means the protocol's standard port.
+        // Throws std::runtime_error if the socket can't be set up.
+        net_sink(protocol proto, const std::string& host = "",
+                 uint16_t port = 0, uint16_t first_universe = 1);
+        ~net_sink();
+
+        net_sink(const net_sink&) = delete;
+        net_sink& operator=(const net_sink&) = delete;
+
+        void write(const frame& f);
+
+        // number of universes (and UDP packets) per frame
+        size_t universe_count() const;
+
+        // wall clock time spent in the most recent sendmmsg batch
+        std::chrono::nanoseconds last_send_time() const;
+
+        // number of frames where not every packet made it into the kernel
+        size_t short_sends() const;
+
+        static constexpr unsigned CHANNELS_PER_UNIVERSE = 510;
+        static constexpr unsigned PIXELS_PER_UNIVERSE =
+                CHANNELS_PER_UNIVERSE / 3;
+        static constexpr uint16_t E131_PORT = 5568;
+        static constexpr uint16_t ARTNET_PORT = 6454;
+
+private:
+        static constexpr size_t E131_HEADER = 126;
+        static constexpr size_t ARTNET_HEADER = 18;
+        static constexpr size_t MAX_PACKET = E131_HEADER + 512;
+
+        using packet_t = std::array<uint8_t, MAX_PACKET>;
+
+        // fill in the parts of each packet that never change
+        void build_e131_header(packet_t& p, uint16_t universe,
+                               size_t channels);
+        void build_artnet_header(packet_t& p, uint16_t universe,
+                                 size_t channels);
+
+        protocol proto_;
+        int sock_;
+        size_t header_len_;
+        uint8_t sequence_;
+        size_t short_sends_;
+        std::chrono::nanoseconds last_send_time_;
+
+        std::vector<packet_t> packets_;
+        std::vector<sockaddr_in> dests_;
+        std::vector<iovec> iov_;
+        std::vector<mmsghdr> msgs_;
+};
@@ -0,0 +1,114 @@
+/**
+ * \file net_sink_test.cpp
+ *
+ * \brief Tests for net_sink. A UDP socket on localhost stands in for the
+ * pixel controllers; we check the packets it receives and time the sends.
+ */
+
+#include "net_sink.hpp"
+
+#include <cassert>
+#include <cstring>
+#include <iostream>
+
+#include <arpa/inet.h>
+#include <unistd.h>
+
+using namespace std;
+using namespace chrono;
+
+static int listen_udp(uint16_t& port)
+{
+        sockaddr_in addr;
+        socklen_t len = sizeof addr;
+        int sock, ret;
+
+        sock = socket(AF_INET, SOCK_DGRAM, 0);
+        assert(sock >= 0);
+        memset(&addr, 0, sizeof addr);
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = 0;
+        ret = bind(sock, (sockaddr *)&addr, sizeof addr);
+        assert(ret == 0);
+        ret = getsockname(sock, (sockaddr *)&addr, &len);
+        assert(ret == 0);
+        port = ntohs(addr.sin_port);
+        return sock;
+}
+
+static void check(net_sink::protocol proto)
+{
+        const size_t header = proto == net_sink::E131 ? 126 : 18;
+        const size_t n_pixels = frame::WIDTH*frame::HEIGHT;
+        uint8_t buf[1024];
+        size_t i, n, p;
+        uint16_t port, universe;
+        ssize_t len;
+        int sock;
+        frame f;
+
+        sock = listen_udp(port);
+        net_sink sink(proto, "127.0.0.1", port, 3);
+        assert(sink.universe_count() == 7);
+
+        for (i = 0; i < n_pixels; ++i)
+                f[i] = pixel(i & 0xff, i >> 8, 0x5a);
+        sink.write(f);
+
+        for (n = 0, p = 0; n < sink.universe_count(); ++n) {
+                len = recv(sock, buf, sizeof buf, 0);
+                assert(len > ssize_t(header));
+                if (proto == net_sink::E131) {
+                        assert(memcmp(buf + 4, "ASC-E1.17", 9) == 0);
+                        assert(((buf[16] << 8 | buf[17]) & 0xfff) == len - 16);
+                        universe = buf[113] << 8 | buf[114];
+                        assert(buf[111] == 1);
+                } else {
+                        assert(memcmp(buf, "Art-Net", 8) == 0);
+                        assert(buf[8] == 0x00 && buf[9] == 0x50);
+                        universe = buf[15] << 8 | buf[14];
+                        assert(buf[12] == 1);
+                }
+                assert(universe == 3 + n);
+
+                // pixels arrive row by row, column 0 first
+                for (i = header; i + 2 < size_t(len) && p < n_pixels;
+                     i += 3, ++p) {
+                        const pixel& px = f.at(p % frame::WIDTH,
+                                               p / frame::WIDTH);
+                        assert(buf[i] == px.red());
+                        assert(buf[i+1] == px.green());
+                        assert(buf[i+2] == px.blue());
+                }
+        }
+        assert(p == n_pixels);
+        assert(sink.short_sends() == 0);
+
+        // time a batch of frames. Drain the listener as we go so the
+        // socket buffer never fills up.
+        const size_t frames = 1000;
+        nanoseconds total(0), worst(0);
+        for (i = 0; i < frames; ++i) {
+                sink.write(f);
+                total += sink.last_send_time();
+                worst = max(worst, sink.last_send_time());
+                for (n = 0; n < sink.universe_count(); ++n)
+                        recv(sock, buf, sizeof buf, 0);
+        }
+
+        cout << (proto == net_sink::E131 ? "e1.31" : "art-net")
+             << ": mean send time "
+             << duration_cast<microseconds>(total).count()/double(frames)
+             << " us, worst " << duration_cast<microseconds>(worst).count()
+             << " us per frame" << endl;
+
+        close(sock);
+}
+
+int main(void)
+{
+        check(net_sink::E131);
+        check(net_sink::ARTNET);
+        cout << "test passed" << endl;
+}
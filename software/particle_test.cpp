@@ -0,0 +1,80 @@
+/**
+ * \file particle_test.cpp
+ *
+ * \brief Tests for particle_pool and particle_generator: the pool fills
+ * up, moves and retires particles, and draws them additively, and the
+ * generator renders a song and shrinks its particle limit to fit a smaller
+ * budget. Reads AmpUp.wav, so run it from the software directory.
+ */
+
+#include "particles.hpp"
+
+#include <cassert>
+#include <cmath>
+#include <iostream>
+
+using namespace std;
+
+int main(void)
+{
+        particle_pool pool;
+        frame f;
+        size_t i, frames = 0, generous, stingy;
+
+        // full is full
+        for (i = 0; i < particle_pool::CAPACITY; ++i)
+                assert(pool.spawn(16, 16, 0, 0, 1, pixel(1, 1, 1)));
+        assert(!pool.spawn(16, 16, 0, 0, 1, pixel(1, 1, 1)));
+        assert(pool.size() == particle_pool::CAPACITY);
+        pool.clear();
+        assert(pool.size() == 0);
+
+        // one falling from (10.5, 20.5) at 4 pixels/s right, one that dies
+        // after half a second, and one that flies off the right edge
+        assert(pool.spawn(10.5, 20.5, 4, 0, 10, pixel(100, 0, 0)));
+        assert(pool.spawn(3, 3, 0, 0, 0.5, pixel(0, 100, 0)));
+        assert(pool.spawn(30, 3, 40, 0, 10, pixel(0, 0, 100)));
+        assert(!pool.spawn(1, 1, 0, 0, 0, pixel()));
+        pool.step(0.25, -8);
+        assert(pool.size() == 3);
+        pool.step(0.25, -8);
+        assert(pool.size() == 1);
+
+        // v = -2, -4; x = 10.5 + 2, y = 20.5 - 0.5 - 1 after the two steps
+        f.fill(pixel(0, 0, 0));
+        pool.draw(f);
+        assert(f.at(12, frame::HEIGHT - 1 - 19).red() ==
+               uint8_t(100*(1 - 0.5f/10)));
+        f.at(12, frame::HEIGHT - 1 - 19) = pixel();
+        for (i = 0; i < f.size(); ++i)
+                assert(f[i].red() == 0 && f[i].green() == 0 &&
+                       f[i].blue() == 0);
+
+        // overlapping particles add, on top of what's there, and saturate
+        pool.clear();
+        assert(pool.spawn(0.5, 0.5, 0, 0, 1, pixel(100, 200, 0)));
+        assert(pool.spawn(0.5, 0.5, 0, 0, 1, pixel(100, 200, 0)));
+        f.fill(pixel(0, 0, 7));
+        pool.draw(f);
+        assert(f.at(0, frame::HEIGHT - 1).red() == 200);
+        assert(f.at(0, frame::HEIGHT - 1).green() == 255);
+        assert(f.at(0, frame::HEIGHT - 1).blue() == 7);
+
+        // the generator renders, and a smaller budget means fewer particles
+        wav_reader song("AmpUp.wav");
+        particle_generator gen;
+        gen.render_song(song, [&](const frame&) { ++frames; });
+        assert(frames > 0);
+        assert(gen.limit() >= 64);
+        assert(gen.limit() <= particle_pool::CAPACITY);
+        generous = gen.limit();
+
+        assert(gen.set_parameter("budget", 0.0001));
+        assert(!gen.set_parameter("budget", 2));
+        gen.render_song(song, [&](const frame&) {});
+        stingy = gen.limit();
+        assert(stingy < generous || generous == 64);
+
+        cout << "test passed" << endl;
+        return 0;
+}
@@ -0,0 +1,256 @@
+/**
+ * \file particles.cpp
+ *
+ * \brief Particle pool and generator.
+ */
+
+#include "particles.hpp"
+#include "metrics.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+using namespace std;
+using namespace chrono;
+
+// a particle this far off the panel isn't coming back
+static const float MARGIN = 8;
+
+particle_pool::particle_pool()
+        : count_(0)
+{}
+
+void particle_pool::clear()
+{
+        count_ = 0;
+}
+
+size_t particle_pool::size() const
+{
+        return count_;
+}
+
+bool particle_pool::spawn(float x, float y, float vx, float vy, float life,
+                          const pixel& color)
+{
+        if (count_ == CAPACITY || life <= 0)
+                return false;
+        x_[count_] = x;
+        y_[count_] = y;
+        vx_[count_] = vx;
+        vy_[count_] = vy;
+        age_[count_] = 0;
+        life_[count_] = life;
+        red_[count_] = color.red();
+        green_[count_] = color.green();
+        blue_[count_] = color.blue();
+        ++count_;
+        return true;
+}
+
+void particle_pool::step(float dt, float gravity)
+{
+        const size_t n = count_;
+        size_t i, live = 0;
+
+        for (i = 0; i < n; ++i)
+                vy_[i] += gravity*dt;
+        for (i = 0; i < n; ++i) {
+                x_[i] += vx_[i]*dt;
+                y_[i] += vy_[i]*dt;
+                age_[i] += dt;
+        }
+
+        // keep the survivors at the front, in order
+        for (i = 0; i < n; ++i) {
+                if (age_[i] >= life_[i] || y_[i] < -MARGIN ||
+                    x_[i] < -MARGIN || x_[i] > frame::WIDTH + MARGIN)
+                        continue;
+                if (i != live) {
+                        x_[live] = x_[i];
+                        y_[live] = y_[i];
+                        vx_[live] = vx_[i];
+                        vy_[live] = vy_[i];
+                        age_[live] = age_[i];
+                        life_[live] = life_[i];
+                        red_[live] = red_[i];
+                        green_[live] = green_[i];
+                        blue_[live] = blue_[i];
+                }
+                ++live;
+        }
+        count_ = live;
+}
+
+void particle_pool::draw(frame& f)
+{
+        const size_t n = count_;
+        size_t i, col, row;
+        float *p;
+        int x, y;
+
+        for (i = 0; i < n; ++i)
+                fade_[i] = 1 - age_[i]/life_[i];
+
+        memset(light_, 0, sizeof(light_));
+        for (i = 0; i < n; ++i) {
+                x = floor(x_[i]);
+                y = floor(y_[i]);
+                if (x < 0 || x >= int(frame::WIDTH) || y < 0 ||
+                    y >= int(frame::HEIGHT))
+                        continue;
+                p = light_[x][frame::HEIGHT - 1 - y];
+                p[0] += red_[i]*fade_[i];
+                p[1] += green_[i]*fade_[i];
+                p[2] += blue_[i]*fade_[i];
+        }
+
+        for (col = 0; col < frame::WIDTH; ++col) {
+                for (row = 0; row < frame::HEIGHT; ++row) {
+                        p = light_[col][row];
+                        pixel& out = f.at(col, row);
+                        out = pixel(min(255.0f, out.red() + p[0]),
+                                    min(255.0f, out.green() + p[1]),
+                                    min(255.0f, out.blue() + p[2]));
+                }
+        }
+}
+
+particle_generator::particle_generator()
+        : frame_rate_(30), budget_(0.25), gravity_(-30), max_(0),
+          limit_(particle_pool::CAPACITY), cost_(0), hue_(0),
+          fountain_carry_(0)
+{}
+
+bool particle_generator::set_parameter(const string& name, float value)
+{
+        if (name == "frame_rate" && value >= 1)
+                frame_rate_ = value;
+        else if (name == "budget" && value > 0 && value <= 1)
+                budget_ = value;
+        else if (name == "gravity")
+                gravity_ = value;
+        else
+                return frame_generator::set_parameter(name, value);
+        return true;
+}
+
+size_t particle_generator::limit() const
+{
+        return limit_;
+}
+
+void particle_generator::prepare(const wav_reader& song)
+{
+        max_ = song.max_sample();
+        reset_bands();
+        pool_.clear();
+        beats_.reset();
+        fountain_carry_ = 0;
+}
+
+pixel particle_generator::hue(float h)
+{
+        const float f = 2*M_PI*h, phase = 2*M_PI/3;
+
+        return pixel(127*(1 + cos(f)), 127*(1 + cos(f - phase)),
+                     127*(1 + cos(f - 2*phase)));
+}
+
+void particle_generator::spawn(float x, float y, float vx, float vy,
+                               float life, const pixel& color)
+{
+        if (pool_.size() < limit_)
+                pool_.spawn(x, y, vx, vy, life, color);
+}
+
+bool particle_generator::make_next_frame(const wav_reader& song,
+                                         microseconds start, frame& frame)
+{
+        static metric_gauge& live = metrics_registry::global().gauge(
+                "musicvis_particles", "Live particles.");
+        static metric_gauge& allowed = metrics_registry::global().gauge(
+                "musicvis_particle_limit",
+                "Particles that fit in the frame budget.");
+        const microseconds interval = get_frame_interval();
+        const float dt = duration<float>(interval).count();
+        uniform_real_distribution<float> unit(0, 1);
+        steady_clock::time_point began;
+        band_levels bands;
+        float bass = 0, level = 0, angle, speed, share, per_particle;
+        size_t i, burst;
+
+        if (!next_bands(song, start, bands))
+                return false;
+        for (i = 0; i < BANDS; ++i)
+                level += bands[i]/BANDS;
+        for (i = 0; i < 4; ++i)
+                bass += bands[i]/4;
+
+        began = steady_clock::now();
+
+        // sparks burst out from somewhere in the top two thirds on a beat
+        if (beats_.update(bass, dt)) {
+                const float cx = frame::WIDTH*unit(random_);
+                const float cy = frame::HEIGHT*(1 + 2*unit(random_))/3;
+                burst = 48 + 160*level;
+                hue_ = fmod(hue_ + 0.17f, 1.0f);
+                for (i = 0; i < burst; ++i) {
+                        angle = 2*M_PI*unit(random_);
+                        speed = 6 + 14*unit(random_);
+                        spawn(cx, cy, speed*cos(angle), speed*sin(angle),
+                              0.3 + 0.5*unit(random_),
+                              hue(hue_ + 0.1f*unit(random_)));
+                }
+        }
+
+        // the fountain at the bottom middle, as strong as the bass
+        fountain_carry_ += 800*bass*bass*dt;
+        for (; fountain_carry_ >= 1; fountain_carry_ -= 1)
+                spawn(frame::WIDTH/2 + 2*(unit(random_) - 0.5f), 0,
+                      8*(unit(random_) - 0.5f),
+                      15 + 30*bass*(0.8f + 0.4f*unit(random_)),
+                      1 + 0.5*unit(random_),
+                      pixel(255, 64 + 128*bass, 16));
+
+        pool_.step(dt, gravity_);
+        frame.fill(pixel(0, 0, 0));
+        pool_.draw(frame);
+
+        // fit the particles to our share of the interval, less when
+        // rendering is already falling behind
+        per_particle = duration<float>(steady_clock::now() - began).count()/
+                max<size_t>(pool_.size(), 64);
+        cost_ = cost_ == 0 ? per_particle : 0.9f*cost_ + 0.1f*per_particle;
+        // a coarse clock can time a whole frame at 0; a nanosecond a
+        // particle keeps the limit finite
+        cost_ = max(cost_, 1e-9f);
+        share = budget_*dt/(quality().band_step << quality().fft_shift);
+        limit_ = max<float>(64, min<float>(particle_pool::CAPACITY,
+                                           share/cost_));
+        live.set(pool_.size());
+        allowed.set(limit_);
+        return true;
+}
+
+unsigned particle_generator::get_frame_rate() const
+{
+        return frame_rate_;
+}
+
+bool particle_generator::compute_bands(const wav_reader& song,
+                                       microseconds start,
+                                       band_levels& bands)
+{
+        spectrum spec;
+
+        if (!make_spectrum(song, start, spec))
+                return false;
+        if (spec.empty()) {
+                bands.fill(0);
+                return true;
+        }
+        bin_spectrum(spec, 0, spec.size()/2, max_, bands);
+        return true;
+}
@@ -0,0 +1,120 @@
+/**
+ * \file particles.hpp
+ *
+ * \brief Audio reactive particle effects: sparks that burst on beats and
+ * a fountain driven by the bass.
+ *
+ * \detail particle_pool keeps a fixed number of particles as a structure
+ * of arrays, so moving, aging and fading them are straight loops over
+ * floats the compiler vectorizes, and nothing is allocated once it's
+ * constructed. Dead particles are removed by compacting the arrays.
+ * Particles are drawn additively, so where they overlap they add up
+ * (saturating at full brightness), and fade out over their lives.
+ *
+ * particle_generator times its own particle work each frame and caps the
+ * number of live particles at what fits its share ("budget") of the frame
+ * interval. When play_song drops the quality level because rendering is
+ * behind, the share shrinks with it.
+ */
+
+#pragma once
+
+#include "beat.hpp"
+#include "frame.hpp"
+
+#include <cstddef>
+#include <random>
+
+class particle_pool {
+public:
+        static const size_t CAPACITY = 2048;
+
+        particle_pool();
+
+        // remove every particle
+        void clear();
+
+        size_t size() const;
+
+        // add a particle at (x, y) pixels from the bottom left of the
+        // panel, moving at (vx, vy) pixels per second, that lives life
+        // seconds. Returns false if the pool is full.
+        bool spawn(float x, float y, float vx, float vy, float life,
+                   const pixel& color);
+
+        // move everything on dt seconds, accelerating by gravity pixels
+        // per second squared (negative is down), and remove particles that
+        // are too old or have left the panel for good
+        void step(float dt, float gravity);
+
+        // add every particle into f, faded by age
+        void draw(frame& f);
+
+private:
+        size_t count_;
+
+        alignas(16) float x_[CAPACITY];
+        alignas(16) float y_[CAPACITY];
+        alignas(16) float vx_[CAPACITY];
+        alignas(16) float vy_[CAPACITY];
+        alignas(16) float age_[CAPACITY];
+        alignas(16) float life_[CAPACITY];
+        alignas(16) float red_[CAPACITY];
+        alignas(16) float green_[CAPACITY];
+        alignas(16) float blue_[CAPACITY];
+
+        // draw's scratch: each particle's brightness, and the sum of
+        // everything on each pixel
+        alignas(16) float fade_[CAPACITY];
+        alignas(16) float light_[frame::WIDTH][frame::HEIGHT][3];
+};
+
+class particle_generator : public frame_generator {
+public:
+        particle_generator();
+        ~particle_generator() = default;
+
+        // "frame_rate", "budget" (the fraction of the frame interval
+        // particles may take) and "gravity" (pixels per second squared)
+        bool set_parameter(const std::string& name, float value);
+
+        // the most particles allowed at once right now
+        size_t limit() const;
+
+protected:
+        void prepare(const wav_reader& song);
+
+        bool make_next_frame(const wav_reader& song,
+                             std::chrono::microseconds start,
+                             frame& frame);
+
+        unsigned get_frame_rate() const;
+
+        bool compute_bands(const wav_reader& song,
+                           std::chrono::microseconds start,
+                           band_levels& bands);
+
+private:
+        // add a particle if there's room under limit_
+        void spawn(float x, float y, float vx, float vy, float life,
+                   const pixel& color);
+
+        // a point on the color wheel
+        static pixel hue(float h);
+
+        unsigned frame_rate_;
+        float budget_;
+        float gravity_;
+        float max_;
+
+        particle_pool pool_;
+        size_t limit_;
+
+        // smoothed seconds of particle work per live particle
+        float cost_;
+
+        beat_detector beats_;
+        float hue_;
+        float fountain_carry_;  // fraction of a particle owed
+        std::minstd_rand random_;
+};
@@ -0,0 +1,113 @@
+/**
+ * \file perf_counters.cpp
+ *
+ * \brief Hardware performance counter implementation.
+ */
+
+#include "perf_counters.hpp"
+
+#include <cstring>
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+using namespace std;
+
+static int open_counter(uint32_t type, uint64_t config)
+{
+        perf_event_attr attr;
+
+        memset(&attr, 0, sizeof attr);
+        attr.size = sizeof attr;
+        attr.type = type;
+        attr.config = config;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+                PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+        // this thread, any cpu, no group
+        return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+perf_counters::perf_counters()
+{
+        fds_[CYCLES] = open_counter(PERF_TYPE_HARDWARE,
+                                    PERF_COUNT_HW_CPU_CYCLES);
+        fds_[INSTRUCTIONS] = open_counter(PERF_TYPE_HARDWARE,
+                                          PERF_COUNT_HW_INSTRUCTIONS);
+        fds_[L1D_MISSES] = open_counter(PERF_TYPE_HW_CACHE,
+                PERF_COUNT_HW_CACHE_L1D |
+                PERF_COUNT_HW_CACHE_OP_READ << 8 |
+                PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        fds_[LLC_MISSES] = open_counter(PERF_TYPE_HARDWARE,
+                                        PERF_COUNT_HW_CACHE_MISSES);
+        fds_[BRANCH_MISSES] = open_counter(PERF_TYPE_HARDWARE,
+                                           PERF_COUNT_HW_BRANCH_MISSES);
+}
+
+perf_counters::~perf_counters()
+{
+        for (int fd : fds_)
+                if (fd >= 0)
+                        close(fd);
+}
+
+bool perf_counters::any_available() const
+{
+        for (int fd : fds_)
+                if (fd >= 0)
+                        return true;
+        return false;
+}
+
+bool perf_counters::available(event e) const
+{
+        return fds_[e] >= 0;
+}
+
+void perf_counters::start()
+{
+        for (int fd : fds_) {
+                if (fd < 0)
+                        continue;
+                ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+                ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+}
+
+perf_counters::reading perf_counters::stop()
+{
+        reading r;
+        uint64_t buf[3];        // value, time enabled, time running
+        int e;
+
+        for (e = 0; e < EVENTS; ++e)
+                if (fds_[e] >= 0)
+                        ioctl(fds_[e], PERF_EVENT_IOC_DISABLE, 0);
+
+        for (e = 0; e < EVENTS; ++e) {
+                r.value[e] = 0;
+                r.valid[e] = false;
+                if (fds_[e] < 0 ||
+                    read(fds_[e], buf, sizeof buf) != sizeof buf ||
+                    buf[2] == 0)
+                        continue;
+                r.value[e] = buf[2] == buf[1] ? buf[0] :
+                        uint64_t(double(buf[0])*buf[1]/buf[2]);
+                r.valid[e] = true;
+        }
+        return r;
+}
+
+const char *perf_counters::name(event e)
+{
+        static const char *const names[EVENTS] = {
+                "cycles", "instructions", "L1d misses", "LLC misses",
+                "branch misses"
+        };
+        return names[e];
+}
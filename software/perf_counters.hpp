@@ -0,0 +1,48 @@
+/**
+ * \file perf_counters.hpp
+ *
+ * \brief Hardware performance counters (cycles, instructions, cache and
+ * branch misses) for the calling thread, via perf_event_open.
+ *
+ * \detail Each counter is opened on its own, so one the CPU or kernel
+ * doesn't support (or perf_event_paranoid forbids) just reads as
+ * unavailable and the rest still work. Only user space is counted, which
+ * is allowed at the default paranoia level. If the kernel had to multiplex
+ * counters, values are scaled up to the full measured time.
+ */
+
+#pragma once
+
+#include <cstdint>
+
+class perf_counters {
+public:
+        enum event { CYCLES, INSTRUCTIONS, L1D_MISSES, LLC_MISSES,
+                     BRANCH_MISSES, EVENTS };
+
+        struct reading {
+                uint64_t value[EVENTS];
+                bool valid[EVENTS];
+        };
+
+        perf_counters();
+        ~perf_counters();
+
+        perf_counters(const perf_counters&) = delete;
+        perf_counters& operator=(const perf_counters&) = delete;
+
+        // true if at least one counter could be opened
+        bool any_available() const;
+        bool available(event e) const;
+
+        // zero and start every counter
+        void start();
+
+        // stop counting and return what was counted since start()
+        reading stop();
+
+        static const char *name(event e);
+
+private:
+        int fds_[EVENTS];
+};
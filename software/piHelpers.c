@@ -139,6 +139,11 @@ void sleepMillis(int millis)
   sleepMicros(1000 * millis);     // sleep 1000 microseconds for each millisecond
 }
 
+volatile unsigned int *sysTimer()
+{
+  return sys_timer;
+}
+
 void spiInit(int freq, int settings)
 {
   int  mem_fd;
@@ -71,6 +71,12 @@ void sleepMicros(int micros);
 
 void sleepMillis(int millis);
 
+/*
+The system timer registers (the free running 1MHz counter is index 1), or
+NULL if pTimerInit hasn't mapped them.
+*/
+volatile unsigned int *sysTimer();
+
 void spiInit(int freq, int settings);
 
 char spiSendReceive(char send);
@@ -87,6 +93,7 @@ static inline void digitalWrite(int pin, int val){(void)pin;(void)val;}
 static inline int digitalRead(int pin){(void)pin;return 0;}
 static inline void sleepMicros(int micros){(void)micros;}
 static inline void sleepMillis(int millis){(void)millis;}
+static inline volatile unsigned int *sysTimer(){return NULL;}
 static inline void spiInit(int freq, int settings){(void)freq;(void)settings;}
 static inline char spiSendReceive(char send){(void)send;return 0;}
 static inline double getVoltage(){return 0;}
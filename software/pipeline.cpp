@@ -0,0 +1,32 @@
+/**
+ * \file pipeline.cpp
+ *
+ * \brief The parts of pipelines that aren't templates.
+ */
+
+#include "pipeline.hpp"
+
+using namespace std;
+using namespace chrono;
+
+frame_context::frame_context(frame_generator& gen, const wav_reader& song,
+                             microseconds start, microseconds interval)
+        : song(song), start(start), interval(interval), gen_(gen)
+{}
+
+bool frame_context::make_spectrum(spectrum& spec) const
+{
+        return gen_.make_spectrum(song, start, spec);
+}
+
+void frame_context::bin_spectrum(const spectrum& spec, size_t first,
+                                 size_t span,
+                                 frame_generator::band_levels& bands) const
+{
+        gen_.bin_spectrum(spec, first, span, song.max_sample(), bands);
+}
+
+const quality_level& frame_context::quality() const
+{
+        return gen_.quality();
+}
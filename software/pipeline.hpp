@@ -0,0 +1,306 @@
+/**
+ * \file pipeline.hpp
+ *
+ * \brief Build a frame_generator out of stages at compile time, so the
+ * whole spectrum -> bands -> picture -> effects chain is one function the
+ * compiler can inline, instead of a std::function call per stage.
+ *
+ * \detail A stage is a class with an input_type, an output_type and
+ *
+ *     bool operator()(frame_context& ctx, const input_type& in,
+ *                     output_type& out);
+ *
+ * which returns false to end the song. The first stage takes
+ * pipeline_start (nothing) and the last one must output a frame. Stages
+ * run in order, each getting the one before's output:
+ *
+ *     auto gen = make_pipeline(15, spectrum_stage(), band_stage(0.5),
+ *                              bars_stage(), afterglow_stage(0.1));
+ *
+ * Outputs live in the generator between frames, so a spectrum's buffer is
+ * reused rather than reallocated. Every stage that outputs a frame writes
+ * straight into the frame being made, which still holds the last frame's
+ * pixels, so frame -> frame stages (effects) get the same frame as in and
+ * out and work on out in place.
+ *
+ * Stages derive from pipeline_stage, whose prepare is called for each
+ * song. lambda_generator is still the quick way to try an idea out;
+ * pipelines are for generators that stick around.
+ */
+
+#pragma once
+
+#include "afterglow.hpp"
+#include "frame.hpp"
+
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <memory>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+// what a stage can see of the frame being made, and the generator's
+// analysis helpers
+class frame_context {
+public:
+        frame_context(frame_generator& gen, const wav_reader& song,
+                      std::chrono::microseconds start,
+                      std::chrono::microseconds interval);
+
+        const wav_reader& song;
+        const std::chrono::microseconds start;
+        const std::chrono::microseconds interval;
+
+        // frame_generator::make_spectrum for this frame's slice
+        bool make_spectrum(spectrum& spec) const;
+
+        // frame_generator::bin_spectrum against the song's loudest sample
+        void bin_spectrum(const spectrum& spec, size_t first, size_t span,
+                          frame_generator::band_levels& bands) const;
+
+        const quality_level& quality() const;
+
+private:
+        frame_generator& gen_;
+};
+
+// input of the first stage
+struct pipeline_start {};
+
+// base for stages: a per song hook that does nothing
+struct pipeline_stage {
+        void prepare(frame_context&) {}
+};
+
+// the spectrum of this frame's slice of the song. Empty if it was silent.
+struct spectrum_stage : pipeline_stage {
+        typedef pipeline_start input_type;
+        typedef spectrum output_type;
+
+        bool operator()(frame_context& ctx, const pipeline_start&,
+                        spectrum& out)
+        {
+                return ctx.make_spectrum(out);
+        }
+};
+
+// log spaced band levels from the bottom fraction of the spectrum,
+// leaving out the first skip bins of a full quality FFT
+struct band_stage : pipeline_stage {
+        typedef spectrum input_type;
+        typedef frame_generator::band_levels output_type;
+
+        explicit band_stage(float fraction = 0.5, size_t skip = 0)
+                : fraction(fraction), skip(skip)
+        {}
+
+        bool operator()(frame_context& ctx, const spectrum& in,
+                        output_type& out)
+        {
+                const size_t first = skip >> ctx.quality().fft_shift;
+
+                if (in.empty()) {
+                        out.fill(0);
+                        return true;
+                }
+                ctx.bin_spectrum(in, first, in.size()*fraction - first, out);
+                return true;
+        }
+
+        float fraction;
+        size_t skip;
+};
+
+// a bar per band, bottom up, in a color that slowly cycles the rainbow
+struct bars_stage : pipeline_stage {
+        typedef frame_generator::band_levels input_type;
+        typedef frame output_type;
+
+        bars_stage() : hue(0) {}
+
+        void prepare(frame_context&)
+        {
+                hue = 0;
+        }
+
+        bool operator()(frame_context&, const input_type& in, frame& out)
+        {
+                const float phase = 2*M_PI/3, f = 2*M_PI*hue;
+                const pixel p(127*(1 + std::cos(f)),
+                              127*(1 + std::cos(f - phase)),
+                              127*(1 + std::cos(f - 2*phase)));
+                size_t row, col;
+
+                static_assert(frame_generator::BANDS == frame::WIDTH,
+                              "one band per column");
+                out.fill(pixel(0, 0, 0));
+                for (col = 0; col < frame::WIDTH; ++col)
+                        for (row = 0; row < in[col]*frame::HEIGHT; ++row)
+                                out.at(col, frame::HEIGHT - (1 + row)) = p;
+                hue += 0.005;
+                if (hue >= 1)
+                        hue -= 1;
+                return true;
+        }
+
+        float hue;
+};
+
+// fade out over half_life seconds instead of vanishing (see afterglow.hpp)
+struct afterglow_stage : pipeline_stage {
+        typedef frame input_type;
+        typedef frame output_type;
+
+        explicit afterglow_stage(float half_life = 0.1)
+                : half_life(half_life)
+        {}
+
+        void prepare(frame_context& ctx)
+        {
+                glow.configure(half_life, ctx.interval);
+                glow.reset();
+        }
+
+        bool operator()(frame_context&, const frame&, frame& out)
+        {
+                glow.apply(out);
+                return true;
+        }
+
+        float half_life;
+        afterglow glow;
+};
+
+namespace detail {
+// where a stage's output lives between frames. Frames are the one being
+// made, so there's nothing to keep.
+struct frame_slot {};
+
+template <typename T>
+struct stage_slot {
+        typedef T type;
+
+        static T& get(T& slot, frame&)
+        {
+                return slot;
+        }
+};
+
+template <>
+struct stage_slot<frame> {
+        typedef frame_slot type;
+
+        static frame& get(frame_slot&, frame& f)
+        {
+                return f;
+        }
+};
+} // namespace detail
+
+template <typename... Stages>
+class pipeline_generator : public frame_generator {
+public:
+        explicit pipeline_generator(unsigned frame_rate,
+                                    Stages... stages)
+                : stages_(std::move(stages)...), frame_rate_(frame_rate)
+        {}
+
+        bool set_parameter(const std::string& name, float value)
+        {
+                if (name != "frame_rate" || value < 1)
+                        return frame_generator::set_parameter(name, value);
+                frame_rate_ = value;
+                return true;
+        }
+
+protected:
+        void prepare(const wav_reader& song)
+        {
+                frame_context ctx(*this, song, std::chrono::microseconds(0),
+                                  get_frame_interval());
+
+                reset_bands();
+                prepare_stages<0>(ctx, is_end<0>());
+        }
+
+        bool make_next_frame(const wav_reader& song,
+                             std::chrono::microseconds start, frame& f)
+        {
+                frame_context ctx(*this, song, start, get_frame_interval());
+
+                return run<0>(ctx, pipeline_start(), f, is_end<0>());
+        }
+
+        unsigned get_frame_rate() const
+        {
+                return frame_rate_;
+        }
+
+private:
+        typedef std::tuple<Stages...> stages_t;
+        static constexpr size_t N = sizeof...(Stages);
+
+        template <size_t I>
+        using stage_t = typename std::tuple_element<I, stages_t>::type;
+
+        template <size_t I>
+        using slot = detail::stage_slot<typename stage_t<I>::output_type>;
+
+        template <size_t I>
+        using is_end = std::integral_constant<bool, I == N>;
+
+        static_assert(N > 0, "a pipeline needs at least one stage");
+        static_assert(std::is_same<typename stage_t<0>::input_type,
+                                   pipeline_start>::value,
+                      "the first stage must take pipeline_start");
+        static_assert(std::is_same<typename stage_t<N - 1>::output_type,
+                                   frame>::value,
+                      "the last stage must make a frame");
+
+        template <size_t I>
+        void prepare_stages(frame_context& ctx, std::false_type)
+        {
+                std::get<I>(stages_).prepare(ctx);
+                prepare_stages<I + 1>(ctx, is_end<I + 1>());
+        }
+
+        template <size_t I>
+        void prepare_stages(frame_context&, std::true_type)
+        {}
+
+        template <size_t I, typename In>
+        bool run(frame_context& ctx, const In& in, frame& f, std::false_type)
+        {
+                static_assert(std::is_same<In,
+                              typename stage_t<I>::input_type>::value,
+                              "a stage's input must be the output of the "
+                              "stage before it");
+                auto& out = slot<I>::get(std::get<I>(slots_), f);
+
+                return std::get<I>(stages_)(ctx, in, out) &&
+                        run<I + 1>(ctx, out, f, is_end<I + 1>());
+        }
+
+        template <size_t I, typename In>
+        bool run(frame_context&, const In&, frame&, std::true_type)
+        {
+                return true;
+        }
+
+        stages_t stages_;
+        std::tuple<typename detail::stage_slot<
+                typename Stages::output_type>::type...> slots_;
+        unsigned frame_rate_;
+};
+
+// a new pipeline_generator, without spelling out the stage types
+template <typename... Stages>
+std::unique_ptr<pipeline_generator<Stages...>>
+make_pipeline(unsigned frame_rate, Stages... stages)
+{
+        return std::unique_ptr<pipeline_generator<Stages...>>(
+                new pipeline_generator<Stages...>(frame_rate,
+                                                  std::move(stages)...));
+}
@@ -0,0 +1,87 @@
+/**
+ * \file pipeline_test.cpp
+ *
+ * \brief Tests for pipeline_generator: stages run in order on each other's
+ * output, frame stages work in place, and a stage returning false ends the
+ * song. Reads AmpUp.wav, so run it from the software directory.
+ */
+
+#include "pipeline.hpp"
+
+#include <cassert>
+#include <iostream>
+
+using namespace std;
+using namespace chrono;
+
+// the frame number, for 10 frames
+struct count_stage : pipeline_stage {
+        typedef pipeline_start input_type;
+        typedef int output_type;
+
+        bool operator()(frame_context& ctx, const pipeline_start&, int& out)
+        {
+                out = ctx.start/ctx.interval;
+                return out < 10;
+        }
+};
+
+// light n pixels in the top row
+struct dots_stage : pipeline_stage {
+        typedef int input_type;
+        typedef frame output_type;
+
+        bool operator()(frame_context&, const int& in, frame& out)
+        {
+                int x;
+
+                out.fill(pixel(0, 0, 0));
+                for (x = 0; x < in; ++x)
+                        out.at(x, 0) = pixel(255, 255, 255);
+                return true;
+        }
+};
+
+// copy the top row to the bottom one. in and out are the same frame.
+struct mirror_stage : pipeline_stage {
+        typedef frame input_type;
+        typedef frame output_type;
+
+        bool operator()(frame_context&, const frame& in, frame& out)
+        {
+                size_t x;
+
+                assert(&in == &out);
+                for (x = 0; x < frame::WIDTH; ++x)
+                        out.at(x, frame::HEIGHT - 1) = in.at(x, 0);
+                return true;
+        }
+};
+
+int main(void)
+{
+        wav_reader song("AmpUp.wav");
+        auto gen = make_pipeline(20, count_stage(), dots_stage(),
+                                 mirror_stage());
+        static_fft_generator reference;
+        size_t frames = 0;
+
+        // the dots grow a frame at a time, and are mirrored at the bottom
+        assert(gen->render_song(song, [&](const frame& f) {
+                assert(f.at(frames, 0).red() == 0);
+                assert(frames == 0 ||
+                       f.at(frames - 1, frame::HEIGHT - 1).red() == 255);
+                ++frames;
+        }) == 10);
+
+        // the pipeline take on static_fft lasts as long as the original
+        frames = 0;
+        assert(make_pipeline(15, spectrum_stage(), band_stage(0.5),
+                             bars_stage(), afterglow_stage(0.1))
+               ->render_song(song, [&](const frame&) { ++frames; }) ==
+               reference.render_song(song, [](const frame&) {}));
+        assert(frames > 0);
+
+        cout << "test passed" << endl;
+        return 0;
+}
@@ -0,0 +1,201 @@
+/**
+ * \file pitch.cpp
+ *
+ * \brief pitch_tracker and the melody pipeline stages.
+ */
+
+#include "pitch.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+
+// keeps log() finite for bins that are exactly 0
+static const float TINY = 1e-30f;
+
+pitch_tracker::pitch_tracker(float low, float high, unsigned harmonics)
+        : low_(low), high_(high), harmonics_(max(1u, harmonics))
+{
+        reset();
+}
+
+void pitch_tracker::reset()
+{
+        last_.fundamental = 0;
+        last_.count = 0;
+}
+
+const pitch_estimate& pitch_tracker::last() const
+{
+        return last_;
+}
+
+float pitch_tracker::low() const
+{
+        return low_;
+}
+
+float pitch_tracker::high() const
+{
+        return high_;
+}
+
+partial pitch_tracker::interpolate(const spectrum& spec, size_t k,
+                                   float hz_per_bin)
+{
+        const float a = log(norm(spec[k - 1]) + TINY);
+        const float b = log(norm(spec[k]) + TINY);
+        const float c = log(norm(spec[k + 1]) + TINY);
+        const float d = a - 2*b + c;
+        float p = 0;
+
+        // vertex of the parabola through the three log powers
+        if (d < 0)
+                p = max(-0.5f, min(0.5f, 0.5f*(a - c)/d));
+        return { (k + p)*hz_per_bin, exp((b - 0.25f*(a - c)*p)/2) };
+}
+
+float pitch_tracker::hps(const spectrum& spec, size_t k) const
+{
+        float sum = 0, best;
+        size_t h, i;
+
+        // a harmonic of a fundamental between bins can be up to h/2 bins
+        // from h*k, so take the loudest bin that close
+        for (h = 1; h <= harmonics_; ++h) {
+                best = 0;
+                for (i = h*k - h/2; i <= h*k + h/2; ++i)
+                        best = max(best, norm(spec[i]));
+                sum += log(best + TINY);
+        }
+        return sum;
+}
+
+void pitch_tracker::analyze(const spectrum& spec, unsigned sample_rate,
+                            pitch_estimate& out)
+{
+        const size_t MAX = pitch_estimate::MAX_PARTIALS;
+        // 40dB below the loudest peak, in power
+        const float floor_ratio = 1e-4f;
+        float hz, prev, cur, next, score, best_score;
+        array<float, pitch_estimate::MAX_PARTIALS> power;
+        array<size_t, pitch_estimate::MAX_PARTIALS> bins;
+        size_t first, last, k, best, i, h, found = 0;
+
+        out.fundamental = 0;
+        out.count = 0;
+        if (spec.size() < 8) {
+                last_ = out;
+                return;
+        }
+        hz = float(sample_rate)/spec.size();
+        first = max<size_t>(2, low_/hz);
+        last = min<size_t>(spec.size()/2 - 1, high_/hz + 1);
+
+        // the loudest local maxima, kept sorted
+        prev = norm(spec[first - 1]);
+        cur = norm(spec[first]);
+        for (k = first; k < last; ++k, prev = cur, cur = next) {
+                next = norm(spec[k + 1]);
+                if (cur <= prev || cur < next)
+                        continue;
+                if (found == MAX && cur <= power[MAX - 1])
+                        continue;
+                i = found < MAX ? found++ : MAX - 1;
+                for (; i > 0 && power[i - 1] < cur; --i) {
+                        power[i] = power[i - 1];
+                        bins[i] = bins[i - 1];
+                }
+                power[i] = cur;
+                bins[i] = k;
+        }
+        for (i = 0; i < found && power[i] >= power[0]*floor_ratio; ++i)
+                out.partials[i] = interpolate(spec, bins[i], hz);
+        out.count = i;
+        if (out.count == 0) {
+                last_ = out;
+                return;
+        }
+
+        // the fundamental with the strongest harmonics
+        best = 0;
+        best_score = -INFINITY;
+        for (k = first; k <= last && (k + 1)*harmonics_ < spec.size()/2;
+             ++k) {
+                score = hps(spec, k);
+                if (score > best_score) {
+                        best_score = score;
+                        best = k;
+                }
+        }
+        if (best == 0) {
+                last_ = out;
+                return;
+        }
+
+        // stick with last frame's pitch unless it's clearly gone
+        if (last_.fundamental > 0) {
+                k = round(last_.fundamental/hz);
+                if (k >= first && k <= last &&
+                    (k + 1)*harmonics_ < spec.size()/2 &&
+                    hps(spec, k) > best_score - 1)
+                        best = k;
+        }
+
+        // the most precise frequency for it is a partial's, divided down
+        out.fundamental = interpolate(spec, best, hz).frequency;
+        for (i = 0; i < out.count; ++i) {
+                h = round(out.partials[i].frequency/(best*hz));
+                if (h >= 1 && h <= harmonics_ &&
+                    fabs(out.partials[i].frequency/h - best*hz) < hz) {
+                        out.fundamental = out.partials[i].frequency/h;
+                        break;
+                }
+        }
+        last_ = out;
+}
+
+bool melody_stage::operator()(frame_context&, const pitch_estimate& in,
+                              frame& out)
+{
+        const size_t right = frame::WIDTH - 1;
+        float note, hue, level;
+        size_t x, y, i;
+        int r;
+
+        for (x = 0; x < right; ++x)
+                for (y = 0; y < frame::HEIGHT; ++y)
+                        out.at(x, y) = out.at(x + 1, y);
+        for (y = 0; y < frame::HEIGHT; ++y)
+                out.at(right, y) = pixel(0, 0, 0);
+
+        for (i = 0; i < in.count; ++i) {
+                r = row(in.partials[i].frequency);
+                level = in.partials[i].magnitude/in.partials[0].magnitude;
+                if (r >= 0)
+                        out.at(right, r) = pixel(0, 48*level, 96*level);
+        }
+
+        r = row(in.fundamental);
+        if (r >= 0) {
+                note = 69 + 12*log2(in.fundamental/440);
+                hue = 2*M_PI*fmod(round(note), 12)/12;
+                out.at(right, r) = pixel(127*(1 + cos(hue)),
+                                         127*(1 + cos(hue - 2*M_PI/3)),
+                                         127*(1 + cos(hue - 4*M_PI/3)));
+        }
+        return true;
+}
+
+int melody_stage::row(float frequency) const
+{
+        float r;
+
+        if (frequency <= 0)
+                return -1;
+        r = frame::HEIGHT*log(frequency/low)/log(high/low);
+        if (r < 0 || r >= frame::HEIGHT)
+                return -1;
+        return frame::HEIGHT - 1 - int(r);
+}
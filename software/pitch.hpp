@@ -0,0 +1,130 @@
+/**
+ * \file pitch.hpp
+ *
+ * \brief Find the pitch being played, and its loudest partials, at better
+ * than FFT bin resolution, so a generator can draw a melody line.
+ *
+ * \detail pitch_tracker works on make_spectrum's output:
+ *
+ *  - Peak picking: the loudest local maxima of the spectrum between low
+ *    and high Hz, at most MAX_PARTIALS of them, dropping any more than
+ *    40dB below the loudest.
+ *  - Each peak's frequency and magnitude are interpolated from the parabola
+ *    through the log magnitudes of its bin and the two beside it. For
+ *    make_spectrum's gaussian window the log magnitude of a steady tone is
+ *    exactly a parabola, so this finds the true frequency. (A phase
+ *    vocoder would need overlapping frames to add anything; ours are back
+ *    to back.)
+ *  - The fundamental is the bin with the largest harmonic product
+ *    spectrum: the product of the power at it and at its first few
+ *    multiples. That's fooled far less by a loud second harmonic than
+ *    taking the loudest peak. It's then refined from whichever partial is
+ *    one of its harmonics. If last frame's fundamental scores nearly as
+ *    well it's kept, so the line doesn't flicker between octaves.
+ *
+ * The only state between frames is the last estimate. pitch_stage and
+ * melody_stage put it in a pipeline (see pipeline.hpp); make_generator's
+ * "melody" scrolls the fundamental and partials across the panel.
+ */
+
+#pragma once
+
+#include "pipeline.hpp"
+
+#include <array>
+#include <cstddef>
+
+// one sinusoid in the spectrum
+struct partial {
+        float frequency;        // Hz
+        float magnitude;        // as make_spectrum scales it
+};
+
+struct pitch_estimate {
+        static const size_t MAX_PARTIALS = 8;
+
+        // Hz, or 0 if the frame was silent
+        float fundamental;
+
+        // loudest first, count of them
+        std::array<partial, MAX_PARTIALS> partials;
+        size_t count;
+};
+
+class pitch_tracker {
+public:
+        // look for fundamentals between low and high Hz, scoring each
+        // with harmonics multiples
+        explicit pitch_tracker(float low = 50, float high = 2000,
+                               unsigned harmonics = 4);
+
+        // forget the last estimate, e.g. at the start of a song
+        void reset();
+
+        // estimate the pitch of a make_spectrum spectrum of audio at
+        // sample_rate. An empty (silent) spectrum gives no fundamental and
+        // no partials.
+        void analyze(const spectrum& spec, unsigned sample_rate,
+                     pitch_estimate& out);
+
+        const pitch_estimate& last() const;
+
+        float low() const;
+        float high() const;
+
+private:
+        // interpolate the peak at bin k
+        static partial interpolate(const spectrum& spec, size_t k,
+                                   float hz_per_bin);
+
+        // log of the harmonic product spectrum at bin k
+        float hps(const spectrum& spec, size_t k) const;
+
+        float low_, high_;
+        unsigned harmonics_;
+        pitch_estimate last_;
+};
+
+// the pitch of spectrum_stage's spectrum
+struct pitch_stage : pipeline_stage {
+        typedef spectrum input_type;
+        typedef pitch_estimate output_type;
+
+        explicit pitch_stage(float low = 50, float high = 2000)
+                : tracker(low, high)
+        {}
+
+        void prepare(frame_context&)
+        {
+                tracker.reset();
+        }
+
+        bool operator()(frame_context& ctx, const spectrum& in,
+                        pitch_estimate& out)
+        {
+                tracker.analyze(in, ctx.song.sample_rate(), out);
+                return true;
+        }
+
+        pitch_tracker tracker;
+};
+
+// scroll the frame left and draw the partials (dim) and fundamental
+// (bright, colored by pitch class) in the new right hand column, low
+// notes at the bottom, low to high Hz covering the height
+struct melody_stage : pipeline_stage {
+        typedef pitch_estimate input_type;
+        typedef frame output_type;
+
+        explicit melody_stage(float low = 50, float high = 2000)
+                : low(low), high(high)
+        {}
+
+        bool operator()(frame_context& ctx, const pitch_estimate& in,
+                        frame& out);
+
+        // the row for frequency, or -1 if it's off the panel
+        int row(float frequency) const;
+
+        float low, high;
+};
@@ -0,0 +1,82 @@
+/**
+ * \file pitch_test.cpp
+ *
+ * \brief Tests for pitch_tracker: harmonic tones between bins are pitched
+ * to a small fraction of a bin, a loud second harmonic doesn't fool it an
+ * octave up, partials come out loudest first, and silence has no pitch.
+ * Also renders a song with the melody generator. Reads AmpUp.wav, so run
+ * it from the software directory.
+ */
+
+#include "pitch.hpp"
+#include "player.hpp"
+
+#include <cassert>
+#include <cmath>
+#include <iostream>
+
+using namespace std;
+
+static const unsigned RATE = 44100;
+
+// a 20fps frame of a tone at f0 with the given harmonic amplitudes,
+// windowed and transformed like make_spectrum does
+static spectrum tone(float f0, const vector<float>& amplitudes)
+{
+        const size_t n = RATE/20;
+        const float sigma = 0.4;
+        spectrum spec;
+        float sample, x;
+        size_t i, h;
+
+        for (i = 0; i < n; ++i) {
+                sample = 0;
+                for (h = 0; h < amplitudes.size(); ++h)
+                        sample += amplitudes[h]*
+                                sin(2*M_PI*f0*(h + 1)*i/RATE + h);
+                x = (float(i) - (n - 1)/2.0f)/(sigma*(n - 1)/2);
+                spec.push_back(sample*exp(-0.5f*x*x));
+        }
+        assert(default_fft_backend().forward(spec) == 0);
+        return spec;
+}
+
+int main(void)
+{
+        pitch_tracker tracker;
+        pitch_estimate est;
+        const float hz = float(RATE)/tone(100, { 1 }).size();
+        size_t i, frames = 0;
+
+        // between bins, with decaying harmonics
+        for (float f0 : { 82.4f, 220.5f, 311.1f, 987.8f }) {
+                tracker.reset();
+                tracker.analyze(tone(f0, { 1000, 500, 250, 125 }), RATE, est);
+                assert(fabs(est.fundamental - f0) < 0.05f*hz);
+                assert(est.count >= 2);
+                assert(fabs(est.partials[0].frequency - f0) < 0.05f*hz);
+                for (i = 1; i < est.count; ++i)
+                        assert(est.partials[i].magnitude <=
+                               est.partials[i - 1].magnitude);
+        }
+
+        // the second harmonic is louder than the fundamental
+        tracker.reset();
+        tracker.analyze(tone(196, { 300, 1000, 400, 200 }), RATE, est);
+        assert(fabs(est.partials[0].frequency - 392) < 0.05f*hz);
+        assert(fabs(est.fundamental - 196) < 0.05f*hz);
+
+        // silence
+        tracker.analyze(spectrum(), RATE, est);
+        assert(est.fundamental == 0 && est.count == 0);
+        assert(tracker.last().fundamental == 0);
+
+        wav_reader song("AmpUp.wav");
+        auto melody = make_generator("melody");
+        assert(melody);
+        melody->render_song(song, [&](const frame&) { ++frames; });
+        assert(frames > 0);
+
+        cout << "test passed" << endl;
+        return 0;
+}
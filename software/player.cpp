@@ -0,0 +1,215 @@
+/**
+ * \file player.cpp
+ *
+ * \brief Shared command line visualizer setup.
+ */
+
+#include "player.hpp"
+#include "chroma.hpp"
+#include "expr.hpp"
+#include "fft_backend.hpp"
+#include "fft_tuner.hpp"
+#include "frame_ring.hpp"
+#include "frame_timer.hpp"
+#include "net_sink.hpp"
+#include "particles.hpp"
+#include "piHelpers.h"
+#include "pipeline.hpp"
+#include "pitch.hpp"
+#include "rt_config.hpp"
+#include "spi_wall.hpp"
+#include "task_pool.hpp"
+#include "system_constants.hpp"
+
+#include <cstring>
+#include <iostream>
+
+using namespace std;
+using namespace chrono;
+
+static void usage(const char *prog)
+{
+        cout << "usage: " << prog << " filename.wav [--e131 host] "
+             << "[--artnet host] [--shm] [--metrics port|path] "
+             << "[--rt-cpu n] [--rt role=policy[:prio][@cpus]] [--spin us] "
+             << "[--fft engine] [--spi-wall[-split] dev,dev...] [--spi] "
+             << "[--compress]" << endl;
+}
+
+// "/dev/spidev0.0,/dev/spidev1.0"
+static vector<string> split_devices(const string& arg)
+{
+        vector<string> devices;
+        size_t start = 0, comma;
+
+        do {
+                comma = arg.find(',', start);
+                devices.push_back(arg.substr(start, comma - start));
+                start = comma + 1;
+        } while (comma != string::npos);
+        return devices;
+}
+
+// "role=spec", e.g. "output=fifo:80@3"
+static bool parse_rt(const string& arg)
+{
+        size_t eq = arg.find('=');
+        string role = arg.substr(0, eq);
+        int r;
+
+        if (eq == string::npos)
+                return false;
+        for (r = 0; r < THREAD_ROLES; ++r)
+                if (role == role_name(thread_role(r)))
+                        return role_policy(thread_role(r))
+                                .parse(arg.substr(eq + 1));
+        return false;
+}
+
+bool parse_player_args(int argc, char **argv, player_options& opts)
+{
+        bool explicit_spi = false, rt = false, fft_chosen = false;
+        int i, rt_cpu = -1;
+        string host;
+
+        if (argc < 2) {
+                usage(argv[0]);
+                return false;
+        }
+
+        opts.song = argv[1];
+        // sinks and servers open their devices and sockets here, and
+        // numbers are parsed as we go, so report any of that like a bad
+        // option
+        try {
+                for (i = 2; i < argc; ++i) {
+                        if (strcmp(argv[i], "--spi") == 0) {
+                                explicit_spi = true;
+                        } else if (strcmp(argv[i], "--metrics") == 0 &&
+                                   i+1 < argc) {
+                                opts.metrics.reset(
+                                        new metrics_server(argv[++i]));
+                        } else if (strcmp(argv[i], "--rt-cpu") == 0 &&
+                                   i+1 < argc) {
+                                rt_cpu = stoi(argv[++i]);
+                                rt = true;
+                        } else if (strcmp(argv[i], "--rt") == 0 && i+1 < argc) {
+                                if (!parse_rt(argv[++i])) {
+                                        cerr << "bad --rt setting "
+                                             << argv[i] << endl;
+                                        return false;
+                                }
+                                rt = true;
+                        } else if (strcmp(argv[i], "--spin") == 0 &&
+                                   i+1 < argc) {
+                                frame_timer::set_default_spin(
+                                        microseconds(stoi(argv[++i])));
+                        } else if (strcmp(argv[i], "--fft") == 0 &&
+                                   i+1 < argc) {
+                                if (!set_default_fft_backend(argv[++i])) {
+                                        cerr << "no fft engine " << argv[i]
+                                             << " in this build" << endl;
+                                        return false;
+                                }
+                                fft_chosen = true;
+                        } else if ((strcmp(argv[i], "--spi-wall") == 0 ||
+                                    strcmp(argv[i], "--spi-wall-split") == 0)
+                                   && i+1 < argc) {
+                                opts.sinks.emplace_back(new spi_wall_sink(
+                                        split_devices(argv[i+1]),
+                                        argv[i][10] ? spi_wall_sink::SPLIT :
+                                                      spi_wall_sink::MIRROR));
+                                ++i;
+                                reset_display();
+                        } else if (strcmp(argv[i], "--compress") == 0) {
+                                wav_reader::set_default_compressed(true);
+                        } else if (strcmp(argv[i], "--shm") == 0) {
+                                opts.sinks.emplace_back(new frame_ring_sink);
+                        } else if ((strcmp(argv[i], "--e131") == 0 ||
+                                    strcmp(argv[i], "--artnet") == 0) &&
+                                   i+1 < argc) {
+                                host = strcmp(argv[i+1], "-") == 0 ? "" :
+                                        argv[i+1];
+                                opts.sinks.emplace_back(new net_sink(
+                                        argv[i][2] == 'e' ? net_sink::E131 :
+                                                            net_sink::ARTNET,
+                                        host));
+                                ++i;
+                        } else {
+                                usage(argv[0]);
+                                return false;
+                        }
+                }
+        } catch (const exception& e) {
+                cerr << e.what() << endl;
+                return false;
+        }
+
+        // use this machine's tuned FFT engines unless told otherwise
+        if (!fft_chosen)
+                load_fft_wisdom();
+
+        // the reserved core is where the output thread goes unless told
+        // otherwise
+        if (rt_cpu >= 0 && role_policy(OUTPUT_THREAD).cpus.empty())
+                role_policy(OUTPUT_THREAD).cpus.push_back(rt_cpu);
+        task_pool::configure(0, rt_cpu, []() {
+                apply_role_policy(ANALYSIS_THREAD);
+        });
+        if (rt)
+                rt_self_check(cerr);
+
+        opts.use_spi = opts.sinks.empty() || explicit_spi;
+        if (explicit_spi)
+                opts.sinks.emplace_back(new spi_sink);
+        return true;
+}
+
+static void pulse_reset()
+{
+        pinMode(RESET_PIN, OUTPUT);
+        digitalWrite(RESET_PIN, 1);
+        digitalWrite(RESET_PIN, 0);
+}
+
+void init_display()
+{
+        pioInit();
+        pTimerInit();
+        spiInit(7812000, 0);
+        pulse_reset();
+}
+
+void reset_display()
+{
+        pioInit();
+        pTimerInit();
+        pulse_reset();
+}
+
+unique_ptr<frame_generator> make_generator(const string& name)
+{
+        if (name == "scrolling")
+                return unique_ptr<frame_generator>(new scrolling_fft_generator);
+        if (name == "static")
+                return unique_ptr<frame_generator>(new static_fft_generator);
+        if (name == "bars")
+                return make_pipeline(15, spectrum_stage(), band_stage(0.5),
+                                     bars_stage(), afterglow_stage(0.1));
+        if (name == "chroma")
+                return unique_ptr<frame_generator>(new chroma_generator);
+        if (name == "melody")
+                return make_pipeline(20, spectrum_stage(), pitch_stage(),
+                                     melody_stage());
+        if (name == "particles")
+                return unique_ptr<frame_generator>(new particle_generator);
+        if (name.compare(0, 5, "expr:") == 0)
+                return expr_generator::from_file(name.substr(5));
+        return nullptr;
+}
+
+void attach_sinks(player_options& opts, frame_generator& gen)
+{
+        for (auto& sink : opts.sinks)
+                gen.add_sink(*sink);
+}
@@ -0,0 +1,75 @@
+/**
+ * \file player.hpp
+ *
+ * \brief Setup shared by the command line visualizers (scrolling_fft,
+ * static_fft): argument parsing, frame sinks and Pi peripheral init.
+ */
+
+#pragma once
+
+#include "frame.hpp"
+#include "metrics.hpp"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+struct player_options {
+        std::string song;
+
+        // extra frame destinations requested on the command line
+        std::vector<std::unique_ptr<frame_sink>> sinks;
+
+        // true if frames should (also) go to the SPI panel
+        bool use_spi = true;
+
+        // serves render loop metrics, if asked for
+        std::unique_ptr<metrics_server> metrics;
+};
+
+// parse "prog filename.wav [options]". Prints usage and returns false if
+// the arguments don't make sense. Options:
+//     --e131 host     send frames as E1.31 to host ("-" to multicast)
+//     --artnet host   send frames as Art-Net to host ("-" to broadcast)
+//     --shm           publish frames to the shared memory frame_ring
+//     --metrics where serve Prometheus metrics on localhost port where, or
+//                     on a Unix socket if where is a path
+//     --rt-cpu n      keep CPU n for the output thread; background work
+//                     in the task_pool runs on the other cores
+//     --rt role=spec  scheduling for the output, render or analysis
+//                     threads, as policy[:prio][@cpus] (see rt_config.hpp).
+//                     Either --rt option prints a self-check to stderr.
+//     --spin us       busy wait the last us microseconds before each
+//                     frame instead of trusting the kernel to wake us on
+//                     time (see frame_timer.hpp)
+//     --fft engine    use this fft_backend (builtin, radix2, fftw, ...)
+//                     instead of the fft_tune wisdom for this machine
+//     --spi-wall devs send each of a comma separated list of spidev
+//                     devices a whole frame, concurrently, so each of
+//                     their panels shows the picture (see spi_wall.hpp)
+//     --spi-wall-split devs
+//                     the same, but stretch the picture down the wall of
+//                     panels, the first device's at the top
+//     --spi           keep writing to the SPI panel when using other sinks
+//     --compress      keep songs compressed in memory, for long
+//                     recordings on boards short of RAM (see
+//                     sample_store.hpp)
+bool parse_player_args(int argc, char **argv, player_options& opts);
+
+// set up the Pi's peripherals, including an 8MHz SPI clock, and reset the
+// display before we try to display anything
+void init_display();
+
+// just reset the display, for when something other than frame::write
+// (e.g. an spi_wall_sink) owns the SPI controllers
+void reset_display();
+
+// construct a generator by name ("scrolling", "static", "bars", a
+// pipeline take on static, "chroma", "melody", "particles", or
+// "expr:FILE" for an expression program; see expr.hpp). Returns null for
+// an unknown name, and throws std::runtime_error if an expression program
+// won't compile.
+std::unique_ptr<frame_generator> make_generator(const std::string& name);
+
+// attach the sinks in opts to gen
+void attach_sinks(player_options& opts, frame_generator& gen);
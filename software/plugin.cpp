@@ -0,0 +1,145 @@
+/**
+ * \file plugin.cpp
+ *
+ * \brief Generator plugin loading and hot swapping.
+ */
+
+#include "plugin.hpp"
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+
+#include <dlfcn.h>
+#include <unistd.h>
+
+using namespace std;
+
+// dlopen hands back the already loaded copy of a path it has open, so load
+// a private copy instead. Unlinking it right away is fine; the mapping
+// stays.
+static void *open_copy(const string& path)
+{
+        char tmp[] = "/tmp/musicvis-plugin-XXXXXX.so";
+        void *handle;
+        int fd;
+
+        fd = mkstemps(tmp, 3);
+        if (fd < 0)
+                throw runtime_error(string("plugin: mkstemps: ") +
+                                    strerror(errno));
+        close(fd);
+        {
+                ifstream in(path, ios::binary);
+                ofstream out(tmp, ios::binary);
+                if (!in || !(out << in.rdbuf())) {
+                        unlink(tmp);
+                        throw runtime_error("plugin: can't read " + path);
+                }
+        }
+        handle = dlopen(tmp, RTLD_NOW | RTLD_LOCAL);
+        unlink(tmp);
+        if (!handle)
+                throw runtime_error(string("plugin: ") + dlerror());
+        return handle;
+}
+
+generator_plugin::generator_plugin(const string& path)
+        : path_(path), handle_(open_copy(path)), gen_(nullptr),
+          destroy_(nullptr)
+{
+        musicvis_plugin_abi_fn abi;
+        musicvis_create_generator_fn create;
+        string err;
+
+        // POSIX says a void * from dlsym converts to a function pointer
+        abi = (musicvis_plugin_abi_fn)dlsym(handle_, "musicvis_plugin_abi");
+        create = (musicvis_create_generator_fn)dlsym(
+                handle_, "musicvis_create_generator");
+        destroy_ = (musicvis_destroy_generator_fn)dlsym(
+                handle_, "musicvis_destroy_generator");
+
+        if (!abi || !create || !destroy_)
+                err = " isn't a plugin (no MUSICVIS_PLUGIN)";
+        else if (abi() != MUSICVIS_PLUGIN_ABI)
+                err = " was built for plugin ABI " + to_string(abi()) +
+                        ", we're " + to_string(MUSICVIS_PLUGIN_ABI);
+        else if (!(gen_ = create()))
+                err = " didn't make a generator";
+        if (!err.empty()) {
+                dlclose(handle_);
+                throw runtime_error("plugin: " + path + err);
+        }
+}
+
+generator_plugin::~generator_plugin()
+{
+        destroy_(gen_);
+        dlclose(handle_);
+}
+
+frame_generator& generator_plugin::generator()
+{
+        return *gen_;
+}
+
+const string& generator_plugin::path() const
+{
+        return path_;
+}
+
+plugin_host::plugin_host(generator_switch& sw)
+        : switch_(sw), loaded_(true)
+{}
+
+plugin_host::~plugin_host()
+{
+        wait();
+        // the switch may still be rendering with it
+        if (current_) {
+                frame_generator& g = current_->generator();
+                switch_.retire(g, shared_ptr<void>(move(current_)));
+        }
+}
+
+void plugin_host::load(const string& path)
+{
+        wait();
+        switch_.collect();
+
+        loader_ = thread([this, path]() {
+                unique_ptr<generator_plugin> p;
+                bool ok = false;
+
+                try {
+                        p.reset(new generator_plugin(path));
+                        switch_.prepare_and_switch(p->generator());
+                        ok = true;
+                } catch (const exception& e) {
+                        cerr << e.what() << endl;
+                }
+
+                lock_guard<mutex> lock(lock_);
+                loaded_ = ok;
+                if (!ok)
+                        return;
+                // nothing can switch back to the old one, but it may be
+                // mid frame
+                swap(p, current_);
+                if (p) {
+                        frame_generator& g = p->generator();
+                        switch_.retire(g, shared_ptr<void>(move(p)));
+                }
+        });
+}
+
+bool plugin_host::wait()
+{
+        if (loader_.joinable())
+                loader_.join();
+        lock_guard<mutex> lock(lock_);
+        return loaded_;
+}
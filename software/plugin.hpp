@@ -0,0 +1,105 @@
+/**
+ * \file plugin.hpp
+ *
+ * \brief Load frame generators from shared objects, and swap them in while
+ * a song plays, so trying out a visualizer doesn't mean restarting the
+ * player (and reloading the song and restarting aplay).
+ *
+ * \detail A plugin is a shared object built against the same frame.hpp
+ * that ends with
+ *
+ *     MUSICVIS_PLUGIN(my_generator)
+ *
+ * which exports C linkage functions to check the ABI and to create and
+ * destroy a my_generator, so the object is freed by the code that made
+ * it. Build it with
+ *
+ *     $(CXX) $(CXXFLAGS) -fPIC -shared -o my_plugin.so my_plugin.cpp
+ *
+ * The host must be linked with -rdynamic so the plugin can call
+ * frame_generator's own methods (make_spectrum and so on) in it.
+ *
+ * plugin_host loads a plugin on a background thread, prepares it for the
+ * song that's playing there too, and only then hands it to a
+ * generator_switch, so the render thread just swaps a pointer. Loading the
+ * same path again picks up a rebuilt .so.
+ */
+
+#pragma once
+
+#include "frame.hpp"
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// bump whenever frame_generator or anything it holds changes shape, since
+// plugins compiled against the old frame.hpp would then be wrong
+#define MUSICVIS_PLUGIN_ABI 1
+
+extern "C" {
+typedef unsigned (*musicvis_plugin_abi_fn)();
+typedef frame_generator *(*musicvis_create_generator_fn)();
+typedef void (*musicvis_destroy_generator_fn)(frame_generator *);
+}
+
+#define MUSICVIS_PLUGIN(type)                                           \
+        extern "C" unsigned musicvis_plugin_abi()                       \
+        {                                                               \
+                return MUSICVIS_PLUGIN_ABI;                             \
+        }                                                               \
+        extern "C" frame_generator *musicvis_create_generator()         \
+        {                                                               \
+                return new type;                                        \
+        }                                                               \
+        extern "C" void musicvis_destroy_generator(frame_generator *g)  \
+        {                                                               \
+                delete g;                                               \
+        }
+
+// one loaded plugin and the generator it made
+class generator_plugin {
+public:
+        // throws std::runtime_error if path can't be loaded, was built for
+        // another ABI, or doesn't make a generator
+        explicit generator_plugin(const std::string& path);
+        ~generator_plugin();
+
+        generator_plugin(const generator_plugin&) = delete;
+        generator_plugin& operator=(const generator_plugin&) = delete;
+
+        frame_generator& generator();
+        const std::string& path() const;
+
+private:
+        std::string path_;
+        void *handle_;
+        frame_generator *gen_;
+        musicvis_destroy_generator_fn destroy_;
+};
+
+class plugin_host {
+public:
+        explicit plugin_host(generator_switch& sw);
+        ~plugin_host();
+
+        plugin_host(const plugin_host&) = delete;
+        plugin_host& operator=(const plugin_host&) = delete;
+
+        // load path on a background thread and switch to it once it's
+        // ready. Errors go to stderr. The plugin it replaces is handed to
+        // the switch to unload once the rendering thread is done with it.
+        void load(const std::string& path);
+
+        // wait for the last load to finish. Returns false if it failed.
+        bool wait();
+
+private:
+        generator_switch& switch_;
+        std::mutex lock_;
+        // the plugin most recently switched to
+        std::unique_ptr<generator_plugin> current_;
+        std::thread loader_;
+        bool loaded_;
+};
@@ -0,0 +1,106 @@
+/**
+ * \file plugin_test.cpp
+ *
+ * \brief Tests for generator plugins: pulse_plugin.so loads, is swapped in
+ * mid song, bad plugins are turned away, and replaced generators are only
+ * dropped once the rendering thread is done with them. Reads AmpUp.wav and
+ * pulse_plugin.so, so run it from the software directory.
+ */
+
+#include "plugin.hpp"
+
+#include <cassert>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+
+using namespace std;
+
+// pulse_plugin fills the whole panel with one color
+static bool is_pulse(const frame& f)
+{
+        for (const pixel& p : f)
+                if (p.red() != f[0].red() || p.green() != f[0].green() ||
+                    p.blue() != f[0].blue())
+                        return false;
+        return f[0].red() + f[0].blue() > 0;
+}
+
+int main(void)
+{
+        wav_reader song("AmpUp.wav");
+        static_fft_generator fallback;
+        generator_switch sw(fallback);
+        plugin_host host(sw);
+        size_t frames = 0, pulses = 0;
+        bool threw = false;
+
+        try {
+                generator_plugin("./no_such_plugin.so");
+        } catch (const runtime_error&) {
+                threw = true;
+        }
+        assert(threw);
+
+        // loaded while the song renders, it takes over from the next frame
+        sw.render_song(song, [&](const frame& f) {
+                if (frames == 5) {
+                        host.load("./pulse_plugin.so");
+                        assert(host.wait());
+                } else if (frames > 5) {
+                        assert(is_pulse(f));
+                        ++pulses;
+                }
+                ++frames;
+        });
+        assert(pulses > 0);
+        assert(sw.uses(sw.active()));
+
+        // loading it again gives a new copy, and a failed load leaves the
+        // current one playing
+        {
+                frame_generator& first = sw.active();
+                host.load("./pulse_plugin.so");
+                assert(host.wait());
+                assert(&sw.active() != &first);
+        }
+        host.load("./no_such_plugin.so");
+        assert(!host.wait());
+        frames = 0;
+        sw.render_song(song, [&](const frame& f) {
+                assert(is_pulse(f));
+                ++frames;
+        });
+        assert(frames > 0);
+        assert(sw.collect() == 0);
+
+        // one switched away from mid song is kept until the rendering
+        // thread has moved on from it
+        frame_generator& pulse = sw.active();
+        static_fft_generator other;
+        shared_ptr<int> owner = make_shared<int>(0);
+        weak_ptr<int> kept = owner;
+        frames = 0;
+        sw.render_song(song, [&](const frame& f) {
+                if (frames < 3)
+                        assert(is_pulse(f));
+                if (frames == 2) {
+                        sw.switch_to(other);
+                        sw.retire(pulse, move(owner));
+                        assert(sw.collect() == 1);
+                } else if (frames == 3) {
+                        // swapped out by this frame, which may have been
+                        // the one still using it
+                        assert(!sw.uses(pulse));
+                        assert(sw.collect() == 1);
+                } else if (frames == 4) {
+                        assert(sw.collect() == 0);
+                        assert(kept.expired());
+                }
+                ++frames;
+        });
+        assert(frames > 4);
+
+        cout << "test passed" << endl;
+        return 0;
+}
@@ -0,0 +1,53 @@
+/**
+ * \file pulse_plugin.cpp
+ *
+ * \brief An example generator plugin: the whole panel pulses with the
+ * loudness of the song. Build with make pulse_plugin.so and load it into a
+ * running visualizer_daemon with "plugin ./pulse_plugin.so".
+ */
+
+#include "plugin.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+using namespace chrono;
+
+class pulse_generator : public frame_generator {
+public:
+        pulse_generator() : max_(1) {}
+
+protected:
+        void prepare(const wav_reader& song)
+        {
+                max_ = max(song.max_sample(), 1e-6f);
+        }
+
+        bool make_next_frame(const wav_reader& song, microseconds start,
+                             frame& f)
+        {
+                vector<float> samples = song.get_range(start,
+                                                       get_frame_interval());
+                float peak = 0;
+                uint8_t level;
+
+                if (samples.empty())
+                        return false;
+                for (float s : samples)
+                        peak = max(peak, fabs(s));
+                level = min(peak/max_, 1.0f)*255;
+                f.fill(pixel(level, level/4, 255 - level));
+                return true;
+        }
+
+        unsigned get_frame_rate() const
+        {
+                return 30;
+        }
+
+private:
+        float max_;
+};
+
+MUSICVIS_PLUGIN(pulse_generator)
@@ -0,0 +1,75 @@
+/**
+ * \file quality.cpp
+ *
+ * \brief Adaptive quality controller implementation.
+ */
+
+#include "quality.hpp"
+
+using namespace std;
+using namespace chrono;
+
+// step down once load has been over HIGH for HOT_FRAMES frames, and up once
+// it has been under LOW for CALM_FRAMES. A level costs about half the one
+// above it, so stepping up from LOW lands well under HIGH.
+static const float HIGH = 0.85;
+static const float LOW = 0.35;
+static const unsigned HOT_FRAMES = 3;
+static const unsigned CALM_FRAMES = 64;
+
+// give the smoothed load time to reflect a change before acting again
+static const unsigned COOLDOWN_FRAMES = 8;
+
+static const quality_level levels[quality_controller::LEVELS] = {
+        { 1, 0, false },
+        { 1, 1, false },
+        { 1, 1, true },
+        { 2, 2, true },
+};
+
+quality_controller::quality_controller()
+        : load_(0), level_(0), hot_frames_(0), calm_frames_(0), cooldown_(0)
+{}
+
+bool quality_controller::observe(microseconds render, microseconds budget)
+{
+        float ratio = budget.count() > 0 ?
+                float(render.count())/budget.count() : 0;
+        unsigned old = level_;
+
+        load_ += 0.25f*(ratio - load_);
+
+        if (cooldown_ > 0) {
+                --cooldown_;
+                return false;
+        }
+
+        hot_frames_ = load_ > HIGH ? hot_frames_ + 1 : 0;
+        calm_frames_ = load_ < LOW ? calm_frames_ + 1 : 0;
+
+        if (hot_frames_ >= HOT_FRAMES && level_ + 1 < LEVELS)
+                ++level_;
+        else if (calm_frames_ >= CALM_FRAMES && level_ > 0)
+                --level_;
+
+        if (level_ == old)
+                return false;
+        hot_frames_ = calm_frames_ = 0;
+        cooldown_ = COOLDOWN_FRAMES;
+        return true;
+}
+
+unsigned quality_controller::level() const
+{
+        return level_;
+}
+
+const quality_level& quality_controller::settings() const
+{
+        return levels[level_];
+}
+
+const quality_level& quality_controller::settings(unsigned level)
+{
+        return levels[level < LEVELS ? level : LEVELS - 1];
+}
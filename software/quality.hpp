@@ -0,0 +1,56 @@
+/**
+ * \file quality.hpp
+ *
+ * \brief Trade detail for speed when rendering can't keep up with the
+ * frame rate, so slower boards still make every frame deadline.
+ *
+ * \detail play_song tells a quality_controller how long each frame took to
+ * render compared to the frame interval. It keeps a smoothed load figure
+ * and steps down a level when load stays high, and back up only once load
+ * has stayed well below the threshold for a couple of seconds. The
+ * thresholds are far enough apart that stepping up can't immediately
+ * overload it again, so it doesn't oscillate.
+ *
+ * Each level does roughly half the work of the one above, since the FFT
+ * is most of it:
+ *
+ *     0  full detail
+ *     1  halve the FFT (analyze half of each frame's samples)
+ *     2  also only analyze alternate frames, interpolating in between
+ *     3  quarter the FFT, and analyze every other band, filling in the
+ *        neighbours
+ */
+
+#pragma once
+
+#include <chrono>
+
+struct quality_level {
+        unsigned band_step;     // analyze every band_step-th band
+        unsigned fft_shift;     // use interval >> fft_shift of samples
+        bool interpolate;       // analyze alternate frames only
+};
+
+class quality_controller {
+public:
+        static const unsigned LEVELS = 4;
+
+        quality_controller();
+
+        // record one frame's render time against its budget (the frame
+        // interval). Returns true if the level changed.
+        bool observe(std::chrono::microseconds render,
+                     std::chrono::microseconds budget);
+
+        unsigned level() const;
+        const quality_level& settings() const;
+
+        static const quality_level& settings(unsigned level);
+
+private:
+        float load_;            // smoothed render time / budget
+        unsigned level_;
+        unsigned hot_frames_;   // frames in a row over the high mark
+        unsigned calm_frames_;  // frames in a row under the low mark
+        unsigned cooldown_;     // frames to ignore after a change
+};
@@ -0,0 +1,67 @@
+/**
+ * \file quality_test.cpp
+ *
+ * \brief Tests for quality_controller: it steps down under load, holds
+ * steady in between, and steps back up only after a long calm spell.
+ */
+
+#include "quality.hpp"
+
+#include <cassert>
+#include <iostream>
+
+using namespace std;
+using namespace chrono;
+
+// feed n frames that each took load times the budget. Returns how many
+// times the level changed.
+static unsigned feed(quality_controller& q, float load, unsigned n)
+{
+        const microseconds budget(50000);
+        unsigned changes = 0;
+
+        while (n-- > 0)
+                changes += q.observe(microseconds(long(load*budget.count())),
+                                     budget);
+        return changes;
+}
+
+int main(void)
+{
+        quality_controller q;
+
+        assert(q.level() == 0);
+        assert(q.settings().band_step == 1 && !q.settings().interpolate);
+
+        // comfortable: nothing happens
+        assert(feed(q, 0.5, 500) == 0);
+        assert(q.level() == 0);
+
+        // overloaded: steps down, one level at a time, to the bottom
+        feed(q, 1.5, 5);
+        assert(q.level() == 1);
+        feed(q, 1.5, 200);
+        assert(q.level() == quality_controller::LEVELS - 1);
+        assert(q.settings().interpolate);
+
+        // halfway load at a low level is inside the hysteresis band
+        assert(feed(q, 0.6, 1000) == 0);
+
+        // a brief lull isn't enough to step up
+        assert(feed(q, 0.1, 20) == 0);
+
+        // a long one is, one level per calm spell
+        feed(q, 0.1, 80);
+        assert(q.level() == quality_controller::LEVELS - 2);
+        feed(q, 0.1, 1000);
+        assert(q.level() == 0);
+
+        // load that flips between levels' costs doesn't make it flap:
+        // stepping down halves the cost, which lands in the band
+        q = quality_controller();
+        feed(q, 1.0, 10);
+        assert(q.level() == 1);
+        assert(feed(q, 0.5, 1000) == 0);
+
+        cout << "test passed" << endl;
+}
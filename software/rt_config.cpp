@@ -0,0 +1,214 @@
+/**
+ * \file rt_config.cpp
+ *
+ * \brief Thread scheduling configuration implementation.
+ */
+
+#include "rt_config.hpp"
+
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+#include <pthread.h>
+#include <sched.h>
+
+using namespace std;
+
+static thread_policy policies[THREAD_ROLES];
+
+thread_policy::thread_policy()
+        : policy(INHERIT), priority(0)
+{}
+
+// parse a non-negative decimal number that is all of s
+static bool parse_number(const string& s, int& n)
+{
+        if (s.empty() || s.find_first_not_of("0123456789") != string::npos)
+                return false;
+        try {
+                n = stoi(s);
+        } catch (const exception&) {
+                return false;
+        }
+        return true;
+}
+
+// parse a cpu list like "0-2,4", as used by isolcpus and taskset
+static bool parse_cpus(const string& list, vector<int>& cpus)
+{
+        istringstream in(list);
+        string range;
+        size_t dash;
+        int lo, hi;
+
+        cpus.clear();
+        while (getline(in, range, ',')) {
+                dash = range.find('-');
+                if (!parse_number(range.substr(0, dash), lo))
+                        return false;
+                if (dash == string::npos)
+                        hi = lo;
+                else if (!parse_number(range.substr(dash + 1), hi))
+                        return false;
+                if (lo < 0 || hi < lo || hi >= CPU_SETSIZE)
+                        return false;
+                for (; lo <= hi; ++lo)
+                        cpus.push_back(lo);
+        }
+        return !cpus.empty();
+}
+
+bool thread_policy::parse(const string& spec)
+{
+        thread_policy p;
+        size_t at = spec.find('@');
+        size_t colon = spec.find(':');
+        string name = spec.substr(0, min(at, colon));
+
+        if (name == "fifo")
+                p.policy = SCHED_FIFO;
+        else if (name == "rr")
+                p.policy = SCHED_RR;
+        else if (name == "other")
+                p.policy = SCHED_OTHER;
+        else
+                return false;
+
+        // the priority comes before the cpus, as in "fifo:80@3"
+        if (colon != string::npos) {
+                if (colon > at || !parse_number(spec.substr(
+                                colon + 1, at - colon - 1), p.priority))
+                        return false;
+        } else if (p.policy != SCHED_OTHER) {
+                p.priority = 50;
+        }
+        if (p.priority < sched_get_priority_min(p.policy) ||
+            p.priority > sched_get_priority_max(p.policy))
+                return false;
+
+        if (at != string::npos && !parse_cpus(spec.substr(at + 1), p.cpus))
+                return false;
+
+        *this = p;
+        return true;
+}
+
+string thread_policy::describe() const
+{
+        ostringstream out;
+        size_t i;
+
+        out << (policy == SCHED_FIFO ? "fifo" :
+                policy == SCHED_RR ? "rr" :
+                policy == SCHED_OTHER ? "other" : "inherit");
+        if (policy == SCHED_FIFO || policy == SCHED_RR)
+                out << ":" << priority;
+        for (i = 0; i < cpus.size(); ++i)
+                out << (i == 0 ? "@" : ",") << cpus[i];
+        return out.str();
+}
+
+const char *role_name(thread_role role)
+{
+        static const char *const names[THREAD_ROLES] = {
+                "output", "render", "analysis"
+        };
+        return names[role];
+}
+
+thread_policy& role_policy(thread_role role)
+{
+        return policies[role];
+}
+
+string apply_role_policy(thread_role role)
+{
+        const thread_policy& p = policies[role];
+        sched_param param;
+        cpu_set_t set;
+        int err;
+
+        // no cpus keeps the inherited affinity, e.g. task_pool workers
+        // kept off the reserved core
+        if (!p.cpus.empty()) {
+                CPU_ZERO(&set);
+                for (int c : p.cpus)
+                        CPU_SET(c, &set);
+                err = pthread_setaffinity_np(pthread_self(), sizeof set,
+                                             &set);
+                if (err != 0)
+                        return string("affinity: ") + strerror(err);
+        }
+
+        if (p.policy == thread_policy::INHERIT)
+                return "";
+        memset(&param, 0, sizeof param);
+        param.sched_priority = p.priority;
+        // so aplay, and threads with no role of their own, don't end up
+        // real time too
+        err = pthread_setschedparam(pthread_self(),
+                                    p.policy | SCHED_RESET_ON_FORK, &param);
+        if (err != 0)
+                return string("scheduling: ") + strerror(err);
+        return "";
+}
+
+saved_thread_policy::saved_thread_policy()
+{
+        have_policy_ = pthread_getschedparam(pthread_self(), &policy_,
+                                             &param_) == 0;
+        have_cpus_ = pthread_getaffinity_np(pthread_self(), sizeof cpus_,
+                                            &cpus_) == 0;
+}
+
+saved_thread_policy::~saved_thread_policy()
+{
+        if (have_policy_)
+                pthread_setschedparam(pthread_self(), policy_, &param_);
+        if (have_cpus_)
+                pthread_setaffinity_np(pthread_self(), sizeof cpus_, &cpus_);
+}
+
+// CPUs the kernel keeps general scheduling off (isolcpus=)
+static vector<int> isolated_cpus()
+{
+        ifstream in("/sys/devices/system/cpu/isolated");
+        vector<int> cpus;
+        string list;
+
+        if (getline(in, list) && !list.empty())
+                parse_cpus(list, cpus);
+        return cpus;
+}
+
+bool rt_self_check(ostream& out)
+{
+        const vector<int> isolated = isolated_cpus();
+        bool all_ok = true;
+        string err;
+        int r, n_isolated;
+
+        for (r = 0; r < THREAD_ROLES; ++r) {
+                const thread_policy& p = policies[r];
+
+                thread t([&]() { err = apply_role_policy(thread_role(r)); });
+                t.join();
+
+                out << "rt: " << role_name(thread_role(r)) << " thread "
+                    << p.describe() << ": " << (err.empty() ? "ok" : err);
+
+                n_isolated = 0;
+                for (int cpu : p.cpus)
+                        for (int iso : isolated)
+                                n_isolated += cpu == iso;
+                if (!p.cpus.empty())
+                        out << " (" << n_isolated << " of " << p.cpus.size()
+                            << " cpus isolated)";
+                out << "\n";
+
+                all_ok = all_ok && err.empty();
+        }
+        return all_ok;
+}
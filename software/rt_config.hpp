@@ -0,0 +1,83 @@
+/**
+ * \file rt_config.hpp
+ *
+ * \brief Scheduling policy, priority and CPU affinity for the threads
+ * involved in playing a song.
+ *
+ * \detail There are three kinds of thread:
+ *
+ *     output      play_song's own thread; waits for each frame edge and
+ *                 writes the frame out
+ *     render      renders frames ahead of the output thread
+ *     analysis    the task_pool workers doing background work
+ *
+ * Each gets a policy written as policy[:priority][@cpus], e.g. "fifo:80@3",
+ * "rr:40" or "other@0-2,4". Roles with no policy, or no cpus, keep the
+ * policy or affinity they inherited, so running under chrt/taskset still
+ * works. The real time policies need root or CAP_SYS_NICE (or an rtprio
+ * limit); rt_self_check says what actually took effect.
+ */
+
+#pragma once
+
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include <sched.h>
+
+enum thread_role { OUTPUT_THREAD, RENDER_THREAD, ANALYSIS_THREAD,
+                   THREAD_ROLES };
+
+struct thread_policy {
+        // leave the thread with whatever it inherited (e.g. from chrt)
+        static const int INHERIT = -1;
+
+        thread_policy();
+
+        // parse policy[:priority][@cpus]. Returns false on a bad spec and
+        // leaves the policy alone.
+        bool parse(const std::string& spec);
+
+        // the spec this policy would parse from
+        std::string describe() const;
+
+        int policy;             // INHERIT, SCHED_OTHER, SCHED_FIFO or SCHED_RR
+        int priority;           // 1-99 for FIFO and RR, 0 for OTHER
+        std::vector<int> cpus;  // allowed CPUs; empty keeps the inherited
+};
+
+const char *role_name(thread_role role);
+
+// the policy for each role. Set these up at startup, before any threads
+// that use them start.
+thread_policy& role_policy(thread_role role);
+
+// apply role's policy to the calling thread. Returns an empty string on
+// success, or what went wrong. Threads and processes the thread starts
+// afterwards don't inherit a real time policy (SCHED_RESET_ON_FORK), but
+// do inherit its affinity.
+std::string apply_role_policy(thread_role role);
+
+// the calling thread's policy and affinity, put back when this goes out
+// of scope, for a thread that takes on a role for a while and then goes
+// back to what it was doing (like the daemon's player thread)
+class saved_thread_policy {
+public:
+        saved_thread_policy();
+        ~saved_thread_policy();
+
+        saved_thread_policy(const saved_thread_policy&) = delete;
+        saved_thread_policy& operator=(const saved_thread_policy&) = delete;
+
+private:
+        int policy_;
+        sched_param param_;
+        cpu_set_t cpus_;
+        bool have_policy_, have_cpus_;
+};
+
+// try every role's policy on a scratch thread and report to out whether
+// it took, and whether pinned CPUs are isolated (isolcpus). Returns false
+// if any policy couldn't be applied.
+bool rt_self_check(std::ostream& out);
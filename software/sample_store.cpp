@@ -0,0 +1,215 @@
+/**
+ * \file sample_store.cpp
+ *
+ * \brief Compressed sample storage implementation.
+ *
+ * \detail A block is
+ *
+ *     order       1 byte: 0, 1 or 2 samples of prediction
+ *     warm up     the first order samples, 16 bit little endian
+ *     groups      for every GROUP samples after those, a byte giving the
+ *                 bit width, then GROUP errors at that width, zigzag coded
+ *                 (0, -1, 1, -2, ... as 0, 1, 2, 3, ...) and packed low
+ *                 bits first. GROUP*width bits is a whole number of bytes.
+ *
+ * The last group of the song is padded with zeros.
+ */
+
+#include "sample_store.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <limits>
+
+using namespace std;
+
+const size_t sample_store::BLOCK;
+const size_t sample_store::GROUP;
+const size_t sample_store::CACHED;
+
+static_assert(sample_store::GROUP % 8 == 0,
+              "groups must pack to whole bytes");
+
+static inline uint32_t zigzag(int32_t v)
+{
+        return uint32_t(v) << 1 ^ uint32_t(v >> 31);
+}
+
+static inline int32_t unzigzag(uint32_t v)
+{
+        return int32_t(v >> 1) ^ -int32_t(v & 1);
+}
+
+// the error predicting s[i] from the order samples before it
+static inline int32_t residual(const int16_t *s, size_t i, unsigned order)
+{
+        switch (order) {
+        case 0:
+                return s[i];
+        case 1:
+                return s[i] - s[i - 1];
+        default:
+                return s[i] - 2*s[i - 1] + s[i - 2];
+        }
+}
+
+sample_store::sample_store()
+        : size_(0), clock_(0)
+{
+        size_t i;
+
+        pending_.reserve(BLOCK);
+        for (i = 0; i < CACHED; ++i) {
+                cache_[i].block = numeric_limits<size_t>::max();
+                cache_[i].used = 0;
+        }
+}
+
+void sample_store::push_back(int16_t sample)
+{
+        pending_.push_back(sample);
+        ++size_;
+        if (pending_.size() == BLOCK) {
+                encode(pending_.data(), BLOCK);
+                pending_.clear();
+        }
+}
+
+void sample_store::finish()
+{
+        if (!pending_.empty())
+                encode(pending_.data(), pending_.size());
+        vector<int16_t>().swap(pending_);
+        data_.shrink_to_fit();
+        offsets_.shrink_to_fit();
+}
+
+size_t sample_store::size() const
+{
+        return size_;
+}
+
+size_t sample_store::bytes() const
+{
+        return data_.capacity() + offsets_.capacity()*sizeof(size_t);
+}
+
+void sample_store::encode(const int16_t *s, size_t count)
+{
+        uint64_t cost[3] = {0, 0, 0}, bits;
+        unsigned order = 0, o, width, filled;
+        uint32_t group[GROUP], biggest;
+        size_t i, j, n;
+        uint8_t *p;
+
+        // predict however leaves the smallest errors
+        for (i = 2; i < count; ++i)
+                for (o = 0; o < 3; ++o)
+                        cost[o] += abs(residual(s, i, o));
+        for (o = 1; o < 3; ++o)
+                if (cost[o] < cost[order])
+                        order = o;
+
+        offsets_.push_back(data_.size());
+        data_.push_back(order);
+        for (i = 0; i < order; ++i) {
+                data_.push_back(uint16_t(s[i]));
+                data_.push_back(uint16_t(s[i]) >> 8);
+        }
+
+        for (i = order; i < count; i += GROUP) {
+                n = min(GROUP, count - i);
+                biggest = 0;
+                for (j = 0; j < GROUP; ++j) {
+                        group[j] = j < n ? zigzag(residual(s, i + j, order))
+                                : 0;
+                        biggest |= group[j];
+                }
+                width = biggest ? 32 - __builtin_clz(biggest) : 0;
+                data_.push_back(width);
+                data_.resize(data_.size() + GROUP*width/8);
+                p = &data_[data_.size() - GROUP*width/8];
+                bits = 0;
+                filled = 0;
+                for (j = 0; j < GROUP; ++j) {
+                        bits |= uint64_t(group[j]) << filled;
+                        for (filled += width; filled >= 8; filled -= 8) {
+                                *p++ = bits;
+                                bits >>= 8;
+                        }
+                }
+        }
+}
+
+void sample_store::decode(size_t block, int16_t *out) const
+{
+        const size_t count = min(BLOCK, size_ - block*BLOCK);
+        const uint8_t *p = &data_[offsets_[block]], *next;
+        const unsigned order = *p++;
+        unsigned width, filled;
+        uint64_t bits;
+        uint32_t mask;
+        int32_t r;
+        size_t i, j, n;
+
+        for (i = 0; i < order; ++i, p += 2)
+                out[i] = int16_t(p[0] | p[1] << 8);
+
+        for (i = order; i < count; i += GROUP) {
+                width = *p++;
+                mask = width ? ~0U >> (32 - width) : 0;
+                next = p + GROUP*width/8;
+                n = min(GROUP, count - i);
+                bits = 0;
+                filled = 0;
+                for (j = i; j < i + n; ++j) {
+                        for (; filled < width; filled += 8)
+                                bits |= uint64_t(*p++) << filled;
+                        r = unzigzag(bits & mask);
+                        bits >>= width;
+                        filled -= width;
+                        if (order == 1)
+                                r += out[j - 1];
+                        else if (order == 2)
+                                r += 2*out[j - 1] - out[j - 2];
+                        out[j] = r;
+                }
+                p = next;
+        }
+}
+
+const int16_t *sample_store::fetch(size_t block) const
+{
+        cached_block *victim = &cache_[0];
+        size_t i;
+
+        for (i = 0; i < CACHED; ++i) {
+                if (cache_[i].block == block) {
+                        cache_[i].used = ++clock_;
+                        return cache_[i].samples;
+                }
+                if (cache_[i].used < victim->used)
+                        victim = &cache_[i];
+        }
+        decode(block, victim->samples);
+        victim->block = block;
+        victim->used = ++clock_;
+        return victim->samples;
+}
+
+void sample_store::copy(size_t first, size_t count, float *out) const
+{
+        lock_guard<mutex> guard(lock_);
+        const int16_t *s;
+        size_t i, n;
+
+        while (count > 0) {
+                n = min(count, BLOCK - first % BLOCK);
+                s = fetch(first/BLOCK) + first % BLOCK;
+                for (i = 0; i < n; ++i)
+                        out[i] = s[i];
+                out += n;
+                first += n;
+                count -= n;
+        }
+}
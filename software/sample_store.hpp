@@ -0,0 +1,76 @@
+/**
+ * \file sample_store.hpp
+ *
+ * \brief Losslessly compressed 16 bit samples, for keeping long recordings
+ * in memory on boards without much of it.
+ *
+ * \detail Samples are compressed in blocks of BLOCK. Each block predicts
+ * every sample from the ones before it (not at all, from the last one, or
+ * by extending the line through the last two, whichever leaves smaller
+ * errors) and stores the errors bit packed, GROUP at a time, at the fewest
+ * bits that hold the biggest of each group. Music typically packs to about
+ * two thirds of its size; silence to next to nothing.
+ *
+ * Each block starts at a recorded offset and decodes on its own, so
+ * reading a range only decodes the blocks it touches. The last few decoded
+ * blocks are cached, since the generators read overlapping windows that
+ * creep through the song. Reading is safe from several threads at once.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+class sample_store {
+public:
+        static const size_t BLOCK = 4096;       // samples per block
+        static const size_t GROUP = 32;         // samples per bit width
+        static const size_t CACHED = 4;         // decoded blocks kept
+
+        sample_store();
+
+        sample_store(const sample_store&) = delete;
+        sample_store& operator=(const sample_store&) = delete;
+
+        // append a sample. Each block is compressed as it fills up.
+        void push_back(int16_t sample);
+
+        // compress whatever is left over, once every sample is in. Nothing
+        // can be read before this.
+        void finish();
+
+        // samples stored
+        size_t size() const;
+
+        // memory the compressed samples and block offsets take
+        size_t bytes() const;
+
+        // copy count samples from first on into out
+        void copy(size_t first, size_t count, float *out) const;
+
+private:
+        struct cached_block {
+                size_t block;
+                uint64_t used;
+                int16_t samples[BLOCK];
+        };
+
+        void encode(const int16_t *samples, size_t count);
+        void decode(size_t block, int16_t *out) const;
+
+        // the decoded samples of block, from the cache if they're there.
+        // Call with lock_ held.
+        const int16_t *fetch(size_t block) const;
+
+        std::vector<uint8_t> data_;
+        std::vector<size_t> offsets_;   // where each block starts in data_
+        std::vector<int16_t> pending_;  // the block being filled
+        size_t size_;
+
+        mutable std::mutex lock_;
+        mutable cached_block cache_[CACHED];
+        mutable uint64_t clock_;
+};
@@ -0,0 +1,131 @@
+/**
+ * \file sample_store_test.cpp
+ *
+ * \brief Tests for sample_store: everything comes back exactly, whatever
+ * the signal, length or range, from several threads at once, and a
+ * compressed wav_reader reads the same as a plain one in less memory.
+ * Reads AmpUp.wav, so run it from the software directory.
+ */
+
+#include "sample_store.hpp"
+#include "wav_reader.hpp"
+
+#include <cassert>
+#include <cmath>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <thread>
+#include <vector>
+
+using namespace std;
+using namespace chrono;
+
+// store n samples of signal(i) and check every sample and a spread of
+// ranges come back as they went in
+static void round_trip(size_t n, const function<int16_t(size_t)>& signal)
+{
+        const size_t B = sample_store::BLOCK;
+        const size_t ranges[][2] = {
+                {0, n}, {0, 1}, {n/2, n/4}, {B - 1, 2}, {B - 5, B + 10},
+                {n - 1, 1}, {3*B/2, 3*B}, {n/3, 0}
+        };
+        sample_store store;
+        vector<int16_t> in(n);
+        vector<float> out;
+        size_t i, r, first, count;
+
+        for (i = 0; i < n; ++i) {
+                in[i] = signal(i);
+                store.push_back(in[i]);
+        }
+        store.finish();
+        assert(store.size() == n);
+
+        for (r = 0; r < sizeof(ranges)/sizeof(*ranges); ++r) {
+                first = ranges[r][0];
+                count = ranges[r][1];
+                if (first > n || first + count > n)
+                        continue;
+                out.assign(count, 1e9);
+                store.copy(first, count, out.data());
+                for (i = 0; i < count; ++i)
+                        assert(out[i] == in[first + i]);
+        }
+}
+
+int main(void)
+{
+        const size_t B = sample_store::BLOCK;
+        minstd_rand random(7);
+        uniform_int_distribution<int> any(-32768, 32767);
+        vector<int16_t> noise(5*B + 17);
+        vector<float> whole;
+        vector<thread> readers;
+        microseconds at;
+        size_t i;
+
+        for (i = 0; i < noise.size(); ++i)
+                noise[i] = any(random);
+
+        round_trip(0, [](size_t) { return 0; });
+        round_trip(1, [](size_t) { return -32768; });
+        round_trip(2*B, [](size_t) { return 0; });
+        round_trip(noise.size(), [&](size_t i) { return noise[i]; });
+        round_trip(3*B + 31, [](size_t i) {
+                return int16_t(20000*sin(i*0.01));
+        });
+        // the biggest errors any predictor can see
+        round_trip(2*B + 1, [](size_t i) {
+                return int16_t(i % 2 ? 32767 : -32768);
+        });
+        round_trip(B + 3, [](size_t i) {
+                return int16_t(i % 3 ? 32767 : -32768);
+        });
+        round_trip(B, [](size_t i) { return int16_t(i*i); });
+
+        // silence packs to next to nothing
+        sample_store quiet;
+        for (i = 0; i < 100*B; ++i)
+                quiet.push_back(0);
+        quiet.finish();
+        assert(quiet.bytes() < 100*B/8);
+
+        // a compressed song reads the same as a plain one, in less room
+        wav_reader plain("AmpUp.wav", false);
+        wav_reader packed("AmpUp.wav", true);
+        assert(packed.size() == plain.size());
+        assert(packed.max_sample() == plain.max_sample());
+        assert(packed.sample_rate() == plain.sample_rate());
+        assert(packed.get_all_samples() == plain.get_all_samples());
+        assert(packed.sample_bytes() < plain.sample_bytes()*0.9);
+        assert(packed.get_range(seconds(1000), milliseconds(50)).empty());
+        for (at = microseconds(0); at < seconds(15); at += milliseconds(77))
+                assert(packed.get_range(at, milliseconds(50)) ==
+                       plain.get_range(at, milliseconds(50)));
+
+        // and the cache holds up with readers on several threads
+        sample_store shared;
+        whole = plain.get_all_samples();
+        for (float s : whole)
+                shared.push_back(s);
+        shared.finish();
+        for (i = 0; i < 4; ++i)
+                readers.emplace_back([&, i]() {
+                        vector<float> out(3000);
+                        size_t n, k, first;
+
+                        for (n = 0; n < 500; ++n) {
+                                first = (n*7919 + i*104729) %
+                                        (whole.size() - out.size());
+                                shared.copy(first, out.size(), out.data());
+                                for (k = 0; k < out.size(); ++k)
+                                        assert(out[k] == whole[first + k]);
+                        }
+                });
+        for (auto& t : readers)
+                t.join();
+
+        cout << "test passed" << endl;
+        return 0;
+}
@@ -7,39 +7,28 @@
 *       then calls all the helper code we have to play the song in the
 *       wave file specified by the file name, generate the visualization
 *       frames for the song being played, and send the visualization frames
-*       over to an FPGA via the serial interface.
+*       over to an FPGA via the serial interface. See player.hpp for the
+*       options to send frames over the network instead.
 *
 */
 
-#include "system_constants.hpp"
 #include "frame.hpp"
-#include "piHelpers.h"
-
-#include <algorithm>
-#include <iostream>
+#include "player.hpp"
 
 using namespace std;
 
 int main (int argc, char** argv) 
 {
     scrolling_fft_generator gen;
-        
-    if (argc != 2) {
-        cout << "usage: ./scrolling_fft filename.wav"
-             << endl;
-        return 1;
-    }
+    player_options opts;
 
-    // set up the Pi's peripherals, including an 8MHz SPI clock
-    pioInit();
-    pTimerInit();
-    spiInit(7812000, 0);
+    if (!parse_player_args(argc, argv, opts))
+        return 1;
 
-    // reset the display before trying to display anything
-    pinMode(RESET_PIN, OUTPUT);
-    digitalWrite(RESET_PIN, 1);
-    digitalWrite(RESET_PIN, 0);
+    if (opts.use_spi)
+        init_display();
+    attach_sinks(opts, gen);
 
-    gen.play_song(argv[1]);
+    gen.play_song(opts.song);
     return 0;
 }
@@ -0,0 +1,279 @@
+/**
+ * \file spi_wall.cpp
+ *
+ * \brief Multi-controller SPI frame sink implementation.
+ */
+
+#include "spi_wall.hpp"
+#include "metrics.hpp"
+#include "rt_config.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <linux/spi/spidev.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+using namespace std;
+using namespace chrono;
+
+// open and configure one spidev device the way init_display sets up SPI0:
+// mode 0, 8 bit words
+static int open_spidev(const string& device, uint32_t speed_hz)
+{
+        uint8_t mode = SPI_MODE_0, bits = 8;
+        string err;
+        int fd;
+
+        fd = open(device.c_str(), O_RDWR);
+        if (fd < 0)
+                throw runtime_error("spi_wall_sink: " + device + ": " +
+                                    strerror(errno));
+        if (ioctl(fd, SPI_IOC_WR_MODE, &mode) < 0)
+                err = "SPI_IOC_WR_MODE";
+        else if (ioctl(fd, SPI_IOC_WR_BITS_PER_WORD, &bits) < 0)
+                err = "SPI_IOC_WR_BITS_PER_WORD";
+        else if (ioctl(fd, SPI_IOC_WR_MAX_SPEED_HZ, &speed_hz) < 0)
+                err = "SPI_IOC_WR_MAX_SPEED_HZ";
+        if (!err.empty()) {
+                err = "spi_wall_sink: " + device + ": " + err + ": " +
+                        strerror(errno);
+                close(fd);
+                throw runtime_error(err);
+        }
+        return fd;
+}
+
+wall_frame::wall_frame(size_t panels)
+        : panels_(panels)
+{}
+
+size_t wall_frame::panels() const
+{
+        return panels_.size();
+}
+
+frame& wall_frame::panel(size_t p)
+{
+        return panels_.at(p);
+}
+
+const frame& wall_frame::panel(size_t p) const
+{
+        return panels_.at(p);
+}
+
+pixel& wall_frame::at(size_t x, size_t y)
+{
+        return panels_.at(y/frame::HEIGHT).at(x, y % frame::HEIGHT);
+}
+
+const pixel& wall_frame::at(size_t x, size_t y) const
+{
+        return panels_.at(y/frame::HEIGHT).at(x, y % frame::HEIGHT);
+}
+
+spi_wall_sink::spi_wall_sink(const vector<string>& devices, layout how,
+                             uint32_t speed_hz)
+        : speed_hz_(speed_hz), layout_(how), stretched_(devices.size()),
+          generation_(0), pending_(0), quit_(false), errors_(0),
+          last_write_time_(0)
+{
+        size_t c;
+
+        if (devices.empty())
+                throw runtime_error("spi_wall_sink: no devices");
+
+        channels_.resize(devices.size());
+        try {
+                for (c = 0; c < devices.size(); ++c) {
+                        channels_[c].device = devices[c];
+                        channels_[c].fd = open_spidev(devices[c], speed_hz);
+                }
+        } catch (...) {
+                while (c-- > 0)
+                        close(channels_[c].fd);
+                throw;
+        }
+        start(devices.size());
+}
+
+spi_wall_sink::spi_wall_sink(size_t n, layout how)
+        : speed_hz_(0), layout_(how), stretched_(n), generation_(0),
+          pending_(0), quit_(false), errors_(0), last_write_time_(0)
+{
+        size_t c;
+
+        if (n == 0)
+                throw runtime_error("spi_wall_sink: no channels");
+        channels_.resize(n);
+        for (c = 0; c < n; ++c) {
+                channels_[c].fd = -1;
+                channels_[c].device = "channel" + to_string(c);
+        }
+        start(n);
+}
+
+spi_wall_sink::~spi_wall_sink()
+{
+        shutdown();
+        for (channel& ch : channels_)
+                if (ch.fd >= 0)
+                        close(ch.fd);
+}
+
+void spi_wall_sink::start(size_t n)
+{
+        size_t c;
+
+        for (c = 0; c < n; ++c) {
+                channels_[c].source = NULL;
+                channels_[c].shown = false;
+        }
+        for (c = 0; c < n; ++c)
+                channels_[c].worker = thread(&spi_wall_sink::run, this, c);
+}
+
+void spi_wall_sink::shutdown()
+{
+        {
+                lock_guard<mutex> guard(lock_);
+                if (quit_)
+                        return;
+                quit_ = true;
+        }
+        work_.notify_all();
+        for (channel& ch : channels_)
+                ch.worker.join();
+}
+
+void spi_wall_sink::write(const frame& f)
+{
+        const size_t n = channels_.size();
+        size_t x, y;
+
+        if (layout_ == SPLIT) {
+                // nearest row, so each row of f covers n rows of the wall
+                for (y = 0; y < n*frame::HEIGHT; ++y)
+                        for (x = 0; x < frame::WIDTH; ++x)
+                                stretched_.at(x, y) = f.at(x, y/n);
+                write(stretched_);
+                return;
+        }
+        for (channel& ch : channels_)
+                ch.source = &f;
+        send();
+}
+
+void spi_wall_sink::write(const wall_frame& wall)
+{
+        size_t c;
+
+        if (wall.panels() != channels_.size())
+                throw runtime_error("spi_wall_sink: " +
+                                    to_string(wall.panels()) + " panels for " +
+                                    to_string(channels_.size()) +
+                                    " channels");
+        for (c = 0; c < channels_.size(); ++c)
+                channels_[c].source = &wall.panel(c);
+        send();
+}
+
+void spi_wall_sink::send()
+{
+        const auto start = steady_clock::now();
+
+        // the channels only look at their source between here and
+        // pending_ reaching 0
+        unique_lock<mutex> guard(lock_);
+        ++generation_;
+        pending_ = channels_.size();
+        work_.notify_all();
+        done_.wait(guard, [this]() { return pending_ == 0; });
+        last_write_time_ = steady_clock::now() - start;
+}
+
+void spi_wall_sink::run(size_t c)
+{
+        channel& ch = channels_[c];
+        metrics_registry& r = metrics_registry::global();
+        const string labels = "device=\"" + ch.device + "\"";
+        metric_counter& bytes = r.counter(
+                "musicvis_spi_wall_bytes_total",
+                "Bytes written to each SPI channel of a panel wall.", labels);
+        metric_counter& skipped = r.counter(
+                "musicvis_spi_wall_frames_skipped_total",
+                "Frames not sent because the panel already showed them.",
+                labels);
+        metric_latency& send = r.latency(
+                "musicvis_spi_wall_send_seconds",
+                "Time to send one frame on each SPI channel.", labels);
+        steady_clock::time_point t;
+        uint64_t seen = 0;
+
+        // a channel is output, just like the thread that hands it frames
+        apply_role_policy(OUTPUT_THREAD);
+
+        for (;;) {
+                {
+                        unique_lock<mutex> guard(lock_);
+                        work_.wait(guard, [&]() {
+                                return quit_ || generation_ != seen;
+                        });
+                        if (quit_)
+                                return;
+                        seen = generation_;
+                }
+
+                ch.source->pack(ch.packed);
+                if (ch.shown && ch.packed == ch.last) {
+                        skipped.add(1);
+                } else {
+                        t = steady_clock::now();
+                        ch.shown = transfer(c, ch.packed.data(),
+                                            ch.packed.size());
+                        if (ch.shown) {
+                                ch.last = ch.packed;
+                                bytes.add(ch.packed.size());
+                        } else {
+                                ++errors_;
+                        }
+                        send.observe(steady_clock::now() - t);
+                }
+
+                lock_guard<mutex> guard(lock_);
+                if (--pending_ == 0)
+                        done_.notify_one();
+        }
+}
+
+bool spi_wall_sink::transfer(size_t c, const uint8_t *data, size_t len)
+{
+        spi_ioc_transfer tr;
+
+        memset(&tr, 0, sizeof tr);
+        tr.tx_buf = (unsigned long)data;
+        tr.len = len;
+        tr.speed_hz = speed_hz_;
+        tr.bits_per_word = 8;
+        return ioctl(channels_[c].fd, SPI_IOC_MESSAGE(1), &tr) >= 0;
+}
+
+size_t spi_wall_sink::channel_count() const
+{
+        return channels_.size();
+}
+
+nanoseconds spi_wall_sink::last_write_time() const
+{
+        return last_write_time_;
+}
+
+size_t spi_wall_sink::errors() const
+{
+        return errors_;
+}
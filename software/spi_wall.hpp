@@ -0,0 +1,134 @@
+/**
+ * \file spi_wall.hpp
+ *
+ * \brief Frame sink for walls of panels on several SPI controllers at
+ * once, e.g. SPI0 and SPI1 on a Pi, or SPI0 to SPI6 on a Pi 4.
+ *
+ * \detail The FPGA's frame_reader (hardware/ledDriver2.sv) takes 1024
+ * pixels, frame::PACKED_SIZE bytes, per frame and has no framing to find
+ * where a frame starts, so anything shorter would leave its write address
+ * out of step for good. So each channel always sends its panel a whole
+ * packed frame in one transfer.
+ *
+ * A wall_frame holds one panel per channel, stacked top to bottom. A
+ * plain frame, which is what generators make, is either shown on every
+ * panel (MIRROR) or stretched down the whole wall (SPLIT), so with two
+ * panels the top one shows the top 16 rows, each twice. Each channel packs and sends its
+ * panel on its own thread through the kernel's spidev driver, so the
+ * controllers run concurrently and a wall takes as long as one panel.
+ * write returns once every channel is done. Like frame::write, a channel
+ * skips a frame its panel already shows.
+ *
+ * frame::write drives SPI0 directly through /dev/mem, so don't use it and
+ * an spidev0.x channel together.
+ */
+
+#pragma once
+
+#include "frame.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// a wall of panels, one per channel, stacked top to bottom
+class wall_frame {
+public:
+        explicit wall_frame(size_t panels);
+
+        size_t panels() const;
+
+        frame& panel(size_t p);
+        const frame& panel(size_t p) const;
+
+        // x from the left, y from the top of the whole wall
+        pixel& at(size_t x, size_t y);
+        const pixel& at(size_t x, size_t y) const;
+
+private:
+        std::vector<frame> panels_;
+};
+
+class spi_wall_sink : public frame_sink {
+public:
+        // what write(const frame&) shows
+        enum layout { MIRROR, SPLIT };
+
+        // one channel per device (e.g. "/dev/spidev0.0"), all at speed_hz.
+        // Throws std::runtime_error if a device can't be set up.
+        explicit spi_wall_sink(const std::vector<std::string>& devices,
+                               layout how = MIRROR,
+                               uint32_t speed_hz = 7812000);
+        ~spi_wall_sink();
+
+        spi_wall_sink(const spi_wall_sink&) = delete;
+        spi_wall_sink& operator=(const spi_wall_sink&) = delete;
+
+        // show f on every panel, or across the wall, as the layout says
+        void write(const frame& f);
+
+        // show each panel of wall on its channel. Throws
+        // std::runtime_error if wall doesn't have a panel per channel.
+        void write(const wall_frame& wall);
+
+        size_t channel_count() const;
+
+        // wall clock time the most recent write took, all channels
+        std::chrono::nanoseconds last_write_time() const;
+
+        // transfers the driver refused
+        size_t errors() const;
+
+protected:
+        // for tests and other transports: n channels, no devices opened
+        explicit spi_wall_sink(size_t n, layout how = MIRROR);
+
+        // send one packed panel frame. Called on channel's own thread.
+        // Returns false on failure.
+        virtual bool transfer(size_t channel, const uint8_t *data,
+                              size_t len);
+
+        // stop the channel threads. Subclasses overriding transfer must
+        // call this in their destructor, before their members go away.
+        void shutdown();
+
+private:
+        struct channel {
+                int fd;
+                std::string device;
+                const frame *source;    // what to show, during a write
+                frame::packed packed;
+                frame::packed last;     // what the panel shows
+                bool shown;             // whether last is valid
+                std::thread worker;
+        };
+
+        void start(size_t n);
+        void run(size_t c);
+
+        // hand each channel its source and wait for them all
+        void send();
+
+        uint32_t speed_hz_;
+        layout layout_;
+        std::vector<channel> channels_;
+
+        // a SPLIT frame stretched over the wall
+        wall_frame stretched_;
+
+        // write hands out frames by bumping generation_; each channel
+        // sends its panel and counts pending_ down
+        std::mutex lock_;
+        std::condition_variable work_, done_;
+        uint64_t generation_;
+        size_t pending_;
+        bool quit_;
+
+        std::atomic<size_t> errors_;
+        std::chrono::nanoseconds last_write_time_;
+};
@@ -0,0 +1,155 @@
+/**
+ * \file spi_wall_test.cpp
+ *
+ * \brief Tests for spi_wall_sink. A subclass that records what each
+ * channel was sent, and takes a while doing it, stands in for the spidev
+ * devices; we check every transfer is a whole packed panel frame, that
+ * each panel gets its own picture, or its part of a split frame, that
+ * the channels run at the same time, and that their metrics render as one
+ * group per name.
+ */
+
+#include "spi_wall.hpp"
+#include "metrics.hpp"
+
+#include <cassert>
+#include <iostream>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
+using namespace std;
+using namespace chrono;
+
+static const milliseconds SEND_TIME(20);
+
+class fake_wall : public spi_wall_sink {
+public:
+        explicit fake_wall(size_t n, layout how = MIRROR)
+                : spi_wall_sink(n, how), sent(n), sends(n, 0)
+        {}
+
+        ~fake_wall()
+        {
+                shutdown();
+        }
+
+        // the last transfer and the number of transfers on each channel
+        vector<frame::packed> sent;
+        vector<size_t> sends;
+
+        size_t total() const
+        {
+                size_t t = 0;
+
+                for (size_t s : sends)
+                        t += s;
+                return t;
+        }
+
+protected:
+        bool transfer(size_t channel, const uint8_t *data, size_t len)
+        {
+                this_thread::sleep_for(SEND_TIME);
+                lock_guard<mutex> guard(lock_);
+                // the FPGA only understands whole frames
+                assert(len == frame::PACKED_SIZE);
+                copy(data, data + len, sent[channel].begin());
+                ++sends[channel];
+                return true;
+        }
+
+private:
+        mutex lock_;
+};
+
+int main(void)
+{
+        frame::packed want;
+        frame f;
+        size_t i, c;
+
+        for (size_t n : { 1, 2, 3, 4 }) {
+                fake_wall wall(n);
+                wall_frame big(n);
+                assert(wall.channel_count() == n);
+                for (i = 0; i < f.size(); ++i)
+                        f[i] = pixel(i, 3*i, 7*i);
+
+                // every panel gets the whole frame, all at once
+                wall.write(f);
+                f.pack(want);
+                for (c = 0; c < n; ++c) {
+                        assert(wall.sent[c] == want);
+                        assert(wall.sends[c] == 1);
+                }
+                assert(wall.last_write_time() < SEND_TIME*2);
+                assert(wall.errors() == 0);
+
+                // nothing changed, nothing sent
+                wall.write(f);
+                assert(wall.total() == n);
+
+                // a wall sized frame puts each panel on its own channel
+                for (i = 0; i < frame::WIDTH; ++i)
+                        for (c = 0; c < n*frame::HEIGHT; ++c)
+                                big.at(i, c) = pixel(i, c, 1);
+                wall.write(big);
+                for (c = 0; c < n; ++c) {
+                        big.panel(c).pack(want);
+                        assert(wall.sent[c] == want);
+                        assert(wall.sends[c] == 2);
+                }
+                assert(big.panel(n - 1).at(3, frame::HEIGHT - 1).green() ==
+                       uint8_t(n*frame::HEIGHT - 1));
+
+                // a change to the last panel only goes to its channel
+                big.at(5, n*frame::HEIGHT - 1) = pixel(255, 255, 255);
+                wall.write(big);
+                big.panel(n - 1).pack(want);
+                assert(wall.sent[n - 1] == want);
+                assert(wall.sends[n - 1] == 3);
+                assert(wall.total() == 2*n + 1);
+
+                // and the panels have to match the channels
+                try {
+                        wall.write(wall_frame(n + 1));
+                        assert(false);
+                } catch (const runtime_error&) {
+                }
+        }
+
+        // a split wall stretches a frame over its panels, top first
+        {
+                fake_wall split(2, spi_wall_sink::SPLIT);
+                frame top, bottom;
+                for (i = 0; i < f.size(); ++i)
+                        f[i] = pixel(16*(i % 16), i/8, 255 - i/4);
+                split.write(f);
+                for (i = 0; i < frame::WIDTH; ++i) {
+                        for (c = 0; c < frame::HEIGHT; ++c) {
+                                top.at(i, c) = f.at(i, c/2);
+                                bottom.at(i, c) =
+                                        f.at(i, (c + frame::HEIGHT)/2);
+                        }
+                }
+                top.pack(want);
+                assert(split.sent[0] == want);
+                bottom.pack(want);
+                assert(split.sent[1] == want);
+                assert(split.sends[0] == 1 && split.sends[1] == 1);
+        }
+
+        // every channel registers its own series of the same metrics,
+        // from its own thread; each name still gets one TYPE line
+        {
+                const string text = metrics_registry::global().render();
+                const string type = "# TYPE musicvis_spi_wall_bytes_total";
+                size_t at = text.find(type);
+                assert(at != string::npos);
+                assert(text.find(type, at + 1) == string::npos);
+        }
+
+        cout << "test passed" << endl;
+        return 0;
+}
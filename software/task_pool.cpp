@@ -0,0 +1,285 @@
+/**
+ * \file task_pool.cpp
+ *
+ * \brief Work stealing task pool implementation.
+ */
+
+#include "task_pool.hpp"
+
+#include <algorithm>
+
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+using namespace std;
+
+// which worker of which pool the current thread is, if any
+static thread_local const task_pool *current_pool = nullptr;
+static thread_local unsigned current_worker = 0;
+
+// settings for the global pool, fixed once it's created
+static mutex global_lock;
+static bool global_created = false;
+static unsigned global_threads = 0;
+static int global_reserved_cpu = -1;
+static function<void()> global_worker_init;
+
+static unsigned online_cpus()
+{
+        long n = sysconf(_SC_NPROCESSORS_ONLN);
+        return n > 0 ? n : 1;
+}
+
+task_pool::task_pool(unsigned threads, int reserved_cpu,
+                     function<void()> worker_init)
+        : reserved_cpu_(-1), worker_init_(move(worker_init)), queued_(0),
+          next_(0), stop_(false)
+{
+        const unsigned cpus = online_cpus();
+        unsigned i;
+
+        // reserving the only core would leave the workers nowhere to run
+        if (reserved_cpu >= 0 && unsigned(reserved_cpu) < cpus && cpus > 1)
+                reserved_cpu_ = reserved_cpu;
+
+        if (threads == 0)
+                threads = max(1U, cpus - (reserved_cpu_ >= 0 ? 1 : 0));
+
+        for (i = 0; i < threads; ++i)
+                workers_.emplace_back(new worker);
+        for (i = 0; i < threads; ++i)
+                threads_.emplace_back(&task_pool::worker_loop, this, i);
+}
+
+task_pool::~task_pool()
+{
+        {
+                lock_guard<mutex> lock(sleep_lock_);
+                stop_ = true;
+        }
+        wake_.notify_all();
+        for (thread& t : threads_)
+                t.join();
+}
+
+task_pool& task_pool::global()
+{
+        static task_pool *pool = [] {
+                lock_guard<mutex> lock(global_lock);
+                global_created = true;
+                return new task_pool(global_threads, global_reserved_cpu,
+                                     global_worker_init);
+        }();
+        return *pool;
+}
+
+bool task_pool::configure(unsigned threads, int reserved_cpu,
+                          function<void()> worker_init)
+{
+        lock_guard<mutex> lock(global_lock);
+
+        if (global_created)
+                return false;
+        global_threads = threads;
+        global_reserved_cpu = reserved_cpu;
+        global_worker_init = move(worker_init);
+        return true;
+}
+
+unsigned task_pool::size() const
+{
+        return workers_.size();
+}
+
+int task_pool::reserved_cpu() const
+{
+        return reserved_cpu_;
+}
+
+void task_pool::submit(function<void()> task)
+{
+        unsigned w;
+
+        // workers keep their own tasks close; everyone else deals round
+        // robin so the load starts out spread
+        if (current_pool == this)
+                w = current_worker;
+        else
+                w = next_.fetch_add(1, memory_order_relaxed) % workers_.size();
+
+        {
+                lock_guard<mutex> lock(workers_[w]->lock);
+                workers_[w]->tasks.push_back(move(task));
+        }
+        queued_.fetch_add(1, memory_order_release);
+
+        // take the lock so a worker can't miss the wakeup between checking
+        // queued_ and going to sleep
+        { lock_guard<mutex> lock(sleep_lock_); }
+        wake_.notify_one();
+}
+
+bool task_pool::take(unsigned self, function<void()>& task)
+{
+        const unsigned n = workers_.size();
+        unsigned i;
+
+        if (queued_.load(memory_order_acquire) == 0)
+                return false;
+
+        // our own work, newest first
+        if (self < n) {
+                worker& w = *workers_[self];
+                lock_guard<mutex> lock(w.lock);
+                if (!w.tasks.empty()) {
+                        task = move(w.tasks.back());
+                        w.tasks.pop_back();
+                        queued_.fetch_sub(1, memory_order_relaxed);
+                        return true;
+                }
+        }
+
+        // steal someone else's oldest
+        for (i = 1; i <= n; ++i) {
+                worker& w = *workers_[(self + i) % n];
+                lock_guard<mutex> lock(w.lock);
+                if (!w.tasks.empty()) {
+                        task = move(w.tasks.front());
+                        w.tasks.pop_front();
+                        queued_.fetch_sub(1, memory_order_relaxed);
+                        return true;
+                }
+        }
+        return false;
+}
+
+bool task_pool::run_one()
+{
+        unsigned self = current_pool == this ? current_worker : size();
+        function<void()> task;
+
+        if (!take(self, task))
+                return false;
+        task();
+        return true;
+}
+
+void task_pool::worker_loop(unsigned self)
+{
+        const unsigned cpus = online_cpus();
+        function<void()> task;
+        cpu_set_t others;
+        unsigned cpu;
+
+        current_pool = this;
+        current_worker = self;
+
+        // stay off the reserved core. worker_init runs after so it can
+        // narrow that down further.
+        if (reserved_cpu_ >= 0) {
+                CPU_ZERO(&others);
+                for (cpu = 0; cpu < cpus; ++cpu)
+                        if (int(cpu) != reserved_cpu_)
+                                CPU_SET(cpu, &others);
+                pthread_setaffinity_np(pthread_self(), sizeof others, &others);
+        }
+        if (worker_init_)
+                worker_init_();
+
+        for (;;) {
+                if (take(self, task)) {
+                        task();
+                        task = nullptr;
+                        continue;
+                }
+
+                unique_lock<mutex> lock(sleep_lock_);
+                wake_.wait(lock, [this]() {
+                        return stop_ || queued_.load() > 0;
+                });
+                if (stop_)
+                        return;
+        }
+}
+
+void task_pool::parallel_for(size_t begin, size_t end, size_t grain,
+                             const function<void(size_t, size_t)>& body)
+{
+        task_group group(*this);
+        size_t first;
+
+        if (begin >= end)
+                return;
+        if (grain == 0)
+                grain = max<size_t>(1, (end - begin) / (4*size()));
+
+        for (first = begin; first < end; first += grain) {
+                size_t last = min(end, first + grain);
+                group.run([&body, first, last]() { body(first, last); });
+        }
+        group.wait();
+}
+
+task_group::task_group(task_pool& pool)
+        : pool_(pool), outstanding_(0)
+{}
+
+task_group::~task_group()
+{
+        try {
+                wait();
+        } catch (...) {
+        }
+}
+
+void task_group::run(function<void()> task)
+{
+        {
+                lock_guard<mutex> lock(lock_);
+                ++outstanding_;
+        }
+        pool_.submit([this, task]() {
+                exception_ptr error;
+
+                try {
+                        task();
+                } catch (...) {
+                        error = current_exception();
+                }
+
+                lock_guard<mutex> lock(lock_);
+                if (error && !error_)
+                        error_ = error;
+                if (--outstanding_ == 0)
+                        done_.notify_all();
+        });
+}
+
+void task_group::wait()
+{
+        exception_ptr error;
+
+        // help out rather than just block; our tasks may be queued behind
+        // others, or nested inside the task that's waiting. Only sleep
+        // briefly in case more work shows up that we could help with.
+        for (;;) {
+                {
+                        lock_guard<mutex> lock(lock_);
+                        if (outstanding_ == 0)
+                                break;
+                }
+                if (pool_.run_one())
+                        continue;
+
+                unique_lock<mutex> lock(lock_);
+                done_.wait_for(lock, chrono::milliseconds(1), [this]() {
+                        return outstanding_ == 0;
+                });
+        }
+
+        lock_guard<mutex> lock(lock_);
+        swap(error, error_);
+        if (error)
+                rethrow_exception(error);
+}
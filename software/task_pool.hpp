@@ -0,0 +1,121 @@
+/**
+ * \file task_pool.hpp
+ *
+ * \brief One pool of worker threads for all the background work (analysis,
+ * export, ...), so separate features don't each spin up their own threads
+ * and fight over the cores.
+ *
+ * \detail Every worker has its own deque of tasks. A worker pushes and
+ * pops at the back of its own deque, so nested work stays hot in its
+ * cache, and when it runs dry it steals from the front of the others'.
+ * Tasks submitted from outside the pool are dealt out round robin.
+ *
+ * The pool can keep one CPU to itself: its workers are pinned to every
+ * other core, leaving the reserved one for play_song's output thread so
+ * background work never takes cycles from frame output.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class task_pool {
+public:
+        // threads == 0 means one per core (minus the reserved core, if
+        // any). reserved_cpu < 0 means don't reserve a core. Each worker
+        // calls worker_init, if given, before taking any tasks (e.g. to
+        // set its scheduling policy).
+        explicit task_pool(unsigned threads = 0, int reserved_cpu = -1,
+                           std::function<void()> worker_init = nullptr);
+        ~task_pool();
+
+        task_pool(const task_pool&) = delete;
+        task_pool& operator=(const task_pool&) = delete;
+
+        // the process wide pool, created on first use with the settings
+        // from configure()
+        static task_pool& global();
+
+        // set up the global pool. Returns false if it already exists.
+        static bool configure(unsigned threads, int reserved_cpu = -1,
+                              std::function<void()> worker_init = nullptr);
+
+        // queue a task. Prefer task_group, which can wait for it.
+        void submit(std::function<void()> task);
+
+        // run one queued task on the calling thread, if there is one.
+        // Used by threads waiting on work in the pool so they help out
+        // instead of blocking it.
+        bool run_one();
+
+        // call body(first, last) over [begin, end) split into chunks of
+        // about grain indices, and wait for all of them. grain == 0 picks
+        // a chunk size that gives each worker a few chunks.
+        void parallel_for(size_t begin, size_t end, size_t grain,
+                          const std::function<void(size_t, size_t)>& body);
+
+        unsigned size() const;
+        int reserved_cpu() const;
+
+private:
+        struct worker {
+                std::mutex lock;
+                std::deque<std::function<void()>> tasks;
+        };
+
+        void worker_loop(unsigned self);
+
+        // take a task, from worker self's own deque first if self is a
+        // worker of this pool
+        bool take(unsigned self, std::function<void()>& task);
+
+        std::vector<std::unique_ptr<worker>> workers_;
+        std::vector<std::thread> threads_;
+        int reserved_cpu_;
+        std::function<void()> worker_init_;
+
+        std::atomic<size_t> queued_;
+        std::atomic<unsigned> next_;
+        std::mutex sleep_lock_;
+        std::condition_variable wake_;
+        bool stop_;
+};
+
+// a set of tasks that can be waited on together. Waiting runs queued pool
+// tasks rather than blocking, so groups can nest inside pool tasks.
+class task_group {
+public:
+        explicit task_group(task_pool& pool = task_pool::global());
+
+        // waits for outstanding tasks, swallowing their exceptions
+        ~task_group();
+
+        task_group(const task_group&) = delete;
+        task_group& operator=(const task_group&) = delete;
+
+        void run(std::function<void()> task);
+
+        // wait for every task run so far, then rethrow the first
+        // exception any of them threw
+        void wait();
+
+private:
+        task_pool& pool_;
+
+        // tasks finishing take lock_ to update these, so once wait() has
+        // seen outstanding_ hit zero under the lock no task will touch
+        // the group again
+        std::mutex lock_;
+        std::condition_variable done_;
+        size_t outstanding_;
+        std::exception_ptr error_;
+};
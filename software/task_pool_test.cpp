@@ -0,0 +1,74 @@
+/**
+ * \file task_pool_test.cpp
+ *
+ * \brief Some small tests for task_pool and task_group.
+ */
+
+#include "task_pool.hpp"
+
+#include <cassert>
+#include <iostream>
+#include <numeric>
+#include <stdexcept>
+#include <vector>
+
+using namespace std;
+
+int main(void)
+{
+        task_pool pool(4);
+        vector<uint64_t> data(1 << 20);
+        atomic<uint64_t> sum(0);
+        atomic<unsigned> leaves(0);
+        bool caught = false;
+
+        // parallel_for covers every index exactly once
+        iota(data.begin(), data.end(), 0);
+        pool.parallel_for(0, data.size(), 0, [&](size_t first, size_t last) {
+                uint64_t s = 0;
+                for (size_t i = first; i < last; ++i)
+                        s += data[i];
+                sum += s;
+        });
+        assert(sum == uint64_t(data.size())*(data.size() - 1)/2);
+
+        // nested groups: all the tasks are spawned from one worker, so the
+        // others only get them by stealing, and the waits inside tasks
+        // must help rather than block
+        task_group outer(pool);
+        outer.run([&]() {
+                task_group inner(pool);
+                for (int i = 0; i < 64; ++i)
+                        inner.run([&]() {
+                                task_group leaf(pool);
+                                for (int j = 0; j < 16; ++j)
+                                        leaf.run([&]() { ++leaves; });
+                                leaf.wait();
+                        });
+                inner.wait();
+        });
+        outer.wait();
+        assert(leaves == 64*16);
+
+        // the first exception a task throws comes out of wait
+        task_group failing(pool);
+        for (int i = 0; i < 8; ++i)
+                failing.run([i]() {
+                        if (i == 5)
+                                throw runtime_error("task failed");
+                });
+        try {
+                failing.wait();
+        } catch (const runtime_error&) {
+                caught = true;
+        }
+        assert(caught);
+
+        // a reserved CPU is only honoured if there's another one left
+        task_pool reserved(2, 0);
+        assert(reserved.size() == 2);
+        assert(reserved.reserved_cpu() ==
+               (thread::hardware_concurrency() > 1 ? 0 : -1));
+
+        cout << "test passed" << endl;
+}
@@ -0,0 +1,169 @@
+/**
+ * \file video_export.cpp
+ *
+ * \brief LED styled video export implementation.
+ */
+
+#include "video_export.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+using namespace std;
+
+// brightness of a point d pixels from the center of a dot of radius r:
+// an antialiased disc that is a little brighter in the middle, like a
+// diffused LED
+static float dot(float d, float r)
+{
+        float edge = min(max(r + 0.5f - d, 0.0f), 1.0f);
+        return edge*(1 - 0.25f*(d/r)*(d/r));
+}
+
+video_exporter::video_exporter(unsigned size, format fmt,
+                               unsigned frame_rate, task_pool& pool)
+        : size_(size), cell_(size/frame::WIDTH), fmt_(fmt),
+          frame_rate_(frame_rate), pool_(pool)
+{
+        const float r = 0.42*cell_;
+        const float c = (cell_ - 1)/2.0;
+        unsigned x, y, half = cell_/2;
+        float w;
+
+        if (size == 0 || size % frame::WIDTH != 0 ||
+            (fmt == Y4M && cell_ % 2 != 0))
+                throw invalid_argument("video_exporter: bad output size");
+
+        sprite_.resize(cell_*cell_);
+        for (y = 0; y < cell_; ++y)
+                for (x = 0; x < cell_; ++x)
+                        sprite_[y*cell_ + x] = 256*dot(hypot(x - c, y - c), r);
+
+        // average each 2x2 block for the subsampled chroma planes
+        chroma_sprite_.resize(half*half);
+        for (y = 0; y < half; ++y) {
+                for (x = 0; x < half; ++x) {
+                        w = sprite_[2*y*cell_ + 2*x] +
+                            sprite_[2*y*cell_ + 2*x + 1] +
+                            sprite_[(2*y + 1)*cell_ + 2*x] +
+                            sprite_[(2*y + 1)*cell_ + 2*x + 1];
+                        chroma_sprite_[y*half + x] = w/4;
+                }
+        }
+}
+
+size_t video_exporter::frame_bytes() const
+{
+        return fmt_ == Y4M ? size_*size_*3/2 : size_*size_*3;
+}
+
+bool video_exporter::write_header(FILE *out)
+{
+        if (fmt_ == RGB)
+                return true;
+        return fprintf(out, "YUV4MPEG2 W%u H%u F%u:1 Ip A1:1 C420jpeg\n",
+                       size_, size_, frame_rate_) > 0;
+}
+
+void video_exporter::upscale(const frame& f, uint8_t *buf) const
+{
+        if (fmt_ == Y4M)
+                upscale_y4m(f, buf);
+        else
+                upscale_rgb(f, buf);
+}
+
+void video_exporter::upscale_y4m(const frame& f, uint8_t *buf) const
+{
+        const unsigned half = cell_/2;
+        int y_led[frame::WIDTH], u_led[frame::WIDTH], v_led[frame::WIDTH];
+        uint8_t *y_plane = buf;
+        uint8_t *u_plane = y_plane + size_*size_;
+        uint8_t *v_plane = u_plane + size_*size_/4;
+        unsigned lx, ly, row, col;
+        const uint16_t *w;
+        uint8_t *yp, *up, *vp;
+
+        for (ly = 0; ly < frame::HEIGHT; ++ly) {
+                // full range BT.601, as C420jpeg expects. u and v are kept
+                // centered on zero so the sprite can scale them.
+                for (lx = 0; lx < frame::WIDTH; ++lx) {
+                        const pixel& p = f.at(lx, ly);
+                        y_led[lx] = 0.299*p.red() + 0.587*p.green() +
+                                0.114*p.blue();
+                        u_led[lx] = -0.168736*p.red() - 0.331264*p.green() +
+                                0.5*p.blue();
+                        v_led[lx] = 0.5*p.red() - 0.418688*p.green() -
+                                0.081312*p.blue();
+                }
+
+                for (row = 0; row < cell_; ++row) {
+                        yp = y_plane + (ly*cell_ + row)*size_;
+                        w = &sprite_[row*cell_];
+                        for (lx = 0; lx < frame::WIDTH; ++lx)
+                                for (col = 0; col < cell_; ++col)
+                                        *yp++ = (y_led[lx]*w[col]) >> 8;
+                }
+
+                for (row = 0; row < half; ++row) {
+                        up = u_plane + (ly*half + row)*(size_/2);
+                        vp = v_plane + (ly*half + row)*(size_/2);
+                        w = &chroma_sprite_[row*half];
+                        for (lx = 0; lx < frame::WIDTH; ++lx) {
+                                for (col = 0; col < half; ++col) {
+                                        *up++ = 128 + ((u_led[lx]*w[col]) >> 8);
+                                        *vp++ = 128 + ((v_led[lx]*w[col]) >> 8);
+                                }
+                        }
+                }
+        }
+}
+
+void video_exporter::upscale_rgb(const frame& f, uint8_t *buf) const
+{
+        unsigned lx, ly, row, col;
+        const uint16_t *w;
+        uint8_t *p = buf;
+
+        for (ly = 0; ly < frame::HEIGHT; ++ly) {
+                for (row = 0; row < cell_; ++row) {
+                        w = &sprite_[row*cell_];
+                        for (lx = 0; lx < frame::WIDTH; ++lx) {
+                                const pixel& px = f.at(lx, ly);
+                                for (col = 0; col < cell_; ++col) {
+                                        *p++ = (px.red()*w[col]) >> 8;
+                                        *p++ = (px.green()*w[col]) >> 8;
+                                        *p++ = (px.blue()*w[col]) >> 8;
+                                }
+                        }
+                }
+        }
+}
+
+bool video_exporter::write_frames(const vector<frame>& frames, FILE *out)
+{
+        // a few frames per worker per batch keeps every core busy without
+        // buffering the whole video
+        const size_t batch = 4*pool_.size();
+        const size_t bytes = frame_bytes();
+        vector<uint8_t> buf(batch*bytes);
+        size_t first, n, i;
+
+        for (first = 0; first < frames.size(); first += n) {
+                n = min(batch, frames.size() - first);
+
+                pool_.parallel_for(0, n, 1, [&](size_t lo, size_t hi) {
+                        for (size_t j = lo; j < hi; ++j)
+                                upscale(frames[first + j], &buf[j*bytes]);
+                });
+
+                for (i = 0; i < n; ++i) {
+                        if (fmt_ == Y4M && fputs("FRAME\n", out) == EOF)
+                                return false;
+                        if (fwrite(&buf[i*bytes], 1, bytes, out) != bytes)
+                                return false;
+                }
+        }
+        return true;
+}
@@ -0,0 +1,60 @@
+/**
+ * \file video_export.hpp
+ *
+ * \brief Turn rendered frames into a video stream that looks like the
+ * panel: every pixel becomes a round LED dot. Output is either YUV4MPEG2
+ * (4:2:0, which ffmpeg and most players read directly) or raw packed RGB.
+ *
+ * \detail The dot is a sprite of brightness weights computed once in the
+ * constructor. Scaling a color by a weight is linear in YUV too, so each
+ * LED's color is converted to YUV once and the sprite just scales it.
+ * Frames are upscaled in parallel on a task_pool, a batch at a time, and
+ * written in order.
+ */
+
+#pragma once
+
+#include "frame.hpp"
+#include "task_pool.hpp"
+
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+class video_exporter {
+public:
+        enum format { Y4M, RGB };
+
+        // size is the width and height of the output video in pixels and
+        // must be a multiple of 32 (of 64 for Y4M, so chroma planes line up
+        // with the LEDs). Throws std::invalid_argument on a bad size.
+        video_exporter(unsigned size, format fmt, unsigned frame_rate,
+                       task_pool& pool = task_pool::global());
+
+        // write the stream header. Call once before write_frames.
+        bool write_header(FILE *out);
+
+        // upscale frames and write them to out in order. Returns false if a
+        // write fails (e.g. the pipe was closed).
+        bool write_frames(const std::vector<frame>& frames, FILE *out);
+
+        // bytes of one upscaled frame, not counting any per-frame header
+        size_t frame_bytes() const;
+
+private:
+        // upscale one frame into buf, which holds frame_bytes() bytes
+        void upscale(const frame& f, uint8_t *buf) const;
+        void upscale_y4m(const frame& f, uint8_t *buf) const;
+        void upscale_rgb(const frame& f, uint8_t *buf) const;
+
+        const unsigned size_;
+        const unsigned cell_;
+        const format fmt_;
+        const unsigned frame_rate_;
+        task_pool& pool_;
+
+        // brightness of each pixel of one LED cell, 0-256. chroma_sprite_
+        // is the same at half resolution, for the 4:2:0 chroma planes
+        std::vector<uint16_t> sprite_;
+        std::vector<uint16_t> chroma_sprite_;
+};
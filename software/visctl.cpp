@@ -0,0 +1,60 @@
+/**
+ * \file visctl.cpp
+ *
+ * \brief Send one command to visualizer_daemon and print the reply, e.g.
+ *
+ *     ./visctl queue music.wav
+ *     ./visctl --socket /run/musicvis.sock generator static
+ */
+
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using namespace std;
+
+int main(int argc, char **argv)
+{
+        string path = "/tmp/musicvis.sock";
+        string line, reply;
+        sockaddr_un addr;
+        char buf[256];
+        ssize_t n;
+        int i = 1, fd;
+
+        if (argc > 2 && strcmp(argv[1], "--socket") == 0) {
+                path = argv[2];
+                i = 3;
+        }
+        if (i >= argc || path.size() >= sizeof addr.sun_path) {
+                cerr << "usage: " << argv[0] << " [--socket path] command "
+                     << "[args...]" << endl;
+                return 1;
+        }
+        for (; i < argc; ++i)
+                line += string(argv[i]) + (i + 1 < argc ? " " : "\n");
+
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        memset(&addr, 0, sizeof addr);
+        addr.sun_family = AF_UNIX;
+        strcpy(addr.sun_path, path.c_str());
+        if (fd < 0 || connect(fd, (sockaddr *)&addr, sizeof addr) < 0) {
+                cerr << "can't connect to " << path << ": "
+                     << strerror(errno) << endl;
+                return 1;
+        }
+
+        if (write(fd, line.data(), line.size()) < 0)
+                return 1;
+        while (reply.find('\n') == string::npos &&
+               (n = read(fd, buf, sizeof buf)) > 0)
+                reply.append(buf, n);
+        close(fd);
+
+        cout << reply;
+        return reply.compare(0, 2, "ok") == 0 ? 0 : 1;
+}
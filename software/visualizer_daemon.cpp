@@ -0,0 +1,312 @@
+/**
+ * \file visualizer_daemon.cpp
+ *
+ * \brief Long running player. The Pi's peripherals are set up and every
+ * generator is constructed once at startup; songs are then played from a
+ * queue controlled over a Unix domain socket, so changing songs doesn't
+ * pay for a cold start.
+ *
+ * \detail Commands are single lines; each gets one line back, starting
+ * with "ok" or "error".
+ *
+ *     play FILE           stop the current song and play FILE now
+ *     queue FILE          play FILE after the queued songs
+ *     stop                stop playing and clear the queue
+ *     generator NAME      switch generator, mid song if one is playing.
+ *                         expr:FILE compiles an expression program (see
+ *                         expr.hpp), again each time so edits show up.
+ *     plugin PATH         load a generator plugin (see plugin.hpp) and
+ *                         switch to it once it's ready. Loading the same
+ *                         path again picks up a rebuilt plugin.
+ *     set NAME VALUE      set a parameter of the current generator
+ *     status              current song, generator and queue length
+ *     quit                stop playing and exit
+ *
+ * visctl sends one command from the command line, or use e.g.
+ *     echo "queue song.wav" | socat - UNIX-CONNECT:/tmp/musicvis.sock
+ */
+
+#include "frame.hpp"
+#include "metrics.hpp"
+#include "player.hpp"
+#include "plugin.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using namespace std;
+
+static const char *const DEFAULT_SOCKET = "/tmp/musicvis.sock";
+
+class daemon_state {
+public:
+        daemon_state(player_options& opts);
+
+        // play songs off the queue until quit
+        void player_loop();
+
+        // run one command line, returning the reply
+        string command(const string& line);
+
+        bool quitting() const;
+
+private:
+        map<string, unique_ptr<frame_generator>> generators_;
+        string generator_name_;
+        generator_switch switch_;
+        plugin_host plugins_;
+
+        mutex lock_;
+        condition_variable wake_;
+        deque<string> queue_;
+        string playing_;
+        atomic<bool> quit_;
+        metric_gauge& queue_depth_;
+};
+
+daemon_state::daemon_state(player_options& opts)
+        : generators_(), generator_name_("scrolling"),
+          switch_(*(generators_["scrolling"] = make_generator("scrolling"))),
+          plugins_(switch_),
+          quit_(false),
+          queue_depth_(metrics_registry::global().gauge(
+                  "musicvis_queue_depth", "Songs waiting to be played."))
+{
+        generators_["static"] = make_generator("static");
+        generators_["bars"] = make_generator("bars");
+        generators_["chroma"] = make_generator("chroma");
+        generators_["melody"] = make_generator("melody");
+        generators_["particles"] = make_generator("particles");
+        attach_sinks(opts, switch_);
+}
+
+void daemon_state::player_loop()
+{
+        unique_lock<mutex> lock(lock_);
+        string song;
+        uint64_t stops;
+
+        for (;;) {
+                wake_.wait(lock, [this]() {
+                        return quit_ || !queue_.empty();
+                });
+                if (quit_)
+                        return;
+
+                song = queue_.front();
+                queue_.pop_front();
+                queue_depth_.set(queue_.size());
+                playing_ = song;
+                // under lock_, so a play, stop or quit from here on is
+                // seen by play_song even before it starts
+                stops = switch_.stops();
+
+                lock.unlock();
+                try {
+                        switch_.play_song(song, stops);
+                } catch (const runtime_error& e) {
+                        cerr << song << ": " << e.what() << endl;
+                }
+                // nothing's rendering; free generators replaced mid song
+                switch_.collect();
+                lock.lock();
+                playing_.clear();
+        }
+}
+
+bool daemon_state::quitting() const
+{
+        return quit_;
+}
+
+string daemon_state::command(const string& line)
+{
+        istringstream in(line);
+        string cmd, arg;
+        float value;
+
+        in >> cmd;
+        getline(in >> ws, arg);
+
+        lock_guard<mutex> lock(lock_);
+        if (cmd == "play" || cmd == "queue") {
+                // wav_reader exits the process on a file it can't parse,
+                // so check here rather than take the daemon down later
+                if (arg.empty() || !wav_reader::readable(arg))
+                        return "error can't read " + arg;
+                if (cmd == "play") {
+                        queue_.clear();
+                        queue_.push_front(arg);
+                        switch_.stop();
+                } else {
+                        queue_.push_back(arg);
+                }
+                wake_.notify_one();
+        } else if (cmd == "stop") {
+                queue_.clear();
+                switch_.stop();
+        } else if (cmd == "generator") {
+                auto it = generators_.find(arg);
+                if (arg.compare(0, 5, "expr:") == 0) {
+                        unique_ptr<frame_generator> gen;
+                        try {
+                                gen = make_generator(arg);
+                        } catch (const runtime_error& e) {
+                                return string("error ") + e.what();
+                        }
+                        // the old program may still be rendering, so
+                        // the switch frees it once it's done
+                        if (it != generators_.end()) {
+                                frame_generator& old = *it->second;
+                                switch_.retire(old, shared_ptr<void>(
+                                                       move(it->second)));
+                        }
+                        generators_[arg] = move(gen);
+                        it = generators_.find(arg);
+                }
+                if (it == generators_.end())
+                        return "error no generator " + arg;
+                switch_.switch_to(*it->second);
+                generator_name_ = arg;
+        } else if (cmd == "plugin") {
+                // loads in the background; failures are logged, and the
+                // current generator keeps going
+                if (arg.empty() || access(arg.c_str(), R_OK) != 0)
+                        return "error can't read " + arg;
+                plugins_.load(arg);
+                generator_name_ = "plugin:" + arg;
+        } else if (cmd == "set") {
+                istringstream args(arg);
+                string name;
+                if (!(args >> name >> value))
+                        return "error usage: set NAME VALUE";
+                switch_.set_parameter(name, value);
+        } else if (cmd == "status") {
+                ostringstream out;
+                out << "ok playing=" << (playing_.empty() ? "-" : playing_)
+                    << " generator=" << generator_name_
+                    << " queued=" << queue_.size();
+                return out.str();
+        } else if (cmd == "quit") {
+                quit_ = true;
+                queue_.clear();
+                switch_.stop();
+                wake_.notify_one();
+        } else {
+                return "error unknown command " + cmd;
+        }
+        queue_depth_.set(queue_.size());
+        return "ok";
+}
+
+// read command lines from one client until it hangs up
+static void serve_client(int fd, daemon_state& state)
+{
+        string buf, reply;
+        char chunk[256];
+        size_t nl;
+        ssize_t n;
+
+        while (!state.quitting() &&
+               (n = read(fd, chunk, sizeof chunk)) > 0) {
+                buf.append(chunk, n);
+                while ((nl = buf.find('\n')) != string::npos) {
+                        reply = state.command(buf.substr(0, nl)) + "\n";
+                        buf.erase(0, nl + 1);
+                        if (write(fd, reply.data(), reply.size()) < 0)
+                                return;
+                }
+        }
+}
+
+static int listen_unix(const string& path)
+{
+        sockaddr_un addr;
+        int fd;
+
+        if (path.size() >= sizeof addr.sun_path)
+                throw runtime_error("socket path too long");
+
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0)
+                throw runtime_error(string("socket: ") + strerror(errno));
+
+        memset(&addr, 0, sizeof addr);
+        addr.sun_family = AF_UNIX;
+        strcpy(addr.sun_path, path.c_str());
+        unlink(path.c_str());
+        if (bind(fd, (sockaddr *)&addr, sizeof addr) < 0 ||
+            listen(fd, 4) < 0) {
+                close(fd);
+                throw runtime_error("can't listen on " + path + ": "
+                                    + strerror(errno));
+        }
+        return fd;
+}
+
+int main(int argc, char **argv)
+{
+        string path = DEFAULT_SOCKET;
+        player_options opts;
+        vector<char *> args;
+        int i, fd, client;
+
+        // take --socket out and hand everything else to the usual player
+        // option parsing, with a dummy song
+        args.push_back(argv[0]);
+        args.push_back((char *)"-");
+        for (i = 1; i < argc; ++i) {
+                if (strcmp(argv[i], "--socket") == 0 && i+1 < argc)
+                        path = argv[++i];
+                else
+                        args.push_back(argv[i]);
+        }
+        if (!parse_player_args(args.size(), args.data(), opts)) {
+                cerr << "(" << argv[0] << " takes no song, but also "
+                     << "--socket path)" << endl;
+                return 1;
+        }
+
+        signal(SIGPIPE, SIG_IGN);
+
+        if (opts.use_spi)
+                init_display();
+        daemon_state state(opts);
+
+        try {
+                fd = listen_unix(path);
+        } catch (const runtime_error& e) {
+                cerr << e.what() << endl;
+                return 1;
+        }
+
+        thread player(&daemon_state::player_loop, &state);
+
+        while (!state.quitting()) {
+                client = accept(fd, NULL, NULL);
+                if (client < 0)
+                        continue;
+                serve_client(client, state);
+                close(client);
+        }
+
+        player.join();
+        close(fd);
+        unlink(path.c_str());
+        return 0;
+}
@@ -21,17 +21,81 @@
 #include <iterator>
 #include <fstream>
 #include <algorithm>
+#include <limits>
 using namespace std;
 
 #define CHUNK_SIZE_LENGTH 4
 #define CHUNK_ID_LENGTH 4
 
-wav_reader::wav_reader(string filename)
+static bool compress_by_default = false;
+
+bool wav_reader::default_compressed()
+{
+        return compress_by_default;
+}
+
+void wav_reader::set_default_compressed(bool compressed)
+{
+        compress_by_default = compressed;
+}
+
+// walk the chunks the constructor will read: a RIFF/WAVE header no bigger
+// than the file, PCM format first, mono or stereo at 8 or 16 bits, and
+// some data
+bool wav_reader::readable(const string& filename)
+{
+        ifstream in(filename, ios::binary);
+        uint64_t file_size, end, offset = 0;
+        uint32_t riff_size, size, rate;
+        uint16_t fmt[8];
+        char id[4];
+        bool format = false;
+
+        if (!in.seekg(0, ios::end))
+                return false;
+        file_size = in.tellg();
+        in.seekg(0);
+        if (!in.read(id, 4) || memcmp(id, "RIFF", 4) ||
+            !in.read((char *)&riff_size, 4) || !in.read(id, 4) ||
+            memcmp(id, "WAVE", 4) || riff_size < 4 ||
+            riff_size + 8ull > file_size)
+                return false;
+
+        // wav_reader trusts every chunk to fit
+        end = riff_size - 4;
+        while (offset + 8 <= end && in.read(id, 4) &&
+               in.read((char *)&size, 4)) {
+                if (offset + 8 + size > end)
+                        return false;
+                if (offset == 0) {
+                        if (memcmp(id, "fmt ", 4) || size < 16 ||
+                            !in.read((char *)fmt, 16))
+                                return false;
+                        memcpy(&rate, fmt + 2, 4);
+                        format = fmt[0] == 1 && rate > 0 &&
+                                (fmt[1] == 1 || fmt[1] == 2) &&
+                                (fmt[7] == 8 || fmt[7] == 16);
+                        in.seekg(size - 16, ios::cur);
+                } else if (!memcmp(id, "data", 4)) {
+                        return format && size >= fmt[1]*fmt[7]/8u;
+                } else {
+                        in.seekg(size, ios::cur);
+                }
+                offset += 8 + size;
+        }
+        return false;
+}
+
+wav_reader::wav_reader(string filename, bool compressed)
 {
     char* file_data;
     uint32_t file_size;
     size_t file_offset = 0;
 
+    max_sample_ = numeric_limits<int16_t>::min();
+    if (compressed)
+        packed_ = make_shared<sample_store>();
+
     ifstream file (filename, ios::binary | ios::in);
     if (file.is_open()) {
         // read in all of the file data
@@ -44,6 +108,8 @@ wav_reader::wav_reader(string filename)
         while (file_offset < file_size) {
             read_general_chunk(file_data, file_offset);
         }
+        if (packed_)
+            packed_->finish();
 
 
         delete[] file_data;
@@ -59,6 +125,22 @@ float wav_reader::max_sample() const
         return max_sample_;
 }
 
+unsigned wav_reader::sample_rate() const
+{
+        return fmt_chunk.dw_samples_per_sec;
+}
+
+size_t wav_reader::size() const
+{
+        return packed_ ? packed_->size() : samples_.size();
+}
+
+size_t wav_reader::sample_bytes() const
+{
+        return packed_ ? packed_->bytes() :
+                samples_.capacity()*sizeof(int16_t);
+}
+
 vector<float> wav_reader::get_range(chrono::microseconds start, 
             chrono::microseconds duration) const
 {
@@ -66,6 +148,15 @@ vector<float> wav_reader::get_range(chrono::microseconds start,
     const float samples_per_micros = float(fmt_chunk.dw_samples_per_sec) / 1000000;
     const uint32_t start_index = uint32_t(samples_per_micros * start.count());
     const uint32_t range_length = uint32_t(samples_per_micros * duration.count());
+    if (packed_) {
+            // only decode the blocks the range touches
+            if (start_index < size())
+                    samples_in_range.resize(min<size_t>(range_length,
+                                                        size() - start_index));
+            packed_->copy(start_index, samples_in_range.size(),
+                          samples_in_range.data());
+            return samples_in_range;
+    }
     for (uint32_t i = start_index; i < start_index + range_length; i++) {
             if (i >= samples_.size())
                     return samples_in_range;
@@ -78,6 +169,11 @@ vector<float> wav_reader::get_range(chrono::microseconds start,
 vector<float> wav_reader::get_all_samples() const
 {
         vector<float> samples;
+        if (packed_) {
+                samples.resize(packed_->size());
+                packed_->copy(0, samples.size(), samples.data());
+                return samples;
+        }
         copy(samples_.begin(), samples_.end(), back_inserter(samples));
         return samples;
 }
@@ -138,10 +234,16 @@ void wav_reader::read_general_chunk(char* file_data, size_t& file_offset)
     // if we are at the data chunk, get the data samples
     if (strcmp(id, "data") == 0) {
         num_samples_ = size;
+        // reserving the sample count up front saves copying a huge page
+        // backed buffer as it grows. The chunk size is in bytes, which is
+        // up to 4 times as many for 16 bit stereo.
+        if (!packed_)
+            samples_.reserve(num_samples_ /
+                             max<size_t>(1, fmt_chunk.w_block_align));
         if (fmt_chunk.w_channels == 1) {
             if (fmt_chunk.w_bits_per_sample == 8) {
                     for (size_t i = file_offset + 8; i < file_offset + 8 + num_samples_; i++) {
-                            samples_.push_back(uint8_t(file_data[i]));
+                            store_sample(uint8_t(file_data[i]));
                     }
             }
             else if (fmt_chunk.w_bits_per_sample == 16) {
@@ -150,7 +252,7 @@ void wav_reader::read_general_chunk(char* file_data, size_t& file_offset)
                             uint8_t byte1 = uint8_t(file_data[i]);
                             uint8_t byte2 = uint8_t(file_data[i + 1]);
                             int16_t sample = int16_t(byte2) << 8 | byte1;
-                            samples_.push_back(sample);
+                            store_sample(sample);
                     }
             }
         } else if (fmt_chunk.w_channels == 2) {
@@ -160,7 +262,7 @@ void wav_reader::read_general_chunk(char* file_data, size_t& file_offset)
                             uint8_t byte1 = uint8_t(file_data[i]);
                             uint8_t byte2 = uint8_t(file_data[i + 1]);
                             int16_t sample = (byte1 + byte2) / 2;
-                            samples_.push_back(sample);
+                            store_sample(sample);
                     }
             }
             else if (fmt_chunk.w_bits_per_sample == 16) {
@@ -173,14 +275,21 @@ void wav_reader::read_general_chunk(char* file_data, size_t& file_offset)
                             int16_t sample1 = int16_t(byte2) << 8 | byte1;
                             int16_t sample2 = int16_t(byte4) << 8 | byte3;
                             int16_t sample = (int32_t(sample1) + sample2) / 2;
-                            samples_.push_back(sample);
+                            store_sample(sample);
                     }
             }
         }
 
-        max_sample_ = float(*max_element(samples_.begin(), samples_.end()));
     }
 
     file_offset = file_offset + size + CHUNK_ID_LENGTH + CHUNK_SIZE_LENGTH;
 }
 
+void wav_reader::store_sample(int16_t sample)
+{
+        if (packed_)
+                packed_->push_back(sample);
+        else
+                samples_.push_back(sample);
+        max_sample_ = max(max_sample_, float(sample));
+}
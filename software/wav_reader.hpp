@@ -10,15 +10,31 @@
 #ifndef WAVREADER_HPP_INCLUDED
 #define WAVREADER_HPP_INCLUDED 1
 
+#include "aligned_allocator.hpp"
+#include "sample_store.hpp"
+
 #include <chrono>
+#include <memory>
 #include <string>
 #include <vector>
 
 class wav_reader {
     public:
-        wav_reader(std::string filename);
+        // compressed keeps the samples in a sample_store, at about two
+        // thirds of the memory, decoding them as get_range asks for them
+        wav_reader(std::string filename,
+                   bool compressed = default_compressed());
         wav_reader() = delete;
 
+        // whether songs are compressed unless the constructor is told
+        // otherwise. Off to start with.
+        static bool default_compressed();
+        static void set_default_compressed(bool compressed);
+
+        // the constructor exits the process on a file it can't parse, so
+        // check with this first when that matters
+        static bool readable(const std::string& filename);
+
         /**
         *   \brief Returns a vector containing all of the samples that fall
         *       into the time range spcified by start and duration.
@@ -33,6 +49,15 @@ class wav_reader {
 
         float max_sample() const;
 
+        // samples per second
+        unsigned sample_rate() const;
+
+        // samples in the song
+        size_t size() const;
+
+        // memory holding the samples
+        size_t sample_bytes() const;
+
         // return the entire song
         std::vector<float> get_all_samples() const;
     private:
@@ -67,7 +92,11 @@ class wav_reader {
 
         void read_general_chunk(char* file_data, size_t& file_offset);
 
-        std::vector<int16_t> samples_;  ///> the data samples themselves
+        // append a sample to whichever store we use
+        void store_sample(int16_t sample);
+
+        aligned_vector<int16_t> samples_;  ///> the data samples themselves
+        std::shared_ptr<sample_store> packed_;  ///> or, compressed, these
         size_t num_samples_;            ///> the number of samples
         float max_sample_;              ///> the largest sample
 };